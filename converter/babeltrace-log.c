@@ -42,9 +42,11 @@
 #include <errno.h>
 #include <string.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #include <babeltrace/babeltrace-internal.h>
 #include <babeltrace/ctf/types.h>
+#include <babeltrace/ctf/ctf-index.h>
 #include <babeltrace/compat/uuid.h>
 #include <babeltrace/compat/utc.h>
 #include <babeltrace/endian.h>
@@ -54,13 +56,50 @@
 #define NSEC_PER_SEC 1000000000ULL
 #define USEC_PER_SEC 1000000UL
 
+/* Bulk mode: input block and default packet sizes, in bytes */
+#define BULK_READ_LEN		(4 * 1024 * 1024)
+#define BULK_PACKET_LEN		(1024 * 1024)
+#define MAX_PARSE_THREADS	64
+/* Smaller blocks of lines are not worth handing to the parser threads */
+#define PARALLEL_PARSE_MIN_LINES	1024
+
 int babeltrace_debug, babeltrace_verbose;
 
 static char *s_outputname;
 static int s_timestamp;
 static int s_help;
+static int s_bulk;
+static unsigned int s_nr_threads = 1;
+static uint64_t s_packet_len = BULK_PACKET_LEN;
 static unsigned char s_uuid[BABELTRACE_UUID_LEN];
 
+/* A line of the bulk mode input block, NUL-terminated in place */
+struct log_line {
+	char *line;
+	size_t len;		/* including the terminating NUL */
+	char *text;		/* start of text, after the timestamp */
+	size_t text_len;	/* including the terminating NUL */
+	uint64_t ts;
+};
+
+struct parse_work {
+	pthread_t thread;
+	struct log_line *lines;
+	size_t nr_lines;
+};
+
+/* State of the bulk mode packet index, written to index/datastream.idx */
+struct bulk_index {
+	int fd;			/* -1 if no index is written */
+	int dir_fd;
+	uint64_t nr_events;	/* in the current packet */
+	uint64_t timestamp_begin;
+	uint64_t timestamp_end;
+};
+
+/* babeltrace_timegm() may temporarily modify the TZ environment variable. */
+static pthread_mutex_t timegm_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* Metadata format string */
 static const char metadata_fmt[] =
 "/* CTF 1.8 */\n"
@@ -196,6 +235,62 @@ error:
 	abort();
 }
 
+/*
+ * Extract the timestamp of a line. On success, "tline" and "tlen" are set
+ * to the text following the timestamp. May be called concurrently.
+ */
+static
+int parse_timestamp(char *line, char **tline, size_t len, size_t *tlen,
+		uint64_t *ts)
+{
+	int has_timestamp = 0;
+	unsigned long sec, usec, msec;
+	unsigned int year, mon, mday, hour, min;
+
+	/* Extract time from input line */
+	if (sscanf(line, "[%lu.%lu] ", &sec, &usec) == 2) {
+		*ts = (uint64_t) sec * USEC_PER_SEC + (uint64_t) usec;
+		/*
+		 * Default CTF clock has 1GHz frequency. Convert
+		 * from usec to nsec.
+		 */
+		*ts *= NSEC_PER_USEC;
+		has_timestamp = 1;
+	} else if (sscanf(line, "[%u-%u-%u %u:%u:%lu.%lu] ",
+			&year, &mon, &mday, &hour, &min,
+			&sec, &msec) == 7) {
+		time_t ep_sec;
+		struct tm ti;
+
+		memset(&ti, 0, sizeof(ti));
+		ti.tm_year = year - 1900;	/* from 1900 */
+		ti.tm_mon = mon - 1;		/* 0 to 11 */
+		ti.tm_mday = mday;
+		ti.tm_hour = hour;
+		ti.tm_min = min;
+		ti.tm_sec = sec;
+
+		pthread_mutex_lock(&timegm_lock);
+		ep_sec = babeltrace_timegm(&ti);
+		pthread_mutex_unlock(&timegm_lock);
+		if (ep_sec != (time_t) -1) {
+			*ts = (uint64_t) ep_sec * NSEC_PER_SEC
+				+ (uint64_t) msec * NSEC_PER_MSEC;
+		}
+		has_timestamp = 1;
+	}
+	if (has_timestamp) {
+		*tline = strchr(line, ']');
+		assert(*tline);
+		(*tline)++;
+		if ((*tline)[0] == ' ') {
+			(*tline)++;
+		}
+		*tlen = len + line - *tline;
+	}
+	return has_timestamp;
+}
+
 static
 void write_event_header(struct ctf_stream_pos *pos, char *line,
 			char **tline, size_t len, size_t *tlen,
@@ -205,51 +300,9 @@ void write_event_header(struct ctf_stream_pos *pos, char *line,
 		return;
 
 	/* Only need to be executed on first pass (dummy) */
-	if (pos->dummy)	{
-		int has_timestamp = 0;
-		unsigned long sec, usec, msec;
-		unsigned int year, mon, mday, hour, min;
-
-		/* Extract time from input line */
-		if (sscanf(line, "[%lu.%lu] ", &sec, &usec) == 2) {
-			*ts = (uint64_t) sec * USEC_PER_SEC + (uint64_t) usec;
-			/*
-			 * Default CTF clock has 1GHz frequency. Convert
-			 * from usec to nsec.
-			 */
-			*ts *= NSEC_PER_USEC;
-			has_timestamp = 1;
-		} else if (sscanf(line, "[%u-%u-%u %u:%u:%lu.%lu] ",
-				&year, &mon, &mday, &hour, &min,
-				&sec, &msec) == 7) {
-			time_t ep_sec;
-			struct tm ti;
-
-			memset(&ti, 0, sizeof(ti));
-			ti.tm_year = year - 1900;	/* from 1900 */
-			ti.tm_mon = mon - 1;		/* 0 to 11 */
-			ti.tm_mday = mday;
-			ti.tm_hour = hour;
-			ti.tm_min = min;
-			ti.tm_sec = sec;
-
-			ep_sec = babeltrace_timegm(&ti);
-			if (ep_sec != (time_t) -1) {
-				*ts = (uint64_t) ep_sec * NSEC_PER_SEC
-					+ (uint64_t) msec * NSEC_PER_MSEC;
-			}
-			has_timestamp = 1;
-		}
-		if (has_timestamp) {
-			*tline = strchr(line, ']');
-			assert(*tline);
-			(*tline)++;
-			if ((*tline)[0] == ' ') {
-				(*tline)++;
-			}
-			*tlen = len + line - *tline;
-		}
-	}
+	if (pos->dummy)
+		(void) parse_timestamp(line, tline, len, tlen, ts);
+
 	/* timestamp */
 	if (!ctf_align_pos(pos, sizeof(uint64_t) * CHAR_BIT))
 		goto error;
@@ -325,6 +378,10 @@ void trace_text(FILE *input, int output)
 		fprintf(stderr, "Error in ctf_init_pos\n");
 		return;
 	}
+	ctf_packet_seek(&pos.parent, 0, SEEK_SET);
+	if (pos.offset == EOF) {
+		goto end;
+	}
 	write_packet_header(&pos, s_uuid);
 	write_packet_context(&pos);
 	for (;;) {
@@ -339,12 +396,319 @@ void trace_text(FILE *input, int output)
 			trace_string(line, &pos, strlen(line) + 1);
 		}
 	}
+end:
 	ret = ctf_fini_pos(&pos);
 	if (ret) {
 		fprintf(stderr, "Error in ctf_fini_pos\n");
 	}
 }
 
+static
+void parse_lines(struct log_line *lines, size_t nr_lines)
+{
+	size_t i;
+
+	for (i = 0; i < nr_lines; i++) {
+		struct log_line *line = &lines[i];
+
+		line->text = line->line;
+		line->text_len = line->len;
+		line->ts = 0;
+		if (s_timestamp)
+			(void) parse_timestamp(line->line, &line->text,
+				line->len, &line->text_len, &line->ts);
+	}
+}
+
+static
+void *parse_lines_thread(void *data)
+{
+	struct parse_work *work = data;
+
+	parse_lines(work->lines, work->nr_lines);
+	return NULL;
+}
+
+/*
+ * Extract the timestamps of a block of lines, splitting the block
+ * between the parser threads. The calling thread parses the first part.
+ */
+static
+void bulk_parse_lines(struct log_line *lines, size_t nr_lines)
+{
+	struct parse_work work[MAX_PARSE_THREADS];
+	unsigned int i, nr_threads = s_nr_threads;
+	size_t chunk;
+
+	if (!s_timestamp || nr_threads <= 1 ||
+			nr_lines < PARALLEL_PARSE_MIN_LINES) {
+		parse_lines(lines, nr_lines);
+		return;
+	}
+
+	chunk = (nr_lines + nr_threads - 1) / nr_threads;
+	for (i = 0; i < nr_threads; i++) {
+		size_t begin = i * chunk < nr_lines ? i * chunk : nr_lines;
+
+		work[i].lines = &lines[begin];
+		work[i].nr_lines = nr_lines - begin < chunk ?
+			nr_lines - begin : chunk;
+	}
+	for (i = 1; i < nr_threads; i++) {
+		if (pthread_create(&work[i].thread, NULL, parse_lines_thread,
+				&work[i])) {
+			/* Parse this part once the others are done. */
+			work[i].thread = pthread_self();
+		}
+	}
+	parse_lines(work[0].lines, work[0].nr_lines);
+	for (i = 1; i < nr_threads; i++) {
+		if (pthread_equal(work[i].thread, pthread_self()))
+			parse_lines(work[i].lines, work[i].nr_lines);
+		else
+			pthread_join(work[i].thread, NULL);
+	}
+}
+
+static
+void bulk_index_disable(struct bulk_index *index)
+{
+	if (index->fd < 0)
+		return;
+	/* An incomplete index would hide packets from the reader. */
+	if (close(index->fd))
+		perror("close");
+	if (unlinkat(index->dir_fd, "index/datastream.idx", 0))
+		perror("unlinkat");
+	index->fd = -1;
+}
+
+static
+void bulk_index_init(struct bulk_index *index, int fd, int dir_fd)
+{
+	struct ctf_packet_index_file_hdr hdr;
+
+	index->fd = fd;
+	index->dir_fd = dir_fd;
+	index->nr_events = 0;
+	if (fd < 0)
+		return;
+
+	hdr.magic = htobe32(CTF_INDEX_MAGIC);
+	hdr.index_major = htobe32(CTF_INDEX_MAJOR);
+	hdr.index_minor = htobe32(CTF_INDEX_MINOR);
+	hdr.packet_index_len = htobe32(sizeof(struct ctf_packet_index));
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		perror("write");
+		bulk_index_disable(index);
+	}
+}
+
+/* Add the current packet to the index; must be called before leaving it. */
+static
+void bulk_index_add_packet(struct ctf_stream_pos *pos,
+		struct bulk_index *index)
+{
+	struct ctf_packet_index entry;
+
+	if (index->fd < 0)
+		return;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.offset = htobe64(pos->mmap_offset);
+	entry.packet_size = htobe64(pos->packet_size);
+	entry.content_size = htobe64(pos->offset);
+	if (index->nr_events) {
+		entry.timestamp_begin = htobe64(index->timestamp_begin);
+		entry.timestamp_end = htobe64(index->timestamp_end);
+	}
+	if (write(index->fd, &entry, sizeof(entry)) != sizeof(entry)) {
+		perror("write");
+		bulk_index_disable(index);
+	}
+}
+
+static
+void bulk_open_packet(struct ctf_stream_pos *pos, struct bulk_index *index)
+{
+	write_packet_header(pos, s_uuid);
+	write_packet_context(pos);
+	index->nr_events = 0;
+}
+
+/*
+ * Serialize a parsed line in the current packet, moving to a new packet
+ * if it does not fit. Unlike trace_string(), the event size is computed
+ * directly instead of being serialized in a dummy position first.
+ */
+static
+void bulk_trace_line(struct ctf_stream_pos *pos, struct bulk_index *index,
+		struct log_line *line)
+{
+	uint64_t len = (uint64_t) line->text_len * CHAR_BIT, offset;
+
+	for (;;) {
+		offset = pos->offset;
+		if (s_timestamp) {
+			offset += offset_align(offset,
+				sizeof(uint64_t) * CHAR_BIT);
+			offset += sizeof(uint64_t) * CHAR_BIT;
+		}
+		if (offset + len <= pos->packet_size)
+			break;
+		if (!index->nr_events) {
+			fprintf(stderr, "[Error] Line too large for packet size (%" PRIu64 "kB) (discarded)\n",
+				pos->packet_size / CHAR_BIT / 1024);
+			return;
+		}
+		bulk_index_add_packet(pos, index);
+		ctf_pos_pad_packet(pos);
+		bulk_open_packet(pos, index);
+	}
+
+	if (s_timestamp) {
+		if (!ctf_align_pos(pos, sizeof(uint64_t) * CHAR_BIT))
+			goto error;
+		*(uint64_t *) ctf_get_pos_addr(pos) = line->ts;
+		if (!ctf_move_pos(pos, sizeof(uint64_t) * CHAR_BIT))
+			goto error;
+	}
+	memcpy(ctf_get_pos_addr(pos), line->text, line->text_len);
+	if (!ctf_move_pos(pos, len))
+		goto error;
+
+	if (!index->nr_events++)
+		index->timestamp_begin = line->ts;
+	index->timestamp_end = line->ts;
+	return;
+
+error:
+	fprintf(stderr, "[error] Out of packet bounds when writing event\n");
+	abort();
+}
+
+/*
+ * Bulk mode: read the input in large blocks, split them into lines with
+ * memchr(), extract the timestamps of a whole block (in parallel if
+ * requested) and serialize its lines in large packets.
+ */
+static
+void trace_text_bulk(int input, int output, int index_fd, int dir_fd)
+{
+	struct ctf_stream_pos pos;
+	struct bulk_index index;
+	struct log_line *lines = NULL;
+	size_t buf_size = BULK_READ_LEN, filled = 0, nr_alloc = 0;
+	char *buf;
+	int eof = 0, ret;
+
+	/* One extra byte terminates a last line without newline. */
+	buf = malloc(buf_size + 1);
+	if (!buf) {
+		perror("malloc");
+		return;
+	}
+
+	memset(&pos, 0, sizeof(pos));
+	ret = ctf_init_pos(&pos, NULL, output, O_RDWR);
+	if (ret) {
+		fprintf(stderr, "Error in ctf_init_pos\n");
+		goto end;
+	}
+	pos.next_packet_size = s_packet_len * CHAR_BIT;
+	ctf_packet_seek(&pos.parent, 0, SEEK_SET);
+	if (pos.offset == EOF) {
+		(void) ctf_fini_pos(&pos);
+		goto end;
+	}
+	bulk_index_init(&index, index_fd, dir_fd);
+	bulk_open_packet(&pos, &index);
+
+	while (!eof) {
+		size_t i, nr_lines = 0, consumed;
+		char *line, *end;
+
+		while (filled < buf_size) {
+			ssize_t len;
+
+			len = read(input, buf + filled, buf_size - filled);
+			if (len < 0 && errno == EINTR)
+				continue;
+			if (len < 0)
+				perror("read");
+			if (len <= 0) {
+				eof = 1;
+				break;
+			}
+			filled += len;
+		}
+
+		line = buf;
+		end = buf + filled;
+		while (line < end) {
+			char *nl = memchr(line, '\n', end - line);
+
+			if (!nl) {
+				/* Incomplete line, unless at end of input */
+				if (!eof)
+					break;
+				nl = end;
+			}
+			*nl = '\0';
+			if (nr_lines == nr_alloc) {
+				struct log_line *new_lines;
+
+				nr_alloc = nr_alloc ? nr_alloc * 2 : 4096;
+				new_lines = realloc(lines,
+					nr_alloc * sizeof(*lines));
+				if (!new_lines) {
+					perror("realloc");
+					goto end_pos;
+				}
+				lines = new_lines;
+			}
+			printf_debug("read: %s\n", line);
+			lines[nr_lines].line = line;
+			lines[nr_lines].len = nl - line + 1;
+			nr_lines++;
+			line = nl + 1;
+		}
+		bulk_parse_lines(lines, nr_lines);
+		for (i = 0; i < nr_lines; i++)
+			bulk_trace_line(&pos, &index, &lines[i]);
+
+		if (eof)
+			break;
+		consumed = line - buf;
+		if (!consumed) {
+			char *new_buf;
+
+			/* Line larger than the buffer */
+			buf_size *= 2;
+			new_buf = realloc(buf, buf_size + 1);
+			if (!new_buf) {
+				perror("realloc");
+				goto end_pos;
+			}
+			buf = new_buf;
+		} else {
+			memmove(buf, buf + consumed, filled - consumed);
+			filled -= consumed;
+		}
+	}
+end_pos:
+	bulk_index_add_packet(&pos, &index);
+	ret = ctf_fini_pos(&pos);
+	if (ret) {
+		fprintf(stderr, "Error in ctf_fini_pos\n");
+	}
+	if (index.fd >= 0 && close(index.fd))
+		perror("close");
+end:
+	free(lines);
+	free(buf);
+}
+
 static
 void usage(FILE *fp)
 {
@@ -358,6 +722,11 @@ void usage(FILE *fp)
 	fprintf(fp, "\n");
 	fprintf(fp, "  -t                             With timestamps (format: [sec.usec] string\\n)\n");
 	fprintf(fp, "                                                 (format: [YYYY-MM-DD HH:MM:SS.MS] string\\n)\n");
+	fprintf(fp, "  -b                             Bulk mode: read the input in large blocks and write\n");
+	fprintf(fp, "                                 large packets along with a packet index\n");
+	fprintf(fp, "  -p SIZE                        Bulk mode packet size, in kB (default: %d)\n",
+		BULK_PACKET_LEN / 1024);
+	fprintf(fp, "  -j THREADS                     Bulk mode timestamp parser threads (default: 1)\n");
 	fprintf(fp, "\n");
 }
 
@@ -369,7 +738,22 @@ int parse_args(int argc, char **argv)
 	for (i = 1; i < argc; i++) {
 		if (!strcmp(argv[i], "-t"))
 			s_timestamp = 1;
-		else if (!strcmp(argv[i], "-h")) {
+		else if (!strcmp(argv[i], "-b"))
+			s_bulk = 1;
+		else if (!strcmp(argv[i], "-p")) {
+			if (++i == argc)
+				return -EINVAL;
+			s_packet_len = strtoull(argv[i], NULL, 0) * 1024;
+			/* Room for the packet header and context */
+			if (s_packet_len < getpagesize())
+				return -EINVAL;
+		} else if (!strcmp(argv[i], "-j")) {
+			if (++i == argc)
+				return -EINVAL;
+			s_nr_threads = strtoul(argv[i], NULL, 0);
+			if (!s_nr_threads || s_nr_threads > MAX_PARSE_THREADS)
+				return -EINVAL;
+		} else if (!strcmp(argv[i], "-h")) {
 			s_help = 1;
 			return 0;
 		} else if (argv[i][0] == '-')
@@ -384,7 +768,7 @@ int parse_args(int argc, char **argv)
 
 int main(int argc, char **argv)
 {
-	int fd, metadata_fd, ret;
+	int fd, metadata_fd, index_fd = -1, ret;
 	DIR *dir;
 	int dir_fd;
 	FILE *metadata_fp;
@@ -439,7 +823,22 @@ int main(int argc, char **argv)
 
 	babeltrace_uuid_generate(s_uuid);
 	print_metadata(metadata_fp);
-	trace_text(stdin, fd);
+	if (s_bulk) {
+		/*
+		 * The packet index is optional: without it, the reader
+		 * indexes the stream itself.
+		 */
+		if (mkdirat(dir_fd, "index", S_IRWXU|S_IRWXG) == 0) {
+			index_fd = openat(dir_fd, "index/datastream.idx",
+				O_WRONLY|O_CREAT|O_TRUNC,
+				S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP);
+		}
+		if (index_fd < 0)
+			perror("[warning] Cannot create packet index");
+		trace_text_bulk(STDIN_FILENO, fd, index_fd, dir_fd);
+	} else {
+		trace_text(stdin, fd);
+	}
 
 	ret = close(fd);
 	if (ret)
@@ -36,9 +36,11 @@
 #include <babeltrace/ctf/events.h>
 /* TODO: fix object model for format-agnostic callbacks */
 #include <babeltrace/ctf/events-internal.h>
+#include <babeltrace/ctf/metadata.h>
 #include <babeltrace/ctf/iterator.h>
 #include <babeltrace/ctf-text/types.h>
 #include <babeltrace/iterator.h>
+#include <babeltrace/bench-internal.h>
 #include <popt.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -50,6 +52,7 @@
 #include <inttypes.h>
 #include <ftw.h>
 #include <string.h>
+#include <limits.h>
 
 #include <babeltrace/ctf-ir/metadata.h>	/* for clocks */
 
@@ -57,6 +60,8 @@
 
 #define DEFAULT_FILE_ARRAY_SIZE	1
 
+#define NSEC_PER_SEC	1000000000ULL
+
 #define NET_URL_PREFIX	"net://"
 #define NET4_URL_PREFIX	"net4://"
 #define NET6_URL_PREFIX	"net6://"
@@ -72,6 +77,9 @@ static char *opt_input_format, *opt_output_format;
  */
 static GPtrArray *opt_input_paths;
 static char *opt_output_path;
+static int opt_stats;
+static int opt_begin_set, opt_end_set;
+static uint64_t opt_begin, opt_end;	/* in ns */
 
 static struct bt_format *fmt_read;
 
@@ -103,6 +111,18 @@ enum {
 	OPT_CLOCK_DATE,
 	OPT_CLOCK_GMT,
 	OPT_CLOCK_FORCE_CORRELATE,
+	OPT_BENCH,
+	OPT_MMAP_POPULATE,
+	OPT_MMAP_HUGEPAGE,
+	OPT_READAHEAD,
+	OPT_PREFETCH,
+	OPT_MAX_OPEN_FILES,
+	OPT_MAX_MAPPED_SIZE,
+	OPT_LAZY_OPEN,
+	OPT_STATS,
+	OPT_BEGIN,
+	OPT_END,
+	OPT_STREAMS,
 };
 
 /*
@@ -132,6 +152,18 @@ static struct poptOption long_options[] = {
 	{ "clock-date", 0, POPT_ARG_NONE, NULL, OPT_CLOCK_DATE, NULL, NULL },
 	{ "clock-gmt", 0, POPT_ARG_NONE, NULL, OPT_CLOCK_GMT, NULL, NULL },
 	{ "clock-force-correlate", 0, POPT_ARG_NONE, NULL, OPT_CLOCK_FORCE_CORRELATE, NULL, NULL },
+	{ "bench", 0, POPT_ARG_NONE, NULL, OPT_BENCH, NULL, NULL },
+	{ "mmap-populate", 0, POPT_ARG_NONE, NULL, OPT_MMAP_POPULATE, NULL, NULL },
+	{ "mmap-hugepage", 0, POPT_ARG_NONE, NULL, OPT_MMAP_HUGEPAGE, NULL, NULL },
+	{ "readahead", 0, POPT_ARG_STRING, NULL, OPT_READAHEAD, NULL, NULL },
+	{ "prefetch", 0, POPT_ARG_STRING, NULL, OPT_PREFETCH, NULL, NULL },
+	{ "max-open-files", 0, POPT_ARG_STRING, NULL, OPT_MAX_OPEN_FILES, NULL, NULL },
+	{ "max-mapped-size", 0, POPT_ARG_STRING, NULL, OPT_MAX_MAPPED_SIZE, NULL, NULL },
+	{ "lazy-open", 0, POPT_ARG_NONE, NULL, OPT_LAZY_OPEN, NULL, NULL },
+	{ "stats", 0, POPT_ARG_NONE, NULL, OPT_STATS, NULL, NULL },
+	{ "begin", 0, POPT_ARG_STRING, NULL, OPT_BEGIN, NULL, NULL },
+	{ "end", 0, POPT_ARG_STRING, NULL, OPT_END, NULL, NULL },
+	{ "streams", 0, POPT_ARG_STRING, NULL, OPT_STREAMS, NULL, NULL },
 	{ NULL, 0, 0, NULL, 0, NULL, NULL },
 };
 
@@ -177,10 +209,66 @@ static void usage(FILE *fp)
 	fprintf(fp, "      --clock-gmt                Print clock in GMT time zone (default: local time zone)\n");
 	fprintf(fp, "      --clock-force-correlate    Assume that clocks are inherently correlated\n");
 	fprintf(fp, "                                 across traces.\n");
+	fprintf(fp, "      --bench                    Report decoding throughput and time spent per phase\n");
+	fprintf(fp, "                                 on stderr (default output format: dummy)\n");
+	fprintf(fp, "      --mmap-populate            Pre-fault the pages of each packet when mapping it\n");
+	fprintf(fp, "      --mmap-hugepage            Use huge pages for packet mappings of 2 MiB or more\n");
+	fprintf(fp, "      --readahead packets        Read ahead this many packets after the current one\n");
+	fprintf(fp, "                                 in each stream (default: 0)\n");
+	fprintf(fp, "      --prefetch packets         Read this many packets after the current one in each\n");
+	fprintf(fp, "                                 stream from background threads (default: 0)\n");
+	fprintf(fp, "      --max-open-files count     Keep at most this many stream files open, reopening\n");
+	fprintf(fp, "                                 them on demand (default: no limit)\n");
+	fprintf(fp, "      --max-mapped-size kB       Keep at most this many kB of packets mapped, remapping\n");
+	fprintf(fp, "                                 them on demand (default: no limit)\n");
+	fprintf(fp, "      --lazy-open                Only index stream files and create their definitions\n");
+	fprintf(fp, "                                 when they are first read\n");
+	fprintf(fp, "      --stats                    Print event counts, bytes, first/last timestamps and\n");
+	fprintf(fp, "                                 discarded events per stream and event class, without\n");
+	fprintf(fp, "                                 decoding event payloads\n");
+	fprintf(fp, "      --begin sec[.ns]           Only output events from this timestamp on\n");
+	fprintf(fp, "      --end sec[.ns]             Only output events up to this timestamp\n");
+	fprintf(fp, "                                 (timestamps as printed with --clock-seconds)\n");
+	fprintf(fp, "      --streams id|path<,...>    ctf output: only copy these streams, given by stream\n");
+	fprintf(fp, "                                 id or stream file path (default: all streams)\n");
 	list_formats(fp);
 	fprintf(fp, "\n");
 }
 
+/*
+ * Parse a "sec[.ns]" timestamp into nanoseconds.
+ */
+static int parse_timestamp(const char *str, uint64_t *timestamp)
+{
+	uint64_t sec, nsec = 0;
+	char *endptr;
+	int digits = 0;
+
+	if (!isdigit((int) str[0]))
+		return -EINVAL;
+	errno = 0;
+	sec = strtoull(str, &endptr, 10);
+	if (str == endptr || errno != 0)
+		return -EINVAL;
+	if (*endptr == '.') {
+		for (endptr++; isdigit((int) *endptr); endptr++) {
+			if (++digits > 9)
+				return -EINVAL;
+			nsec = nsec * 10 + (*endptr - '0');
+		}
+		if (!digits)
+			return -EINVAL;
+		for (; digits < 9; digits++)
+			nsec *= 10;
+	}
+	if (*endptr != '\0')
+		return -EINVAL;
+	if (sec > (UINT64_MAX - nsec) / NSEC_PER_SEC)
+		return -ERANGE;
+	*timestamp = sec * NSEC_PER_SEC + nsec;
+	return 0;
+}
+
 static int get_names_args(poptContext *pc)
 {
 	char *str, *strlist, *strctx;
@@ -262,6 +350,32 @@ end:
 	return ret;
 }
 
+/*
+ * Parse the argument of option "name" as an unsigned integer no greater
+ * than max.
+ */
+static int get_uint_arg(poptContext *pc, const char *name, uint64_t max,
+		uint64_t *value)
+{
+	char *str, *endptr;
+	int ret = 0;
+
+	str = (char *) poptGetOptArg(*pc);
+	if (!str) {
+		fprintf(stderr, "[error] Missing --%s argument\n", name);
+		return -EINVAL;
+	}
+	errno = 0;
+	*value = strtoull(str, &endptr, 0);
+	if (*endptr != '\0' || str == endptr || errno != 0 || *value > max) {
+		fprintf(stderr, "[error] Incorrect --%s argument: %s\n",
+			name, str);
+		ret = -EINVAL;
+	}
+	free(str);
+	return ret;
+}
+
 /*
  * Return 0 if caller should continue, < 0 if caller should return
  * error, > 0 if caller should exit without reporting error.
@@ -396,6 +510,97 @@ static int parse_options(int argc, char **argv)
 		case OPT_CLOCK_FORCE_CORRELATE:
 			opt_clock_force_correlate = 1;
 			break;
+		case OPT_BENCH:
+			babeltrace_bench = 1;
+			break;
+		case OPT_MMAP_POPULATE:
+			babeltrace_mmap_populate = 1;
+			break;
+		case OPT_MMAP_HUGEPAGE:
+			babeltrace_mmap_hugepage = 1;
+			break;
+		case OPT_READAHEAD:
+		{
+			uint64_t packets;
+
+			ret = get_uint_arg(&pc, "readahead", UINT_MAX,
+					&packets);
+			if (ret)
+				goto end;
+			babeltrace_readahead = packets;
+			break;
+		}
+		case OPT_PREFETCH:
+		{
+			uint64_t packets;
+
+			ret = get_uint_arg(&pc, "prefetch", UINT_MAX,
+					&packets);
+			if (ret)
+				goto end;
+			babeltrace_prefetch = packets;
+			break;
+		}
+		case OPT_MAX_OPEN_FILES:
+		{
+			uint64_t files;
+
+			ret = get_uint_arg(&pc, "max-open-files", UINT_MAX,
+					&files);
+			if (ret)
+				goto end;
+			babeltrace_max_open_files = files;
+			break;
+		}
+		case OPT_MAX_MAPPED_SIZE:
+			ret = get_uint_arg(&pc, "max-mapped-size",
+					UINT64_MAX >> 10,
+					&babeltrace_max_mapped_size);
+			if (ret)
+				goto end;
+			babeltrace_max_mapped_size <<= 10;
+			break;
+		case OPT_LAZY_OPEN:
+			babeltrace_lazy_open = 1;
+			break;
+		case OPT_STATS:
+			opt_stats = 1;
+			opt_skip_payload = 1;
+			break;
+		case OPT_BEGIN:
+		case OPT_END:
+		{
+			const char *name = opt == OPT_BEGIN ? "begin" : "end";
+			char *str;
+
+			str = (char *) poptGetOptArg(pc);
+			if (!str) {
+				fprintf(stderr, "[error] Missing --%s argument\n", name);
+				ret = -EINVAL;
+				goto end;
+			}
+			if (parse_timestamp(str, opt == OPT_BEGIN ?
+					&opt_begin : &opt_end)) {
+				fprintf(stderr, "[error] Incorrect --%s argument: %s\n", name, str);
+				ret = -EINVAL;
+				free(str);
+				goto end;
+			}
+			if (opt == OPT_BEGIN)
+				opt_begin_set = 1;
+			else
+				opt_end_set = 1;
+			free(str);
+			break;
+		}
+		case OPT_STREAMS:
+			opt_copy_streams = (char *) poptGetOptArg(pc);
+			if (!opt_copy_streams) {
+				fprintf(stderr, "[error] Missing --streams argument\n");
+				ret = -EINVAL;
+				goto end;
+			}
+			break;
 
 		default:
 			ret = -EINVAL;
@@ -412,6 +617,11 @@ static int parse_options(int argc, char **argv)
 		ret = -EINVAL;
 		goto end;
 	}
+	if (opt_begin_set && opt_end_set && opt_begin > opt_end) {
+		fprintf(stderr, "[error] --begin timestamp is after --end timestamp\n");
+		ret = -EINVAL;
+		goto end;
+	}
 
 end:
 	if (pc) {
@@ -617,13 +827,29 @@ end:
 	return ret;
 }
 
+/*
+ * Convert a timestamp given on the command line, which includes the
+ * command-line clock offsets like printed timestamps, to the trace time
+ * base.
+ */
+static
+uint64_t option_timestamp(uint64_t timestamp)
+{
+	uint64_t offset;
+
+	offset = opt_clock_offset * NSEC_PER_SEC + opt_clock_offset_ns;
+	if (timestamp < offset)
+		return 0;
+	return timestamp - offset;
+}
+
 static
 int convert_trace(struct bt_trace_descriptor *td_write,
 		  struct bt_context *ctx)
 {
 	struct bt_ctf_iter *iter;
 	struct ctf_text_stream_pos *sout;
-	struct bt_iter_pos begin_pos;
+	struct bt_iter_pos begin_pos, end_pos;
 	struct bt_ctf_event *ctf_event;
 	int ret;
 
@@ -633,14 +859,29 @@ int convert_trace(struct bt_trace_descriptor *td_write,
 	if (!sout->parent.event_cb)
 		return 0;
 
-	begin_pos.type = BT_SEEK_BEGIN;
-	iter = bt_ctf_iter_create(ctx, &begin_pos, NULL);
+	if (opt_begin_set) {
+		begin_pos.type = BT_SEEK_TIME;
+		begin_pos.u.seek_time = option_timestamp(opt_begin);
+	} else {
+		begin_pos.type = BT_SEEK_BEGIN;
+	}
+	end_pos.type = BT_SEEK_TIME;
+	end_pos.u.seek_time = option_timestamp(opt_end);
+	/* Range within which the ctf output copies packets verbatim. */
+	opt_trim_begin = opt_begin_set ? begin_pos.u.seek_time : 0;
+	opt_trim_end = opt_end_set ? end_pos.u.seek_time : -1ULL;
+	iter = bt_ctf_iter_create(ctx, &begin_pos,
+			opt_end_set ? &end_pos : NULL);
 	if (!iter) {
 		ret = -1;
 		goto error_iter;
 	}
 	while ((ctf_event = bt_ctf_iter_read_event(iter))) {
+		struct bt_bench_sample sample;
+
+		bt_bench_start(&sample);
 		ret = sout->parent.event_cb(&sout->parent, ctf_event->parent->stream);
+		bt_bench_stop(BT_BENCH_PHASE_OUTPUT, &sample);
 		if (ret) {
 			fprintf(stderr, "[error] Writing event failed.\n");
 			goto end;
@@ -657,14 +898,184 @@ error_iter:
 	return ret;
 }
 
+struct event_stats {
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t first_timestamp, last_timestamp;
+};
+
+static
+void print_event_stats(struct ctf_stream_definition *stream,
+		const char *name, struct event_stats *stats)
+{
+	printf("    %-32s %12" PRIu64 " events %14" PRIu64 " bytes  [",
+		name, stats->count, stats->bytes);
+	ctf_print_timestamp(stdout, stream, stats->first_timestamp);
+	printf(" .. ");
+	ctf_print_timestamp(stdout, stream, stats->last_timestamp);
+	printf("]\n");
+}
+
+/*
+ * Read every event header of a stream, skipping contexts and payloads,
+ * and print per event class statistics. Packet and discarded event
+ * counts come from the packet index.
+ */
+static
+int stats_stream(struct ctf_file_stream *file_stream,
+		struct event_stats *totals)
+{
+	struct ctf_stream_definition *stream = &file_stream->parent;
+	struct ctf_stream_declaration *stream_class = stream->stream_class;
+	struct ctf_stream_pos *pos = &file_stream->pos;
+	struct event_stats *events;
+	uint64_t content_bytes = 0, discarded = 0, nr_events = 0;
+	int i, ret;
+
+	/* With lazy open, seeking completes the packet index. */
+	pos->packet_seek(&pos->parent, 0, SEEK_SET);
+	for (i = 0; i < pos->packet_index->len; i++) {
+		struct packet_index *index =
+			&g_array_index(pos->packet_index, struct packet_index, i);
+		uint64_t diff = index->events_discarded;
+
+		content_bytes += index->content_size / CHAR_BIT;
+		if (i > 0) {
+			struct packet_index *prev =
+				&g_array_index(pos->packet_index,
+					struct packet_index, i - 1);
+
+			diff -= prev->events_discarded;
+			if (prev->events_discarded_len == 32)
+				diff = (uint32_t) diff;
+		}
+		discarded += diff;
+	}
+
+	events = g_new0(struct event_stats, stream_class->events_by_id->len);
+	for (;;) {
+		struct event_stats *stats;
+		uint64_t timestamp;
+
+		ret = pos->parent.event_cb(&pos->parent, stream);
+		if (ret == EOF) {
+			ret = 0;
+			break;
+		} else if (ret) {
+			fprintf(stderr, "[error] Reading event failed.\n");
+			goto end;
+		}
+		if (stream->event_id >= stream_class->events_by_id->len) {
+			ret = -EINVAL;
+			goto end;
+		}
+		timestamp = opt_clock_cycles ? stream->cycles_timestamp :
+			stream->real_timestamp;
+		stats = &events[stream->event_id];
+		if (!stats->count)
+			stats->first_timestamp = timestamp;
+		stats->last_timestamp = timestamp;
+		stats->count++;
+		stats->bytes += (pos->offset - pos->last_offset) / CHAR_BIT;
+		nr_events++;
+	}
+
+	printf("  stream %s (stream class %" PRIu64 "): %u packets, %" PRIu64
+		" bytes, %" PRIu64 " events, %" PRIu64 " discarded\n",
+		stream->path, stream_class->stream_id,
+		pos->packet_index->len, content_bytes, nr_events, discarded);
+	for (i = 0; i < stream_class->events_by_id->len; i++) {
+		struct ctf_event_declaration *event_class =
+			g_ptr_array_index(stream_class->events_by_id, i);
+		struct event_stats *total;
+
+		if (!event_class || !events[i].count)
+			continue;
+		print_event_stats(stream, g_quark_to_string(event_class->name),
+			&events[i]);
+		total = &totals[i];
+		if (!total->count
+				|| events[i].first_timestamp < total->first_timestamp)
+			total->first_timestamp = events[i].first_timestamp;
+		if (!total->count
+				|| events[i].last_timestamp > total->last_timestamp)
+			total->last_timestamp = events[i].last_timestamp;
+		total->count += events[i].count;
+		total->bytes += events[i].bytes;
+	}
+end:
+	g_free(events);
+	return ret;
+}
+
+static
+int stats_trace(struct bt_context *ctx)
+{
+	struct trace_collection *tc = ctx->tc;
+	int i, ret = 0;
+
+	for (i = 0; i < tc->array->len; i++) {
+		struct ctf_trace *trace =
+			container_of(g_ptr_array_index(tc->array, i),
+				struct ctf_trace, parent);
+		int stream_id;
+
+		printf("trace %s\n", trace->parent.path);
+		for (stream_id = 0; stream_id < trace->streams->len;
+				stream_id++) {
+			struct ctf_stream_declaration *stream_class =
+				g_ptr_array_index(trace->streams, stream_id);
+			struct ctf_stream_definition *stream = NULL;
+			struct event_stats *totals;
+			int filenr, id;
+
+			if (!stream_class)
+				continue;
+			totals = g_new0(struct event_stats,
+				stream_class->events_by_id->len);
+			for (filenr = 0; filenr < stream_class->streams->len;
+					filenr++) {
+				stream = g_ptr_array_index(stream_class->streams,
+					filenr);
+				if (!stream)
+					continue;
+				ret = stats_stream(container_of(stream,
+						struct ctf_file_stream, parent),
+					totals);
+				if (ret) {
+					g_free(totals);
+					goto end;
+				}
+			}
+			printf("  stream class %" PRIu64 " totals:\n",
+				stream_class->stream_id);
+			for (id = 0; id < stream_class->events_by_id->len; id++) {
+				struct ctf_event_declaration *event_class =
+					g_ptr_array_index(stream_class->events_by_id, id);
+
+				if (!event_class || !totals[id].count)
+					continue;
+				print_event_stats(stream,
+					g_quark_to_string(event_class->name),
+					&totals[id]);
+			}
+			g_free(totals);
+		}
+	}
+end:
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
 	int ret, partial_error = 0, open_success = 0;
 	struct bt_format *fmt_write;
 	struct bt_trace_descriptor *td_write;
 	struct bt_context *ctx;
+	struct bt_bench_time bench_begin, bench_end;
 	int i;
 
+	bt_bench_now(&bench_begin);
 	opt_input_paths = g_ptr_array_new();
 
 	ret = parse_options(argc, argv);
@@ -705,7 +1116,8 @@ int main(int argc, char **argv)
 		}
 	}
 	if (!opt_output_format) {
-		opt_output_format = strdup("text");
+		/* Benchmark decoding alone unless an output is requested. */
+		opt_output_format = strdup(babeltrace_bench ? "dummy" : "text");
 		if (!opt_output_format) {
 			partial_error = 1;
 			goto end;
@@ -752,6 +1164,26 @@ int main(int argc, char **argv)
 		goto error_td_read;
 	}
 
+	if (opt_stats) {
+		if (fmt_read->name != g_quark_from_static_string("ctf")) {
+			fprintf(stderr, "[error] Statistics are only supported for the ctf input format.\n\n");
+			goto error_td_write;
+		}
+		ret = stats_trace(ctx);
+		bt_context_put(ctx);
+		if (ret) {
+			fprintf(stderr, "Error computing trace statistics.\n\n");
+			partial_error = 1;
+		}
+		goto end;
+	}
+
+	if (fmt_write->name == g_quark_from_static_string("ctf")
+			&& fmt_read->name != g_quark_from_static_string("ctf")) {
+		fprintf(stderr, "[error] The ctf output format only supports the ctf input format.\n\n");
+		goto error_td_write;
+	}
+
 	td_write = fmt_write->open_trace(opt_output_path, O_RDWR, NULL, NULL);
 	if (!td_write) {
 		fprintf(stderr, "Error opening trace \"%s\" for writing.\n\n",
@@ -792,6 +1224,12 @@ int main(int argc, char **argv)
 	bt_context_put(ctx);
 	printf_verbose("finished converting. Output written to:\n%s\n",
 			opt_output_path ? : "<stdout>");
+	if (babeltrace_bench) {
+		bt_bench_now(&bench_end);
+		bench_end.wall_ns -= bench_begin.wall_ns;
+		bench_end.cpu_ns -= bench_begin.cpu_ns;
+		bt_bench_fprint(stderr, &bench_end);
+	}
 	goto end;
 
 	/* Error handling */
@@ -0,0 +1,606 @@
+/*
+ * BabelTrace - Common Trace Format (CTF)
+ *
+ * Columnar export format.
+ *
+ * Writes one file per event class, made of contiguous typed columns
+ * (timestamps, integer and floating point fields, string offsets and
+ * their blob), built in a single pass from the decoded definitions.
+ * The file layout is described in babeltrace/ctf-columnar/columnar.h.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <babeltrace/format.h>
+#include <babeltrace/ctf-text/types.h>
+#include <babeltrace/ctf-columnar/columnar.h>
+#include <babeltrace/ctf/metadata.h>
+#include <babeltrace/babeltrace-internal.h>
+#include <babeltrace/ctf/events-internal.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/*
+ * Number of rows buffered per column before a row group is written.
+ */
+#define COLUMNAR_GROUP_ROWS	65536
+
+struct columnar_column {
+	GString *name;
+	enum ctf_columnar_type type;
+	GArray *cells;			/* Array of uint64_t */
+};
+
+/*
+ * Columns of a single event class.
+ */
+struct columnar_table {
+	struct ctf_event_declaration *event_class;
+	FILE *fp;
+	GPtrArray *columns;		/* Array of struct columnar_column */
+	GString *blob;			/* Strings of the current row group */
+	uint64_t nr_rows;		/* Rows in the current row group */
+};
+
+/*
+ * The converter looks up the trace descriptor through struct
+ * ctf_text_stream_pos, so it must stay the first member.
+ */
+struct ctf_columnar_stream_pos {
+	struct ctf_text_stream_pos parent;
+	char *path;			/* Output directory */
+	GHashTable *tables;		/* event class -> struct columnar_table */
+	GHashTable *file_names;		/* Set of file name GQuarks in use */
+};
+
+static
+struct bt_trace_descriptor *ctf_columnar_open_trace(const char *path, int flags,
+		void (*packet_seek)(struct bt_stream_pos *pos, size_t index,
+			int whence), FILE *metadata_fp);
+static
+int ctf_columnar_close_trace(struct bt_trace_descriptor *descriptor);
+
+static
+struct bt_format ctf_columnar_format = {
+	.open_trace = ctf_columnar_open_trace,
+	.close_trace = ctf_columnar_close_trace,
+};
+
+static
+int columnar_write_padded(FILE *fp, const void *buf, size_t len)
+{
+	static const char zero[CTF_COLUMNAR_ALIGN];
+	size_t padding;
+
+	if (len && fwrite(buf, len, 1, fp) != 1)
+		return -1;
+	padding = (CTF_COLUMNAR_ALIGN - (len % CTF_COLUMNAR_ALIGN))
+		% CTF_COLUMNAR_ALIGN;
+	if (padding && fwrite(zero, padding, 1, fp) != 1)
+		return -1;
+	return 0;
+}
+
+static
+void columnar_column_free(gpointer data)
+{
+	struct columnar_column *column = data;
+
+	g_string_free(column->name, TRUE);
+	g_array_free(column->cells, TRUE);
+	g_free(column);
+}
+
+static
+void columnar_column_add(struct columnar_table *table, const char *name,
+		enum ctf_columnar_type type)
+{
+	struct columnar_column *column;
+
+	column = g_new0(struct columnar_column, 1);
+	column->name = g_string_new(name);
+	column->type = type;
+	column->cells = g_array_sized_new(FALSE, FALSE, sizeof(uint64_t),
+			COLUMNAR_GROUP_ROWS);
+	g_ptr_array_add(table->columns, column);
+}
+
+/*
+ * In build mode, declare a column at index *col. Otherwise append a cell
+ * to it. Cells of string columns hold the offset of the string in the
+ * blob.
+ */
+static
+int columnar_cell(struct columnar_table *table, const char *name,
+		unsigned int *col, int build, enum ctf_columnar_type type,
+		uint64_t value)
+{
+	struct columnar_column *column;
+
+	if (build) {
+		columnar_column_add(table, name, type);
+		(*col)++;
+		return 0;
+	}
+	if (*col >= table->columns->len)
+		return -EINVAL;
+	column = g_ptr_array_index(table->columns, *col);
+	if (column->type != type)
+		return -EINVAL;
+	g_array_append_val(column->cells, value);
+	(*col)++;
+	return 0;
+}
+
+static
+int columnar_string_cell(struct columnar_table *table, const char *name,
+		unsigned int *col, int build, const char *str, size_t len)
+{
+	uint64_t offset = table->blob->len;
+
+	if (!build) {
+		g_string_append_len(table->blob, str, strnlen(str, len));
+		g_string_append_c(table->blob, '\0');
+	}
+	return columnar_cell(table, name, col, build, CTF_COLUMNAR_STRING,
+			offset);
+}
+
+static
+int columnar_walk(struct columnar_table *table, struct bt_definition *definition,
+		GString *name, unsigned int *col, int build);
+
+static
+int columnar_walk_struct(struct columnar_table *table,
+		struct definition_struct *struct_definition,
+		GString *name, unsigned int *col, int build)
+{
+	size_t prefix_len = name->len;
+	int i, ret = 0;
+
+	for (i = 0; i < struct_definition->fields->len; i++) {
+		struct bt_definition *field =
+			g_ptr_array_index(struct_definition->fields, i);
+
+		if (prefix_len)
+			g_string_append_c(name, '.');
+		g_string_append(name, rem_(g_quark_to_string(field->name)));
+		ret = columnar_walk(table, field, name, col, build);
+		g_string_truncate(name, prefix_len);
+		if (ret)
+			break;
+	}
+	return ret;
+}
+
+/*
+ * Flatten a definition into columns. Variants, and arrays or sequences
+ * which are not strings, have no fixed shape: they are not exported.
+ */
+static
+int columnar_walk(struct columnar_table *table, struct bt_definition *definition,
+		GString *name, unsigned int *col, int build)
+{
+	switch (definition->declaration->id) {
+	case CTF_TYPE_INTEGER:
+	{
+		struct definition_integer *integer_definition =
+			container_of(definition, struct definition_integer, p);
+
+		if (integer_definition->declaration->signedness)
+			return columnar_cell(table, name->str, col, build,
+				CTF_COLUMNAR_INT64,
+				(uint64_t) integer_definition->value._signed);
+		return columnar_cell(table, name->str, col, build,
+			CTF_COLUMNAR_UINT64,
+			integer_definition->value._unsigned);
+	}
+	case CTF_TYPE_ENUM:
+	{
+		struct definition_enum *enum_definition =
+			container_of(definition, struct definition_enum, p);
+
+		return columnar_walk(table, &enum_definition->integer->p,
+			name, col, build);
+	}
+	case CTF_TYPE_FLOAT:
+	{
+		struct definition_float *float_definition =
+			container_of(definition, struct definition_float, p);
+		uint64_t value;
+
+		memcpy(&value, &float_definition->value, sizeof(value));
+		return columnar_cell(table, name->str, col, build,
+			CTF_COLUMNAR_DOUBLE, value);
+	}
+	case CTF_TYPE_STRING:
+	{
+		struct definition_string *string_definition =
+			container_of(definition, struct definition_string, p);
+
+		return columnar_string_cell(table, name->str, col, build,
+			string_definition->value ? : "",
+			string_definition->value ? string_definition->len : 0);
+	}
+	case CTF_TYPE_STRUCT:
+		return columnar_walk_struct(table,
+			container_of(definition, struct definition_struct, p),
+			name, col, build);
+	case CTF_TYPE_ARRAY:
+	{
+		struct definition_array *array_definition =
+			container_of(definition, struct definition_array, p);
+
+		if (!array_definition->string)
+			return 0;
+		return columnar_string_cell(table, name->str, col, build,
+			array_definition->string->str,
+			array_definition->string->len);
+	}
+	case CTF_TYPE_SEQUENCE:
+	{
+		struct definition_sequence *sequence_definition =
+			container_of(definition, struct definition_sequence, p);
+
+		if (!sequence_definition->string)
+			return 0;
+		return columnar_string_cell(table, name->str, col, build,
+			sequence_definition->string->str,
+			sequence_definition->string->len);
+	}
+	case CTF_TYPE_VARIANT:
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Walk every exported column of an event, in a fixed order: timestamps,
+ * then stream event context, event context and event payload.
+ */
+static
+int columnar_walk_event(struct columnar_table *table,
+		struct ctf_stream_definition *stream,
+		struct ctf_event_definition *event, int build)
+{
+	unsigned int col = 0;
+	GString *name;
+	int ret;
+
+	name = g_string_new("");
+	ret = columnar_cell(table, "timestamp", &col, build,
+			CTF_COLUMNAR_UINT64, stream->real_timestamp);
+	if (ret)
+		goto end;
+	ret = columnar_cell(table, "timestamp_cycles", &col, build,
+			CTF_COLUMNAR_UINT64, stream->cycles_timestamp);
+	if (ret)
+		goto end;
+	if (stream->stream_event_context) {
+		g_string_assign(name, "stream.event.context");
+		ret = columnar_walk_struct(table, stream->stream_event_context,
+				name, &col, build);
+		if (ret)
+			goto end;
+	}
+	if (event->event_context) {
+		g_string_assign(name, "event.context");
+		ret = columnar_walk_struct(table, event->event_context,
+				name, &col, build);
+		if (ret)
+			goto end;
+	}
+	if (event->event_fields) {
+		g_string_assign(name, "event.fields");
+		ret = columnar_walk_struct(table, event->event_fields,
+				name, &col, build);
+		if (ret)
+			goto end;
+	}
+	if (!build && col != table->columns->len)
+		ret = -EINVAL;
+end:
+	g_string_free(name, TRUE);
+	return ret;
+}
+
+static
+int columnar_write_header(struct columnar_table *table)
+{
+	struct ctf_columnar_file_hdr hdr;
+	const char *event_name;
+	int i;
+
+	event_name = g_quark_to_string(table->event_class->name);
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = CTF_COLUMNAR_MAGIC;
+	hdr.major = CTF_COLUMNAR_MAJOR;
+	hdr.minor = CTF_COLUMNAR_MINOR;
+	hdr.byte_order_mark = CTF_COLUMNAR_BYTE_ORDER_MARK;
+	hdr.nr_columns = table->columns->len;
+	hdr.stream_id = table->event_class->stream_id;
+	hdr.event_id = table->event_class->id;
+	hdr.name_len = strlen(event_name) + 1;
+	if (fwrite(&hdr, sizeof(hdr), 1, table->fp) != 1)
+		return -1;
+	if (columnar_write_padded(table->fp, event_name, hdr.name_len))
+		return -1;
+	for (i = 0; i < table->columns->len; i++) {
+		struct columnar_column *column =
+			g_ptr_array_index(table->columns, i);
+		struct ctf_columnar_column_hdr column_hdr;
+
+		column_hdr.type = column->type;
+		column_hdr.name_len = column->name->len + 1;
+		if (fwrite(&column_hdr, sizeof(column_hdr), 1, table->fp) != 1)
+			return -1;
+		if (columnar_write_padded(table->fp, column->name->str,
+				column_hdr.name_len))
+			return -1;
+	}
+	return 0;
+}
+
+static
+int columnar_flush_group(struct columnar_table *table)
+{
+	struct ctf_columnar_group_hdr group_hdr;
+	int i;
+
+	if (!table->nr_rows)
+		return 0;
+	group_hdr.nr_rows = table->nr_rows;
+	group_hdr.blob_len = table->blob->len;
+	if (fwrite(&group_hdr, sizeof(group_hdr), 1, table->fp) != 1)
+		return -1;
+	for (i = 0; i < table->columns->len; i++) {
+		struct columnar_column *column =
+			g_ptr_array_index(table->columns, i);
+
+		if (fwrite(column->cells->data, sizeof(uint64_t),
+				column->cells->len, table->fp)
+				!= column->cells->len)
+			return -1;
+		g_array_set_size(column->cells, 0);
+	}
+	if (columnar_write_padded(table->fp, table->blob->str,
+			table->blob->len))
+		return -1;
+	g_string_truncate(table->blob, 0);
+	table->nr_rows = 0;
+	return 0;
+}
+
+/*
+ * Pick a file name unique within this output directory: event names are
+ * only unique within a stream class, and several traces may be merged.
+ */
+static
+FILE *columnar_open_file(struct ctf_columnar_stream_pos *pos,
+		struct ctf_event_declaration *event_class)
+{
+	GString *name;
+	FILE *fp = NULL;
+	unsigned int nr = 0;
+	gsize i, base_len;
+
+	name = g_string_new("");
+	g_string_printf(name, "%s.%" PRIu64,
+		g_quark_to_string(event_class->name), event_class->stream_id);
+	for (i = 0; i < name->len; i++) {
+		if (name->str[i] == '/')
+			name->str[i] = '_';
+	}
+	base_len = name->len;
+	g_string_append(name, ".col");
+	while (g_hash_table_lookup(pos->file_names,
+			GUINT_TO_POINTER(g_quark_from_string(name->str)))) {
+		g_string_truncate(name, base_len);
+		g_string_append_printf(name, ".%u.col", ++nr);
+	}
+	g_hash_table_insert(pos->file_names,
+		GUINT_TO_POINTER(g_quark_from_string(name->str)),
+		GUINT_TO_POINTER(1));
+
+	g_string_prepend_c(name, '/');
+	g_string_prepend(name, pos->path);
+	fp = fopen(name->str, "w");
+	if (!fp)
+		fprintf(stderr, "[error] Unable to open columnar file %s: %s\n",
+			name->str, strerror(errno));
+	g_string_free(name, TRUE);
+	return fp;
+}
+
+static
+void columnar_table_free(gpointer data)
+{
+	struct columnar_table *table = data;
+
+	if (table->fp) {
+		if (columnar_flush_group(table) || fclose(table->fp))
+			perror("Error writing columnar file");
+	}
+	g_ptr_array_free(table->columns, TRUE);
+	g_string_free(table->blob, TRUE);
+	g_free(table);
+}
+
+static
+struct columnar_table *columnar_table_create(struct ctf_columnar_stream_pos *pos,
+		struct ctf_stream_definition *stream,
+		struct ctf_event_definition *event,
+		struct ctf_event_declaration *event_class)
+{
+	struct columnar_table *table;
+
+	table = g_new0(struct columnar_table, 1);
+	table->event_class = event_class;
+	table->columns = g_ptr_array_new_with_free_func(columnar_column_free);
+	table->blob = g_string_new("");
+
+	if (columnar_walk_event(table, stream, event, 1))
+		goto error;
+	table->fp = columnar_open_file(pos, event_class);
+	if (!table->fp)
+		goto error;
+	if (columnar_write_header(table)) {
+		perror("Error writing columnar file header");
+		goto error;
+	}
+	g_hash_table_insert(pos->tables, event_class, table);
+	return table;
+
+error:
+	columnar_table_free(table);
+	return NULL;
+}
+
+static
+int ctf_columnar_write_event(struct bt_stream_pos *ppos,
+		struct ctf_stream_definition *stream)
+{
+	struct ctf_columnar_stream_pos *pos =
+		container_of(ppos, struct ctf_columnar_stream_pos, parent.parent);
+	struct ctf_stream_declaration *stream_class = stream->stream_class;
+	struct ctf_event_declaration *event_class;
+	struct ctf_event_definition *event;
+	struct columnar_table *table;
+	uint64_t id;
+	int ret;
+
+	id = stream->event_id;
+
+	if (id >= stream_class->events_by_id->len) {
+		fprintf(stderr, "[error] Event id %" PRIu64 " is outside range.\n", id);
+		return -EINVAL;
+	}
+	event = g_ptr_array_index(stream->events_by_id, id);
+	if (!event) {
+		fprintf(stderr, "[error] Event id %" PRIu64 " is unknown.\n", id);
+		return -EINVAL;
+	}
+	event_class = g_ptr_array_index(stream_class->events_by_id, id);
+	if (!event_class) {
+		fprintf(stderr, "[error] Event class id %" PRIu64 " is unknown.\n", id);
+		return -EINVAL;
+	}
+
+	table = g_hash_table_lookup(pos->tables, event_class);
+	if (!table) {
+		table = columnar_table_create(pos, stream, event, event_class);
+		if (!table)
+			return -EINVAL;
+	}
+	ret = columnar_walk_event(table, stream, event, 0);
+	if (ret) {
+		fprintf(stderr, "[error] Event \"%s\" does not match its column layout.\n",
+			g_quark_to_string(event_class->name));
+		return ret;
+	}
+	if (++table->nr_rows == COLUMNAR_GROUP_ROWS) {
+		if (columnar_flush_group(table)) {
+			perror("Error writing columnar file");
+			return -EIO;
+		}
+	}
+	return 0;
+}
+
+static
+struct bt_trace_descriptor *ctf_columnar_open_trace(const char *path, int flags,
+		void (*packet_seek)(struct bt_stream_pos *pos, size_t index,
+			int whence), FILE *metadata_fp)
+{
+	struct ctf_columnar_stream_pos *pos;
+
+	pos = g_new0(struct ctf_columnar_stream_pos, 1);
+
+	switch (flags & O_ACCMODE) {
+	case O_RDWR:
+		if (!path) {
+			fprintf(stderr, "[error] The columnar format needs an output directory.\n");
+			goto error;
+		}
+		if (g_mkdir_with_parents(path, S_IRWXU | S_IRWXG)) {
+			fprintf(stderr, "[error] Unable to create directory %s: %s\n",
+				path, strerror(errno));
+			goto error;
+		}
+		pos->path = strdup(path);
+		if (!pos->path)
+			goto error;
+		pos->tables = g_hash_table_new_full(g_direct_hash,
+			g_direct_equal, NULL, columnar_table_free);
+		pos->file_names = g_hash_table_new(g_direct_hash,
+			g_direct_equal);
+		pos->parent.parent.event_cb = ctf_columnar_write_event;
+		pos->parent.parent.trace = &pos->parent.trace_descriptor;
+		break;
+	case O_RDONLY:
+	default:
+		fprintf(stderr, "[error] Incorrect open flags.\n");
+		goto error;
+	}
+
+	return &pos->parent.trace_descriptor;
+error:
+	g_free(pos);
+	return NULL;
+}
+
+static
+int ctf_columnar_close_trace(struct bt_trace_descriptor *td)
+{
+	struct ctf_columnar_stream_pos *pos =
+		container_of(td, struct ctf_columnar_stream_pos,
+			parent.trace_descriptor);
+
+	/* Flushes and closes every file. */
+	g_hash_table_destroy(pos->tables);
+	g_hash_table_destroy(pos->file_names);
+	free(pos->path);
+	g_free(pos);
+	return 0;
+}
+
+static
+void __attribute__((constructor)) ctf_columnar_init(void)
+{
+	int ret;
+
+	ctf_columnar_format.name = g_quark_from_static_string("columnar");
+	ret = bt_register_format(&ctf_columnar_format);
+	assert(!ret);
+}
+
+static
+void __attribute__((destructor)) ctf_columnar_exit(void)
+{
+	bt_unregister_format(&ctf_columnar_format);
+}
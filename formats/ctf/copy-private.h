@@ -0,0 +1,48 @@
+#ifndef _CTF_COPY_PRIVATE_H
+#define _CTF_COPY_PRIVATE_H
+
+/*
+ * ctf/copy-private.h
+ *
+ * Babeltrace Library - CTF output (trace copy and trimming)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <babeltrace/babeltrace-internal.h>
+#include <babeltrace/format.h>
+#include <babeltrace/format-internal.h>
+
+/*
+ * Open a CTF trace for output. The returned descriptor is only valid
+ * for ctf_copy_close_trace().
+ */
+BT_HIDDEN
+struct bt_trace_descriptor *ctf_copy_open_trace(const char *path);
+
+/*
+ * Returns whether the descriptor was returned by ctf_copy_open_trace().
+ */
+BT_HIDDEN
+int ctf_copy_is_trace(struct bt_trace_descriptor *descriptor);
+
+BT_HIDDEN
+int ctf_copy_close_trace(struct bt_trace_descriptor *descriptor);
+
+#endif /* _CTF_COPY_PRIVATE_H */
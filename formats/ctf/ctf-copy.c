@@ -0,0 +1,972 @@
+/*
+ * BabelTrace - Common Trace Format (CTF)
+ *
+ * CTF output: trace copy and trimming.
+ *
+ * Writes the selected events back as a CTF trace. Packets lying
+ * entirely within the selected time range, including packets without
+ * events, are found from the packet index and copied verbatim from the
+ * input stream files: when a stream reaches a run of such packets, the
+ * whole run is copied and the stream position is moved past it, so that
+ * only the event which led to the run is decoded. Only the packets
+ * crossing the range boundaries are re-encoded from the decoded
+ * definitions, with their packet context sizes and timestamps updated.
+ * The metadata is copied as is, and the packet index of each output
+ * stream is regenerated.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <babeltrace/format.h>
+#include <babeltrace/ctf/types.h>
+#include <babeltrace/ctf/metadata.h>
+#include <babeltrace/ctf-text/types.h>
+#include <babeltrace/babeltrace-internal.h>
+#include <babeltrace/ctf/ctf-index.h>
+#include <babeltrace/mmap-align.h>
+#include <babeltrace/align.h>
+#include <babeltrace/endian.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib.h>
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
+#include "copy-private.h"
+
+#define COPY_BUF_LEN	(64 * 1024)
+
+#ifndef min
+#define min(a, b)	(((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef max
+#define max(a, b)	(((a) > (b)) ? (a) : (b))
+#endif
+
+/*
+ * Selected time range, in the trace time base (ns). Packets entirely
+ * within this range are copied verbatim.
+ */
+uint64_t opt_trim_begin;
+uint64_t opt_trim_end = -1ULL;
+
+/*
+ * Comma-separated list of the streams to copy, by stream id or stream
+ * file path. NULL to copy all streams.
+ */
+char *opt_copy_streams;
+
+/*
+ * Packet context field updated when a re-encoded packet is closed.
+ * offset is the position of the field in the packet, in bits, before
+ * its alignment. declaration is NULL if the field is not present.
+ */
+struct ctf_copy_field {
+	struct declaration_integer *declaration;
+	int64_t offset;
+};
+
+struct ctf_copy_stream {
+	int fd;				/* output stream file */
+	FILE *index_fp;			/* output index file */
+	off_t offset;			/* end of output file, in bytes */
+	uint64_t stream_id;
+	uint64_t cur_index;		/* last input packet handled, -1ULL if none */
+
+	/* Packet being re-encoded */
+	int open;
+	struct ctf_stream_pos pos;
+	struct mmap_align mma;
+	char *buf;
+	size_t buf_len;			/* in bytes */
+	uint64_t nr_events;
+	uint64_t timestamp_begin, timestamp_end;	/* in cycles */
+	uint64_t events_discarded;
+	struct {
+		struct ctf_copy_field content_size;
+		struct ctf_copy_field packet_size;
+		struct ctf_copy_field timestamp_begin;
+		struct ctf_copy_field timestamp_end;
+	} fields;
+};
+
+struct ctf_copy_stream_pos {
+	struct ctf_text_stream_pos parent;
+	char *path;
+	GHashTable *trace_paths;	/* input trace -> output directory */
+	GHashTable *streams;		/* input stream -> struct ctf_copy_stream */
+	gchar **stream_filter;		/* streams to copy, NULL for all */
+};
+
+static
+rw_dispatch copy_write_dispatch_table[] = {
+	[ CTF_TYPE_INTEGER ] = ctf_integer_write,
+	[ CTF_TYPE_FLOAT ] = ctf_float_write,
+	[ CTF_TYPE_ENUM ] = ctf_enum_write,
+	[ CTF_TYPE_STRING ] = ctf_string_write,
+	[ CTF_TYPE_STRUCT ] = ctf_struct_rw,
+	[ CTF_TYPE_VARIANT ] = ctf_variant_rw,
+	[ CTF_TYPE_ARRAY ] = ctf_array_write,
+	[ CTF_TYPE_SEQUENCE ] = ctf_sequence_write,
+};
+
+/* Descriptors returned by ctf_copy_open_trace() */
+static GHashTable *copy_descriptors;
+
+static
+int copy_write_full(int fd, const char *buf, size_t len, off_t offset)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = pwrite(fd, buf, len, offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += ret;
+		len -= ret;
+		offset += ret;
+	}
+	return 0;
+}
+
+/*
+ * Copy a file range, in kernel whenever possible. Each method falls
+ * back on the next one if it is not supported for these files, from
+ * where the previous one stopped.
+ */
+static
+int copy_range(int fd_in, off_t off_in, int fd_out, off_t off_out,
+		size_t len)
+{
+	char *buf;
+	ssize_t ret;
+	int err = 0;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	while (len > 0) {
+		loff_t in = off_in, out = off_out;
+
+		ret = copy_file_range(fd_in, &in, fd_out, &out, len, 0);
+		if (ret <= 0)
+			break;
+		off_in += ret;
+		off_out += ret;
+		len -= ret;
+	}
+#endif
+#ifdef HAVE_SENDFILE
+	if (len > 0 && lseek(fd_out, off_out, SEEK_SET) == off_out) {
+		while (len > 0) {
+			ret = sendfile(fd_out, fd_in, &off_in, len);
+			if (ret <= 0)
+				break;
+			off_out += ret;
+			len -= ret;
+		}
+	}
+#endif
+	if (!len)
+		return 0;
+
+	buf = g_malloc(COPY_BUF_LEN);
+	while (len > 0) {
+		ret = pread(fd_in, buf, min(len, (size_t) COPY_BUF_LEN), off_in);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			break;
+		}
+		if (ret == 0) {
+			/* Input file is shorter than its index. */
+			err = -EIO;
+			break;
+		}
+		err = copy_write_full(fd_out, buf, ret, off_out);
+		if (err)
+			break;
+		off_in += ret;
+		off_out += ret;
+		len -= ret;
+	}
+	g_free(buf);
+	return err;
+}
+
+static
+int copy_write_index(struct ctf_copy_stream *cs, struct ctf_packet_index *index)
+{
+	index->offset = htobe64(index->offset);
+	index->packet_size = htobe64(index->packet_size);
+	index->content_size = htobe64(index->content_size);
+	index->timestamp_begin = htobe64(index->timestamp_begin);
+	index->timestamp_end = htobe64(index->timestamp_end);
+	index->events_discarded = htobe64(index->events_discarded);
+	index->stream_id = htobe64(index->stream_id);
+	if (fwrite(index, sizeof(*index), 1, cs->index_fp) != 1)
+		return -EIO;
+	return 0;
+}
+
+static
+void copy_stream_free(gpointer data)
+{
+	struct ctf_copy_stream *cs = data;
+
+	if (cs->index_fp && fclose(cs->index_fp))
+		perror("Error closing index file");
+	if (cs->fd >= 0 && close(cs->fd))
+		perror("Error closing stream file");
+	g_free(cs->buf);
+	g_free(cs);
+}
+
+static
+int copy_open_index(struct ctf_copy_stream *cs, const char *dir,
+		const char *stream_path)
+{
+	struct ctf_packet_index_file_hdr hdr;
+	char *index_dir, *basename, *index_name, *index_path;
+	int ret = -1;
+
+	index_dir = g_build_filename(dir, "index", NULL);
+	basename = g_path_get_basename(stream_path);
+	index_name = g_strdup_printf("%s.idx", basename);
+	index_path = g_build_filename(index_dir, index_name, NULL);
+
+	if (g_mkdir_with_parents(index_dir, S_IRWXU | S_IRWXG)) {
+		fprintf(stderr, "[error] Unable to create directory %s: %s\n",
+			index_dir, strerror(errno));
+		goto end;
+	}
+	cs->index_fp = fopen(index_path, "w");
+	if (!cs->index_fp) {
+		fprintf(stderr, "[error] Unable to open index %s: %s\n",
+			index_path, strerror(errno));
+		goto end;
+	}
+	hdr.magic = htobe32(CTF_INDEX_MAGIC);
+	hdr.index_major = htobe32(CTF_INDEX_MAJOR);
+	hdr.index_minor = htobe32(CTF_INDEX_MINOR);
+	hdr.packet_index_len = htobe32(sizeof(struct ctf_packet_index));
+	if (fwrite(&hdr, sizeof(hdr), 1, cs->index_fp) != 1) {
+		fprintf(stderr, "[error] Unable to write index %s.\n",
+			index_path);
+		goto end;
+	}
+	ret = 0;
+end:
+	g_free(index_path);
+	g_free(index_name);
+	g_free(basename);
+	g_free(index_dir);
+	return ret;
+}
+
+static
+struct ctf_copy_stream *copy_get_stream(struct ctf_copy_stream_pos *cp,
+		struct ctf_stream_definition *stream)
+{
+	struct ctf_copy_stream *cs;
+	const char *dir;
+	char *file;
+
+	cs = g_hash_table_lookup(cp->streams, stream);
+	if (cs)
+		return cs;
+
+	dir = g_hash_table_lookup(cp->trace_paths,
+			&stream->stream_class->trace->parent);
+	if (!dir || !stream->path[0]) {
+		fprintf(stderr, "[error] The ctf output format only supports file-backed CTF input traces.\n");
+		return NULL;
+	}
+	cs = g_new0(struct ctf_copy_stream, 1);
+	cs->stream_id = stream->stream_id;
+	cs->cur_index = -1ULL;
+	file = g_build_filename(dir, stream->path, NULL);
+	cs->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC,
+			S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	if (cs->fd < 0) {
+		fprintf(stderr, "[error] Unable to open stream %s: %s\n",
+			file, strerror(errno));
+		goto error;
+	}
+	if (copy_open_index(cs, dir, stream->path))
+		goto error;
+	g_free(file);
+	g_hash_table_insert(cp->streams, stream, cs);
+	return cs;
+
+error:
+	g_free(file);
+	copy_stream_free(cs);
+	return NULL;
+}
+
+static
+int copy_packet_verbatim(struct ctf_copy_stream *cs,
+		struct ctf_file_stream *file_stream,
+		struct packet_index *packet)
+{
+	struct ctf_packet_index index;
+	size_t len = packet->packet_size / CHAR_BIT;
+	int fd, ret;
+
+	fd = ctf_file_stream_get_fd(file_stream);
+	if (fd < 0)
+		return -errno;
+	ret = copy_range(fd, packet->offset, cs->fd, cs->offset, len);
+	if (ret) {
+		fprintf(stderr, "[error] Unable to copy packet of stream %s: %s\n",
+			file_stream->parent.path, strerror(-ret));
+		return ret;
+	}
+	index.offset = cs->offset;
+	index.packet_size = packet->packet_size;
+	index.content_size = packet->content_size;
+	index.timestamp_begin = packet->ts_cycles.timestamp_begin;
+	index.timestamp_end = packet->ts_cycles.timestamp_end;
+	index.events_discarded = packet->events_discarded;
+	index.stream_id = cs->stream_id;
+	cs->offset += len;
+	return copy_write_index(cs, &index);
+}
+
+static
+void copy_grow_packet(struct ctf_copy_stream *cs, size_t len)
+{
+	size_t old_len = cs->buf_len;
+
+	if (len <= old_len)
+		return;
+	cs->buf = g_realloc(cs->buf, len);
+	memset(cs->buf + old_len, 0, len - old_len);
+	cs->buf_len = len;
+	mmap_align_set_addr(&cs->mma, cs->buf);
+	cs->pos.packet_size = len * CHAR_BIT;
+}
+
+/*
+ * Write a definition in the packet being re-encoded, growing the packet
+ * buffer when the definition does not fit.
+ */
+static
+int copy_write_definition(struct ctf_copy_stream *cs,
+		struct bt_definition *definition)
+{
+	int64_t offset = cs->pos.offset;
+	int ret;
+
+	for (;;) {
+		ret = generic_rw(&cs->pos.parent, definition);
+		if (ret != -EFAULT)
+			return ret;
+		cs->pos.offset = offset;
+		copy_grow_packet(cs, cs->buf_len << 1);
+	}
+}
+
+static
+void copy_track_field(struct ctf_copy_stream *cs,
+		struct bt_definition *field)
+{
+	struct ctf_copy_field *track;
+	const char *name;
+
+	if (field->declaration->id != CTF_TYPE_INTEGER)
+		return;
+	name = g_quark_to_string(field->name);
+	if (!strcmp(name, "content_size"))
+		track = &cs->fields.content_size;
+	else if (!strcmp(name, "packet_size"))
+		track = &cs->fields.packet_size;
+	else if (!strcmp(name, "timestamp_begin"))
+		track = &cs->fields.timestamp_begin;
+	else if (!strcmp(name, "timestamp_end"))
+		track = &cs->fields.timestamp_end;
+	else
+		return;
+	track->declaration = container_of(field->declaration,
+			struct declaration_integer, p);
+	track->offset = cs->pos.offset;
+}
+
+static
+int copy_open_packet(struct ctf_copy_stream *cs,
+		struct ctf_stream_definition *stream,
+		struct packet_index *packet)
+{
+	struct definition_struct *context = stream->stream_packet_context;
+	size_t len;
+	int ret, i;
+
+	len = max(packet->packet_size / CHAR_BIT,
+			(uint64_t) getpagesize());
+	copy_grow_packet(cs, len);
+	memset(cs->buf, 0, cs->buf_len);
+	memset(&cs->pos, 0, sizeof(cs->pos));
+	memset(&cs->fields, 0, sizeof(cs->fields));
+	mmap_align_set_addr(&cs->mma, cs->buf);
+	cs->pos.fd = -1;
+	cs->pos.prot = PROT_READ | PROT_WRITE;
+	cs->pos.parent.rw_table = copy_write_dispatch_table;
+	cs->pos.base_mma = &cs->mma;
+	cs->pos.packet_size = cs->buf_len * CHAR_BIT;
+	cs->pos.content_size = -1ULL;
+
+	if (stream->trace_packet_header) {
+		ret = copy_write_definition(cs,
+				&stream->trace_packet_header->p);
+		if (ret)
+			return ret;
+	}
+	if (context) {
+		/*
+		 * Write the packet context field by field to record where
+		 * the fields updated on packet close are.
+		 */
+		while (!ctf_align_pos(&cs->pos,
+				context->p.declaration->alignment))
+			copy_grow_packet(cs, cs->buf_len << 1);
+		for (i = 0; i < context->fields->len; i++) {
+			struct bt_definition *field =
+				g_ptr_array_index(context->fields, i);
+
+			copy_track_field(cs, field);
+			ret = copy_write_definition(cs, field);
+			if (ret)
+				return ret;
+		}
+	}
+	cs->nr_events = 0;
+	cs->events_discarded = packet->events_discarded;
+	cs->open = 1;
+	return 0;
+}
+
+static
+int copy_write_event(struct ctf_copy_stream *cs,
+		struct ctf_stream_definition *stream)
+{
+	struct ctf_event_definition *event;
+	uint64_t id = stream->event_id;
+	int ret;
+
+	if (id >= stream->events_by_id->len) {
+		fprintf(stderr, "[error] Event id %" PRIu64 " is outside range.\n", id);
+		return -EINVAL;
+	}
+	event = g_ptr_array_index(stream->events_by_id, id);
+	if (!event) {
+		fprintf(stderr, "[error] Event id %" PRIu64 " is unknown.\n", id);
+		return -EINVAL;
+	}
+	if (stream->stream_event_header) {
+		ret = copy_write_definition(cs,
+				&stream->stream_event_header->p);
+		if (ret)
+			goto error;
+	}
+	if (stream->stream_event_context) {
+		ret = copy_write_definition(cs,
+				&stream->stream_event_context->p);
+		if (ret)
+			goto error;
+	}
+	if (event->event_context) {
+		ret = copy_write_definition(cs, &event->event_context->p);
+		if (ret)
+			goto error;
+	}
+	if (event->event_fields) {
+		ret = copy_write_definition(cs, &event->event_fields->p);
+		if (ret)
+			goto error;
+	}
+	if (!cs->nr_events++)
+		cs->timestamp_begin = stream->cycles_timestamp;
+	cs->timestamp_end = stream->cycles_timestamp;
+	return 0;
+
+error:
+	fprintf(stderr, "[error] Unable to re-encode event of stream %s.\n",
+		stream->path);
+	return ret;
+}
+
+static
+int copy_patch_field(struct ctf_copy_stream *cs,
+		struct ctf_copy_field *field, uint64_t value)
+{
+	struct definition_integer integer;
+	int64_t offset;
+	int ret;
+
+	if (!field->declaration)
+		return 0;
+	memset(&integer, 0, sizeof(integer));
+	integer.p.declaration = &field->declaration->p;
+	integer.declaration = field->declaration;
+	integer.value._unsigned = value;
+	offset = cs->pos.offset;
+	cs->pos.offset = field->offset;
+	ret = ctf_integer_write(&cs->pos.parent, &integer.p);
+	cs->pos.offset = offset;
+	return ret;
+}
+
+/*
+ * Update the packet context of the packet being re-encoded with its
+ * new sizes and time range, and append it to the output stream.
+ */
+static
+int copy_close_packet(struct ctf_copy_stream *cs)
+{
+	struct ctf_packet_index index;
+	uint64_t content_size, packet_size;
+	int ret;
+
+	if (!cs->open)
+		return 0;
+	cs->open = 0;
+
+	content_size = cs->pos.offset;
+	packet_size = ALIGN(content_size, CHAR_BIT);
+	ret = copy_patch_field(cs, &cs->fields.content_size, content_size);
+	if (ret)
+		return ret;
+	ret = copy_patch_field(cs, &cs->fields.packet_size, packet_size);
+	if (ret)
+		return ret;
+	if (cs->nr_events) {
+		ret = copy_patch_field(cs, &cs->fields.timestamp_begin,
+				cs->timestamp_begin);
+		if (ret)
+			return ret;
+		ret = copy_patch_field(cs, &cs->fields.timestamp_end,
+				cs->timestamp_end);
+		if (ret)
+			return ret;
+	}
+
+	ret = copy_write_full(cs->fd, cs->buf, packet_size / CHAR_BIT,
+			cs->offset);
+	if (ret) {
+		fprintf(stderr, "[error] Unable to write packet: %s\n",
+			strerror(-ret));
+		return ret;
+	}
+	index.offset = cs->offset;
+	index.packet_size = packet_size;
+	index.content_size = content_size;
+	index.timestamp_begin = cs->timestamp_begin;
+	index.timestamp_end = cs->timestamp_end;
+	index.events_discarded = cs->events_discarded;
+	index.stream_id = cs->stream_id;
+	cs->offset += packet_size / CHAR_BIT;
+	return copy_write_index(cs, &index);
+}
+
+static
+int copy_packet_in_range(struct packet_index *packet)
+{
+	return packet->ts_real.timestamp_begin >= opt_trim_begin
+		&& packet->ts_real.timestamp_end <= opt_trim_end;
+}
+
+/*
+ * Copy the packets of the [begin, end[ index range which lie entirely
+ * within the time range.
+ */
+static
+int copy_packets_in_range(struct ctf_copy_stream *cs,
+		struct ctf_file_stream *file_stream,
+		uint64_t begin, uint64_t end)
+{
+	GArray *packet_index = file_stream->pos.packet_index;
+	uint64_t i;
+	int ret;
+
+	for (i = begin; i < end; i++) {
+		struct packet_index *packet =
+			&g_array_index(packet_index, struct packet_index, i);
+
+		if (!copy_packet_in_range(packet))
+			continue;
+		ret = copy_packet_verbatim(cs, file_stream, packet);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Move the input stream position to the end of packet "last": the next
+ * event read seeks to the packet following it, without decoding the
+ * events left up to there.
+ */
+static
+void copy_skip_packets(struct ctf_file_stream *file_stream, uint64_t last)
+{
+	struct ctf_stream_pos *pos = &file_stream->pos;
+
+	pos->cur_index = last;
+	pos->offset = pos->content_size;
+}
+
+static
+int copy_stream_selected(struct ctf_copy_stream_pos *cp,
+		struct ctf_stream_definition *stream)
+{
+	const char *trace_path = stream->stream_class->trace->parent.path;
+	size_t len = strlen(trace_path);
+	gchar **filter;
+
+	if (!cp->stream_filter)
+		return 1;
+	for (filter = cp->stream_filter; *filter; filter++) {
+		const char *name = *filter;
+		char *endptr;
+		uint64_t id;
+
+		errno = 0;
+		id = strtoull(name, &endptr, 0);
+		if (name[0] && *endptr == '\0' && !errno) {
+			if (id == stream->stream_class->stream_id)
+				return 1;
+			continue;
+		}
+		if (!strcmp(name, stream->path))
+			return 1;
+		/* Path including the trace directory. */
+		if (!strncmp(name, trace_path, len) && name[len] == '/'
+				&& !strcmp(name + len + 1, stream->path))
+			return 1;
+	}
+	return 0;
+}
+
+static
+int ctf_copy_write_event(struct bt_stream_pos *ppos,
+		struct ctf_stream_definition *stream)
+{
+	struct ctf_copy_stream_pos *cp =
+		container_of(ppos, struct ctf_copy_stream_pos, parent.parent);
+	struct ctf_file_stream *file_stream =
+		container_of(stream, struct ctf_file_stream, parent);
+	GArray *packet_index = file_stream->pos.packet_index;
+	uint64_t cur_index = file_stream->pos.cur_index, last;
+	struct ctf_copy_stream *cs;
+	struct packet_index *packet;
+	int ret;
+
+	cs = g_hash_table_lookup(cp->streams, stream);
+	if (!cs) {
+		if (!copy_stream_selected(cp, stream)) {
+			/* Let the reader reach the end of the stream. */
+			copy_skip_packets(file_stream, packet_index->len - 1);
+			return 0;
+		}
+		cs = copy_get_stream(cp, stream);
+		if (!cs)
+			return -EINVAL;
+	}
+
+	if (cs->cur_index == cur_index)
+		return copy_write_event(cs, stream);
+
+	ret = copy_close_packet(cs);
+	if (ret)
+		return ret;
+	/* Packets without events skipped by the reader. */
+	ret = copy_packets_in_range(cs, file_stream, cs->cur_index + 1,
+			cur_index);
+	if (ret)
+		return ret;
+	cs->cur_index = cur_index;
+	packet = &g_array_index(packet_index, struct packet_index, cur_index);
+	if (copy_packet_in_range(packet)) {
+		/*
+		 * Copy this packet and the following ones within the range,
+		 * and move the reader past them.
+		 */
+		for (last = cur_index; last + 1 < packet_index->len; last++) {
+			if (!copy_packet_in_range(&g_array_index(packet_index,
+					struct packet_index, last + 1)))
+				break;
+		}
+		ret = copy_packets_in_range(cs, file_stream, cur_index,
+				last + 1);
+		if (ret)
+			return ret;
+		cs->cur_index = last;
+		copy_skip_packets(file_stream, last);
+		return 0;
+	}
+	ret = copy_open_packet(cs, stream, packet);
+	if (ret)
+		return ret;
+	return copy_write_event(cs, stream);
+}
+
+/*
+ * Output path of a trace, relative to the output directory: the input
+ * trace hierarchy below the directory common to all input traces.
+ */
+static
+const char *copy_relative_path(struct bt_trace_descriptor *td)
+{
+	GPtrArray *traces = td->collection->array;
+	size_t len = strlen(td->path);
+	int i;
+
+	if (traces->len <= 1)
+		return td->path + len;
+	for (i = 0; i < traces->len; i++) {
+		struct bt_trace_descriptor *other =
+			g_ptr_array_index(traces, i);
+		size_t j;
+
+		for (j = 0; j < len && td->path[j] == other->path[j]; j++)
+			;
+		len = j;
+	}
+	while (len > 0 && td->path[len - 1] != '/')
+		len--;
+	return td->path + len;
+}
+
+static
+int ctf_copy_pre_trace(struct bt_stream_pos *ppos,
+		struct bt_trace_descriptor *td)
+{
+	struct ctf_copy_stream_pos *cp =
+		container_of(ppos, struct ctf_copy_stream_pos, parent.parent);
+	struct ctf_trace *trace = container_of(td, struct ctf_trace, parent);
+	int fd_in = -1, fd_out = -1, ret = -1;
+	char *dir, *metadata_path = NULL;
+	struct stat st;
+
+	dir = g_build_filename(cp->path, copy_relative_path(td), NULL);
+	if (g_mkdir_with_parents(dir, S_IRWXU | S_IRWXG)) {
+		fprintf(stderr, "[error] Unable to create directory %s: %s\n",
+			dir, strerror(errno));
+		goto end;
+	}
+	if (trace->dirfd < 0) {
+		fprintf(stderr, "[error] The ctf output format only supports file-backed CTF input traces.\n");
+		goto end;
+	}
+	fd_in = openat(trace->dirfd, "metadata", O_RDONLY);
+	if (fd_in < 0 || fstat(fd_in, &st)) {
+		fprintf(stderr, "[error] Unable to open metadata of trace %s: %s\n",
+			td->path, strerror(errno));
+		goto end;
+	}
+	metadata_path = g_build_filename(dir, "metadata", NULL);
+	fd_out = open(metadata_path, O_WRONLY | O_CREAT | O_TRUNC,
+			S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	if (fd_out < 0) {
+		fprintf(stderr, "[error] Unable to open %s: %s\n",
+			metadata_path, strerror(errno));
+		goto end;
+	}
+	ret = copy_range(fd_in, 0, fd_out, 0, st.st_size);
+	if (ret) {
+		fprintf(stderr, "[error] Unable to copy metadata of trace %s: %s\n",
+			td->path, strerror(-ret));
+		goto end;
+	}
+	g_hash_table_insert(cp->trace_paths, td, dir);
+	dir = NULL;
+	ret = 0;
+end:
+	if (fd_out >= 0 && close(fd_out))
+		perror("Error closing metadata file");
+	if (fd_in >= 0 && close(fd_in))
+		perror("Error closing metadata file");
+	g_free(metadata_path);
+	g_free(dir);
+	return ret;
+}
+
+/*
+ * Close the boundary packet left open at the end of the range, and copy
+ * the packets within the range which the reader did not reach because
+ * they hold no events. Streams without any event in the range only get
+ * an output stream if they have such packets.
+ */
+static
+int copy_finish_stream(struct ctf_copy_stream_pos *cp,
+		struct ctf_file_stream *file_stream)
+{
+	struct ctf_stream_definition *stream = &file_stream->parent;
+	GArray *packet_index;
+	struct ctf_copy_stream *cs;
+	uint64_t i = 0;
+	int ret;
+
+	if (!copy_stream_selected(cp, stream))
+		return 0;
+	cs = g_hash_table_lookup(cp->streams, stream);
+	if (cs) {
+		ret = copy_close_packet(cs);
+		if (ret)
+			return ret;
+		i = cs->cur_index + 1;
+	}
+	packet_index = file_stream->pos.packet_index;
+	if (!packet_index || !packet_index->len)
+		goto end;
+	if (file_stream->index_pending) {
+		if (g_array_index(packet_index, struct packet_index,
+				0).ts_real.timestamp_begin > opt_trim_end)
+			goto end;
+		ret = ctf_file_stream_load(file_stream);
+		if (ret)
+			return ret;
+		packet_index = file_stream->pos.packet_index;
+	}
+	for (; i < packet_index->len; i++) {
+		struct packet_index *packet =
+			&g_array_index(packet_index, struct packet_index, i);
+
+		if (!copy_packet_in_range(packet))
+			continue;
+		if (!cs) {
+			cs = copy_get_stream(cp, stream);
+			if (!cs)
+				return -EINVAL;
+		}
+		ret = copy_packet_verbatim(cs, file_stream, packet);
+		if (ret)
+			return ret;
+	}
+end:
+	if (cs)
+		g_hash_table_remove(cp->streams, stream);
+	return 0;
+}
+
+static
+int ctf_copy_post_trace(struct bt_stream_pos *ppos,
+		struct bt_trace_descriptor *td)
+{
+	struct ctf_copy_stream_pos *cp =
+		container_of(ppos, struct ctf_copy_stream_pos, parent.parent);
+	struct ctf_trace *trace = container_of(td, struct ctf_trace, parent);
+	int i, j, ret;
+
+	for (i = 0; i < trace->streams->len; i++) {
+		struct ctf_stream_declaration *stream_class =
+			g_ptr_array_index(trace->streams, i);
+
+		if (!stream_class)
+			continue;
+		for (j = 0; j < stream_class->streams->len; j++) {
+			struct ctf_file_stream *file_stream =
+				g_ptr_array_index(stream_class->streams, j);
+
+			if (!file_stream)
+				continue;
+			ret = copy_finish_stream(cp, file_stream);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+BT_HIDDEN
+struct bt_trace_descriptor *ctf_copy_open_trace(const char *path)
+{
+	struct ctf_copy_stream_pos *pos;
+
+	if (!path) {
+		fprintf(stderr, "[error] The ctf output format needs an output directory.\n");
+		return NULL;
+	}
+	if (g_mkdir_with_parents(path, S_IRWXU | S_IRWXG)) {
+		fprintf(stderr, "[error] Unable to create directory %s: %s\n",
+			path, strerror(errno));
+		return NULL;
+	}
+	pos = g_new0(struct ctf_copy_stream_pos, 1);
+	pos->path = strdup(path);
+	if (!pos->path) {
+		g_free(pos);
+		return NULL;
+	}
+	pos->trace_paths = g_hash_table_new_full(g_direct_hash,
+		g_direct_equal, NULL, g_free);
+	pos->streams = g_hash_table_new_full(g_direct_hash,
+		g_direct_equal, NULL, copy_stream_free);
+	if (opt_copy_streams)
+		pos->stream_filter = g_strsplit(opt_copy_streams, ",", 0);
+	pos->parent.parent.pre_trace_cb = ctf_copy_pre_trace;
+	pos->parent.parent.post_trace_cb = ctf_copy_post_trace;
+	pos->parent.parent.event_cb = ctf_copy_write_event;
+	pos->parent.parent.trace = &pos->parent.trace_descriptor;
+
+	if (!copy_descriptors)
+		copy_descriptors = g_hash_table_new(g_direct_hash,
+			g_direct_equal);
+	g_hash_table_insert(copy_descriptors, &pos->parent.trace_descriptor,
+		pos);
+	return &pos->parent.trace_descriptor;
+}
+
+BT_HIDDEN
+int ctf_copy_is_trace(struct bt_trace_descriptor *descriptor)
+{
+	return copy_descriptors &&
+		g_hash_table_lookup(copy_descriptors, descriptor) != NULL;
+}
+
+BT_HIDDEN
+int ctf_copy_close_trace(struct bt_trace_descriptor *descriptor)
+{
+	struct ctf_copy_stream_pos *pos =
+		container_of(descriptor, struct ctf_copy_stream_pos,
+			parent.trace_descriptor);
+
+	g_hash_table_remove(copy_descriptors, descriptor);
+	/* Streams still there were not flushed by a post trace callback. */
+	g_hash_table_destroy(pos->streams);
+	g_hash_table_destroy(pos->trace_paths);
+	g_strfreev(pos->stream_filter);
+	free(pos->path);
+	g_free(pos);
+	return 0;
+}
@@ -26,6 +26,7 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include <babeltrace/format.h>
 #include <babeltrace/ctf/types.h>
 #include <babeltrace/ctf/metadata.h>
@@ -36,6 +37,7 @@
 #include <babeltrace/compat/uuid.h>
 #include <babeltrace/endian.h>
 #include <babeltrace/ctf/ctf-index.h>
+#include <babeltrace/bench-internal.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <sys/mman.h>
@@ -52,6 +54,8 @@
 #include "metadata/ctf-parser.h"
 #include "metadata/ctf-ast.h"
 #include "events-private.h"
+#include "copy-private.h"
+#include "prefetch-private.h"
 #include <babeltrace/compat/memstream.h>
 
 #define LOG2_CHAR_BIT	3
@@ -66,6 +70,12 @@
  */
 #define WRITE_PACKET_LEN	(getpagesize() * 8 * CHAR_BIT)
 
+/*
+ * Minimum length of a packet mapping for which huge pages are requested,
+ * in bytes.
+ */
+#define HUGEPAGE_MAP_LEN	(2 * 1024 * 1024)
+
 #ifndef min
 #define min(a, b)	(((a) < (b)) ? (a) : (b))
 #endif
@@ -79,6 +89,12 @@ int opt_clock_cycles,
 	opt_clock_date,
 	opt_clock_gmt;
 
+/*
+ * When set, only the event headers are decoded: contexts and payloads
+ * are skipped using their layout whenever it allows it.
+ */
+int opt_skip_payload;
+
 uint64_t opt_clock_offset;
 uint64_t opt_clock_offset_ns;
 
@@ -191,6 +207,10 @@ uint64_t ctf_timestamp_begin(struct bt_trace_descriptor *descriptor,
 			if (!stream_pos->packet_index)
 				goto error;
 
+			/* Lazy open: unknown until the stream is indexed. */
+			if (cfs->index_pending)
+				goto error;
+
 			if (stream_pos->packet_index->len <= 0)
 				continue;
 
@@ -250,6 +270,10 @@ uint64_t ctf_timestamp_end(struct bt_trace_descriptor *descriptor,
 			if (!stream_pos->packet_index)
 				goto error;
 
+			/* Lazy open: unknown until the stream is indexed. */
+			if (cfs->index_pending)
+				goto error;
+
 			if (stream_pos->packet_index->len <= 0)
 				continue;
 
@@ -458,6 +482,365 @@ void ctf_print_discarded(FILE *fp, struct ctf_stream_definition *stream)
 	fflush(fp);
 }
 
+/*
+ * Return whether a declaration can be skipped from its layout alone,
+ * without decoding it. Sequence lengths and variant tags depend on the
+ * value of other fields.
+ */
+static
+int ctf_declaration_skippable(struct bt_declaration *declaration)
+{
+	switch (declaration->id) {
+	case CTF_TYPE_INTEGER:
+	case CTF_TYPE_FLOAT:
+	case CTF_TYPE_ENUM:
+	case CTF_TYPE_STRING:
+		return 1;
+	case CTF_TYPE_STRUCT:
+	{
+		struct declaration_struct *struct_declaration =
+			container_of(declaration, struct declaration_struct, p);
+		int i;
+
+		for (i = 0; i < struct_declaration->fields->len; i++) {
+			struct declaration_field *field =
+				&g_array_index(struct_declaration->fields,
+					struct declaration_field, i);
+
+			if (!ctf_declaration_skippable(field->declaration))
+				return 0;
+		}
+		return 1;
+	}
+	case CTF_TYPE_ARRAY:
+	{
+		struct declaration_array *array_declaration =
+			container_of(declaration, struct declaration_array, p);
+
+		return ctf_declaration_skippable(array_declaration->elem);
+	}
+	case CTF_TYPE_SEQUENCE:
+	case CTF_TYPE_VARIANT:
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Move the position past a declaration without decoding it. The
+ * declaration must be skippable.
+ */
+static
+int ctf_skip_declaration(struct ctf_stream_pos *pos,
+		struct bt_declaration *declaration)
+{
+	if (!ctf_align_pos(pos, declaration->alignment))
+		return -EFAULT;
+
+	switch (declaration->id) {
+	case CTF_TYPE_INTEGER:
+	{
+		struct declaration_integer *integer_declaration =
+			container_of(declaration, struct declaration_integer, p);
+
+		if (!ctf_move_pos(pos, integer_declaration->len))
+			return -EFAULT;
+		return 0;
+	}
+	case CTF_TYPE_FLOAT:
+	{
+		struct declaration_float *float_declaration =
+			container_of(declaration, struct declaration_float, p);
+
+		if (!ctf_move_pos(pos, float_declaration->sign->len
+				+ float_declaration->mantissa->len
+				+ float_declaration->exp->len))
+			return -EFAULT;
+		return 0;
+	}
+	case CTF_TYPE_ENUM:
+	{
+		struct declaration_enum *enum_declaration =
+			container_of(declaration, struct declaration_enum, p);
+
+		return ctf_skip_declaration(pos,
+			&enum_declaration->integer_declaration->p);
+	}
+	case CTF_TYPE_STRING:
+	{
+		char *srcaddr, *end;
+
+		if (!ctf_pos_access_ok(pos, CHAR_BIT))
+			return -EFAULT;
+		srcaddr = ctf_get_pos_addr(pos);
+		end = memchr(srcaddr, '\0',
+			(pos->content_size - pos->offset) / CHAR_BIT);
+		if (!end)
+			return -EFAULT;
+		if (!ctf_move_pos(pos, (end - srcaddr + 1) * CHAR_BIT))
+			return -EFAULT;
+		return 0;
+	}
+	case CTF_TYPE_STRUCT:
+	{
+		struct declaration_struct *struct_declaration =
+			container_of(declaration, struct declaration_struct, p);
+		int i, ret;
+
+		for (i = 0; i < struct_declaration->fields->len; i++) {
+			struct declaration_field *field =
+				&g_array_index(struct_declaration->fields,
+					struct declaration_field, i);
+
+			ret = ctf_skip_declaration(pos, field->declaration);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
+	case CTF_TYPE_ARRAY:
+	{
+		struct declaration_array *array_declaration =
+			container_of(declaration, struct declaration_array, p);
+		struct bt_declaration *elem = array_declaration->elem;
+		size_t i;
+		int ret;
+
+		if (elem->id == CTF_TYPE_INTEGER) {
+			struct declaration_integer *integer_declaration =
+				container_of(elem, struct declaration_integer, p);
+
+			/* Elements are contiguous: skip them at once. */
+			if (!(integer_declaration->len % elem->alignment)) {
+				if (!ctf_move_pos(pos, (uint64_t) integer_declaration->len
+						* array_declaration->len))
+					return -EFAULT;
+				return 0;
+			}
+		}
+		for (i = 0; i < array_declaration->len; i++) {
+			ret = ctf_skip_declaration(pos, elem);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * Skip the contexts and payload of the event which header was just read.
+ * Return -ENOTSUP if the event must be decoded instead.
+ */
+static
+int ctf_skip_event(struct ctf_stream_pos *pos,
+		struct ctf_stream_definition *stream, uint64_t id)
+{
+	struct ctf_stream_declaration *stream_class = stream->stream_class;
+	struct ctf_event_declaration *event_class;
+	int ret;
+
+	if (id >= stream_class->events_by_id->len)
+		return -ENOTSUP;
+	event_class = g_ptr_array_index(stream_class->events_by_id, id);
+	if (!event_class)
+		return -ENOTSUP;
+
+	if (unlikely(event_class->skip == CTF_EVENT_SKIP_UNKNOWN)) {
+		if ((!stream_class->event_context_decl
+				|| ctf_declaration_skippable(&stream_class->event_context_decl->p))
+			&& (!event_class->context_decl
+				|| ctf_declaration_skippable(&event_class->context_decl->p))
+			&& (!event_class->fields_decl
+				|| ctf_declaration_skippable(&event_class->fields_decl->p)))
+			event_class->skip = CTF_EVENT_SKIP_LAYOUT;
+		else
+			event_class->skip = CTF_EVENT_SKIP_DECODE;
+	}
+	if (event_class->skip != CTF_EVENT_SKIP_LAYOUT)
+		return -ENOTSUP;
+
+	if (stream_class->event_context_decl) {
+		ret = ctf_skip_declaration(pos,
+			&stream_class->event_context_decl->p);
+		if (ret)
+			return ret;
+	}
+	if (event_class->context_decl) {
+		ret = ctf_skip_declaration(pos, &event_class->context_decl->p);
+		if (ret)
+			return ret;
+	}
+	if (event_class->fields_decl) {
+		ret = ctf_skip_declaration(pos, &event_class->fields_decl->p);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Reader resource budget. Stream files with an open fd and streams with
+ * a mapped packet are kept in LRU lists. When over
+ * babeltrace_max_open_files or babeltrace_max_mapped_size, the least
+ * recently used streams have their fd closed or their packet unmapped,
+ * and get them back on demand.
+ */
+static BT_LIST_HEAD(open_stream_lru);
+static BT_LIST_HEAD(mapped_stream_lru);
+static unsigned int nr_open_streams;
+static uint64_t mapped_stream_bytes;
+
+static
+void stream_budget_close_fd(struct ctf_file_stream *file_stream)
+{
+	if (babeltrace_prefetch)
+		ctf_prefetch_cancel(file_stream->pos.fd);
+	if (close(file_stream->pos.fd))
+		perror("Error closing file fd");
+	file_stream->pos.fd = -1;
+	file_stream->fd_evicted = 1;
+	bt_list_del(&file_stream->fd_node);
+	file_stream->fd_tracked = 0;
+	nr_open_streams--;
+}
+
+/*
+ * Track the fd of a stream file, closing the least recently used ones
+ * to stay within the budget.
+ */
+static
+void stream_budget_add_fd(struct ctf_file_stream *file_stream)
+{
+	if (!babeltrace_max_open_files)
+		return;
+	bt_list_add(&file_stream->fd_node, &open_stream_lru);
+	file_stream->fd_tracked = 1;
+	nr_open_streams++;
+	while (nr_open_streams > babeltrace_max_open_files) {
+		struct ctf_file_stream *victim;
+
+		victim = bt_list_entry(open_stream_lru.prev,
+				struct ctf_file_stream, fd_node);
+		if (victim == file_stream)
+			break;
+		stream_budget_close_fd(victim);
+	}
+}
+
+static
+void stream_budget_del_fd(struct ctf_file_stream *file_stream)
+{
+	if (!file_stream->fd_tracked)
+		return;
+	bt_list_del(&file_stream->fd_node);
+	file_stream->fd_tracked = 0;
+	nr_open_streams--;
+}
+
+int ctf_file_stream_get_fd(struct ctf_file_stream *file_stream)
+{
+	struct ctf_trace *td = file_stream->parent.stream_class->trace;
+	int fd;
+
+	if (!file_stream->fd_evicted) {
+		if (file_stream->fd_tracked)
+			bt_list_move(&file_stream->fd_node, &open_stream_lru);
+		return file_stream->pos.fd;
+	}
+	fd = openat(td->dirfd, file_stream->parent.path, O_RDONLY);
+	if (fd < 0) {
+		perror("File stream openat()");
+		return fd;
+	}
+	file_stream->pos.fd = fd;
+	file_stream->fd_evicted = 0;
+	stream_budget_add_fd(file_stream);
+	return fd;
+}
+
+static
+void stream_budget_unmap(struct ctf_file_stream *file_stream)
+{
+	struct ctf_stream_pos *pos = &file_stream->pos;
+
+	mapped_stream_bytes -= pos->base_mma->page_aligned_length;
+	if (munmap_align(pos->base_mma))
+		perror("Error unmapping packet");
+	pos->base_mma = NULL;
+	file_stream->map_evicted = 1;
+	bt_list_del(&file_stream->map_node);
+	file_stream->map_tracked = 0;
+}
+
+/*
+ * Track the newly mapped packet of a stream, unmapping the packets of
+ * the least recently read streams to stay within the budget.
+ */
+static
+void stream_budget_add_mapping(struct ctf_file_stream *file_stream)
+{
+	file_stream->map_evicted = 0;
+	if (!babeltrace_max_mapped_size)
+		return;
+	bt_list_add(&file_stream->map_node, &mapped_stream_lru);
+	file_stream->map_tracked = 1;
+	mapped_stream_bytes += file_stream->pos.base_mma->page_aligned_length;
+	while (mapped_stream_bytes > babeltrace_max_mapped_size) {
+		struct ctf_file_stream *victim;
+
+		victim = bt_list_entry(mapped_stream_lru.prev,
+				struct ctf_file_stream, map_node);
+		if (victim == file_stream)
+			break;
+		stream_budget_unmap(victim);
+	}
+}
+
+static
+void stream_budget_del_mapping(struct ctf_file_stream *file_stream)
+{
+	file_stream->map_evicted = 0;
+	if (!file_stream->map_tracked)
+		return;
+	mapped_stream_bytes -=
+		file_stream->pos.base_mma->page_aligned_length;
+	bt_list_del(&file_stream->map_node);
+	file_stream->map_tracked = 0;
+}
+
+/*
+ * Mark a stream as being read: remap its current packet if it was
+ * unmapped by the budget.
+ */
+static
+int stream_budget_touch(struct ctf_file_stream *file_stream)
+{
+	struct ctf_stream_pos *pos = &file_stream->pos;
+	int fd;
+
+	if (!file_stream->map_evicted) {
+		if (file_stream->map_tracked)
+			bt_list_move(&file_stream->map_node,
+				&mapped_stream_lru);
+		return 0;
+	}
+	fd = ctf_file_stream_get_fd(file_stream);
+	if (fd < 0)
+		return -1;
+	pos->base_mma = mmap_align(pos->packet_size / CHAR_BIT, pos->prot,
+			pos->flags, fd, pos->mmap_offset);
+	if (pos->base_mma == MAP_FAILED) {
+		pos->base_mma = NULL;
+		fprintf(stderr, "[error] mmap error %s.\n", strerror(errno));
+		return -1;
+	}
+	stream_budget_add_mapping(file_stream);
+	return 0;
+}
+
 static
 int ctf_read_event(struct bt_stream_pos *ppos, struct ctf_stream_definition *stream)
 {
@@ -488,6 +871,13 @@ int ctf_read_event(struct bt_stream_pos *ppos, struct ctf_stream_definition *str
 	if (unlikely(pos->content_size == 0))
 		return EAGAIN;
 
+	if (unlikely(babeltrace_max_mapped_size)) {
+		ret = stream_budget_touch(container_of(pos,
+				struct ctf_file_stream, pos));
+		if (ret)
+			return -EIO;
+	}
+
 	/*
 	 * Packet seeked to by ctf_pos_get_event() only contains
 	 * headers, no event. Consider stream as inactive (live
@@ -545,6 +935,14 @@ int ctf_read_event(struct bt_stream_pos *ppos, struct ctf_stream_definition *str
 		}
 	}
 
+	if (unlikely(opt_skip_payload)) {
+		ret = ctf_skip_event(pos, stream, id);
+		if (!ret)
+			goto end;
+		if (ret != -ENOTSUP)
+			goto error;
+	}
+
 	/* Read stream-declared event context */
 	if (stream->stream_event_context) {
 		ret = generic_rw(ppos, &stream->stream_event_context->p);
@@ -576,6 +974,7 @@ int ctf_read_event(struct bt_stream_pos *ppos, struct ctf_stream_definition *str
 			goto error;
 	}
 
+end:
 	if (pos->last_offset == pos->offset) {
 		fprintf(stderr, "[error] Invalid 0 byte event encountered.\n");
 		return -EINVAL;
@@ -744,6 +1143,151 @@ retry:
 }
 
 
+/*
+ * Release the current packet mapping. Buffered writer positions own a
+ * heap buffer instead of a file mapping.
+ */
+static
+int unmap_packet(struct ctf_stream_pos *pos)
+{
+	if (pos->buffered) {
+		free(pos->base_mma->page_aligned_addr);
+		free(pos->base_mma);
+		return 0;
+	}
+	return munmap_align(pos->base_mma);
+}
+
+/*
+ * Map the current write packet, growing it to packet_size (in bits) if
+ * it is already mapped. The packet content is preserved.
+ */
+int ctf_pos_map_packet(struct ctf_stream_pos *pos, uint64_t packet_size)
+{
+	struct mmap_align *mma;
+	size_t len = packet_size / CHAR_BIT;
+	int ret;
+
+	if (!pos->buffered) {
+		if (pos->base_mma) {
+			ret = munmap_align(pos->base_mma);
+			pos->base_mma = NULL;
+			if (ret) {
+				return -1;
+			}
+		}
+		ret = posix_fallocate(pos->fd, pos->mmap_offset, len);
+		if (ret) {
+			errno = ret;
+			return -1;
+		}
+		mma = mmap_align(len, pos->prot, pos->flags, pos->fd,
+				pos->mmap_offset);
+		if (mma == MAP_FAILED) {
+			return -1;
+		}
+		goto end;
+	}
+
+	if (!pos->base_mma && pos->spare_mma) {
+		mma = pos->spare_mma;
+		pos->spare_mma = NULL;
+		if (mma->page_aligned_length >= ALIGN(len, PAGE_SIZE)) {
+			/*
+			 * Recycled buffer: cleared as a new one, so that
+			 * no byte of the previous packet is written in
+			 * the fields and padding left unset.
+			 */
+			mma->length = len;
+			memset(mma->addr, 0, mma->page_aligned_length);
+			goto end;
+		}
+		free(mma->page_aligned_addr);
+		free(mma);
+	}
+
+	/*
+	 * Page-aligned buffers of page-multiple length satisfy the
+	 * O_DIRECT constraints of the common file systems.
+	 */
+	mma = malloc(sizeof(*mma));
+	if (!mma) {
+		return -1;
+	}
+	mma->length = len;
+	mma->page_aligned_length = ALIGN(len, PAGE_SIZE);
+	ret = posix_memalign(&mma->page_aligned_addr, PAGE_SIZE,
+			mma->page_aligned_length);
+	if (ret) {
+		free(mma);
+		errno = ret;
+		return -1;
+	}
+	mma->addr = mma->page_aligned_addr;
+	if (pos->base_mma) {
+		size_t old_len = pos->base_mma->length;
+
+		memcpy(mma->addr, mmap_align_addr(pos->base_mma), old_len);
+		memset(mma->addr + old_len, 0,
+			mma->page_aligned_length - old_len);
+		(void) unmap_packet(pos);
+	} else {
+		memset(mma->addr, 0, mma->page_aligned_length);
+	}
+end:
+	pos->base_mma = mma;
+	pos->packet_size = packet_size;
+	return 0;
+}
+
+/*
+ * Write the current packet of a buffered writer position to its file.
+ * Nothing to do for mmap-backed positions, the mapping is shared with
+ * the file.
+ */
+int ctf_pos_write_packet(struct ctf_stream_pos *pos)
+{
+	char *buf;
+	size_t len;
+	off_t offset = pos->mmap_offset;
+
+	if (!pos->buffered || !pos->base_mma) {
+		return 0;
+	}
+
+	buf = mmap_align_addr(pos->base_mma);
+	len = pos->packet_size / CHAR_BIT;
+#ifdef O_DIRECT
+	if (pos->direct && ((len | offset) & (PAGE_SIZE - 1))) {
+		int flags;
+
+		/* Unaligned packet, fall back to buffered I/O. */
+		flags = fcntl(pos->fd, F_GETFL);
+		if (flags < 0 || fcntl(pos->fd, F_SETFL, flags & ~O_DIRECT)) {
+			return -1;
+		}
+		pos->direct = 0;
+	}
+#endif
+	while (len) {
+		ssize_t written;
+
+		written = pwrite(pos->fd, buf, len, offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "[error] Unable to write packet: %s.\n",
+				strerror(errno));
+			return -1;
+		}
+		buf += written;
+		offset += written;
+		len -= written;
+	}
+	return 0;
+}
+
 int ctf_init_pos(struct ctf_stream_pos *pos, struct bt_trace_descriptor *trace,
 		int fd, int open_flags)
 {
@@ -758,6 +1302,10 @@ int ctf_init_pos(struct ctf_stream_pos *pos, struct bt_trace_descriptor *trace,
 	case O_RDONLY:
 		pos->prot = PROT_READ;
 		pos->flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+		if (babeltrace_mmap_populate)
+			pos->flags |= MAP_POPULATE;
+#endif
 		pos->parent.rw_table = read_dispatch_table;
 		pos->parent.event_cb = ctf_read_event;
 		pos->parent.trace = trace;
@@ -783,13 +1331,18 @@ int ctf_fini_pos(struct ctf_stream_pos *pos)
 		int ret;
 
 		/* unmap old base */
-		ret = munmap_align(pos->base_mma);
+		ret = unmap_packet(pos);
 		if (ret) {
 			fprintf(stderr, "[error] Unable to unmap old base: %s.\n",
 				strerror(errno));
 			return -1;
 		}
 	}
+	if (pos->spare_mma) {
+		free(pos->spare_mma->page_aligned_addr);
+		free(pos->spare_mma);
+		pos->spare_mma = NULL;
+	}
 	if (pos->packet_index)
 		(void) g_array_free(pos->packet_index, TRUE);
 	return 0;
@@ -849,6 +1402,42 @@ void ctf_update_current_packet_index(struct ctf_stream_definition *stream,
 	stream->events_discarded = events_discarded_diff;
 }
 
+/*
+ * Get the packets following the current one in the page cache by the
+ * time they are mapped, either by reading them asynchronously (prefetch)
+ * or by hinting the kernel (readahead). Packets already requested are
+ * not requested again when reading sequentially.
+ */
+static
+void ctf_pos_readahead(struct ctf_stream_pos *pos)
+{
+	uint64_t i, end, window;
+
+	window = babeltrace_prefetch ? : babeltrace_readahead;
+	if (!window || pos->fd < 0 || !pos->packet_index)
+		return;
+	end = min(pos->cur_index + 1 + window, pos->packet_index->len);
+	i = pos->readahead_index;
+	if (i <= pos->cur_index || i > end)
+		i = pos->cur_index + 1;
+	for (; i < end; i++) {
+		struct packet_index *index;
+
+		index = &g_array_index(pos->packet_index,
+				struct packet_index, i);
+		if (babeltrace_prefetch) {
+			ctf_prefetch_range(pos->fd, index->offset,
+				index->packet_size / CHAR_BIT);
+			continue;
+		}
+#ifdef POSIX_FADV_WILLNEED
+		(void) posix_fadvise(pos->fd, index->offset,
+			index->packet_size / CHAR_BIT, POSIX_FADV_WILLNEED);
+#endif
+	}
+	pos->readahead_index = end;
+}
+
 /*
  * for SEEK_CUR: go to next packet.
  * for SEEK_SET: go to packet numer (index).
@@ -859,8 +1448,8 @@ void ctf_packet_seek(struct bt_stream_pos *stream_pos, size_t index, int whence)
 		container_of(stream_pos, struct ctf_stream_pos, parent);
 	struct ctf_file_stream *file_stream =
 		container_of(pos, struct ctf_file_stream, pos);
+	struct bt_bench_sample sample;
 	int ret;
-	off_t off;
 	struct packet_index *packet_index, *prev_index;
 
 	switch (whence) {
@@ -875,8 +1464,10 @@ void ctf_packet_seek(struct bt_stream_pos *stream_pos, size_t index, int whence)
 		*pos->content_size_loc = pos->offset;
 
 	if (pos->base_mma) {
+		if (!(pos->prot & PROT_WRITE))
+			stream_budget_del_mapping(file_stream);
 		/* unmap old base */
-		ret = munmap_align(pos->base_mma);
+		ret = unmap_packet(pos);
 		if (ret) {
 			fprintf(stderr, "[error] Unable to unmap old base: %s.\n",
 				strerror(errno));
@@ -903,12 +1494,23 @@ void ctf_packet_seek(struct bt_stream_pos *stream_pos, size_t index, int whence)
 			assert(0);
 		}
 		pos->content_size = -1U;	/* Unknown at this point */
-		pos->packet_size = WRITE_PACKET_LEN;
-		off = posix_fallocate(pos->fd, pos->mmap_offset,
-				      pos->packet_size / CHAR_BIT);
-		assert(off >= 0);
+		ret = ctf_pos_map_packet(pos,
+				pos->next_packet_size ? : WRITE_PACKET_LEN);
+		if (ret) {
+			/* Writes are refused past EOF, callers check it. */
+			fprintf(stderr, "[error] Unable to map packet: %s.\n",
+				strerror(errno));
+			pos->content_size_loc = NULL;
+			pos->offset = EOF;
+			return;
+		}
 		pos->offset = 0;
+		return;
 	} else {
+		if (ctf_file_stream_load(file_stream)) {
+			pos->offset = EOF;
+			return;
+		}
 	read_next_packet:
 		switch (whence) {
 		case SEEK_CUR:
@@ -966,6 +1568,12 @@ void ctf_packet_seek(struct bt_stream_pos *stream_pos, size_t index, int whence)
 
 		file_stream->parent.real_timestamp = packet_index->ts_real.timestamp_begin;
 
+		if (file_stream->fd_evicted
+				&& ctf_file_stream_get_fd(file_stream) < 0) {
+			pos->offset = EOF;
+			return;
+		}
+
 		/* Lookup context/packet size in index */
 		if (packet_index->data_offset == -1) {
 			ret = find_data_offset(pos, file_stream, packet_index);
@@ -990,6 +1598,7 @@ void ctf_packet_seek(struct bt_stream_pos *stream_pos, size_t index, int whence)
 		}
 	}
 	/* map new base. Need mapping length from header. */
+	bt_bench_start(&sample);
 	pos->base_mma = mmap_align(pos->packet_size / CHAR_BIT, pos->prot,
 			pos->flags, pos->fd, pos->mmap_offset);
 	if (pos->base_mma == MAP_FAILED) {
@@ -997,6 +1606,18 @@ void ctf_packet_seek(struct bt_stream_pos *stream_pos, size_t index, int whence)
 			strerror(errno));
 		assert(0);
 	}
+#ifdef MADV_HUGEPAGE
+	if (babeltrace_mmap_hugepage &&
+			pos->base_mma->page_aligned_length >= HUGEPAGE_MAP_LEN) {
+		/* Only a hint: ignore errors. */
+		(void) madvise(pos->base_mma->page_aligned_addr,
+			pos->base_mma->page_aligned_length, MADV_HUGEPAGE);
+	}
+#endif
+	if (!(pos->prot & PROT_WRITE)) {
+		stream_budget_add_mapping(file_stream);
+		ctf_pos_readahead(pos);
+	}
 
 	/* update trace_packet_header and stream_packet_context */
 	if (!(pos->prot & PROT_WRITE) &&
@@ -1011,6 +1632,12 @@ void ctf_packet_seek(struct bt_stream_pos *stream_pos, size_t index, int whence)
 		ret = generic_rw(&pos->parent, &file_stream->parent.stream_packet_context->p);
 		assert(!ret);
 	}
+	if (babeltrace_bench && !(pos->prot & PROT_WRITE)) {
+		babeltrace_bench_stats.packets_mapped++;
+		babeltrace_bench_stats.bytes_mapped +=
+			pos->content_size / CHAR_BIT;
+		bt_bench_stop(BT_BENCH_PHASE_PACKET_MAP, &sample);
+	}
 }
 
 static
@@ -1753,6 +2380,27 @@ retry:
 	goto begin;
 }
 
+/*
+ * Index the packets of a stream from the current mapping offset to the
+ * end of the file.
+ */
+static
+int create_stream_remaining_packet_index(struct ctf_trace *td,
+			struct ctf_file_stream *file_stream,
+			size_t filesize)
+{
+	struct ctf_stream_pos *pos = &file_stream->pos;
+	int ret;
+
+	while (pos->mmap_offset < filesize) {
+		ret = create_stream_one_packet_index(pos, td, file_stream,
+			filesize);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
 static
 int create_stream_packet_index(struct ctf_trace *td,
 			struct ctf_file_stream *file_stream)
@@ -1791,12 +2439,60 @@ int create_stream_packet_index(struct ctf_trace *td,
 		}
 	}
 
-	for (pos->mmap_offset = 0; pos->mmap_offset < filestats.st_size; ) {
+	pos->mmap_offset = 0;
+	if (babeltrace_lazy_open) {
+		/*
+		 * Index the first packet to find the stream class. The
+		 * other packets are indexed by ctf_file_stream_load().
+		 */
 		ret = create_stream_one_packet_index(pos, td, file_stream,
 			filestats.st_size);
 		if (ret)
 			return ret;
+		file_stream->index_pending =
+			pos->mmap_offset < filestats.st_size;
+		return 0;
 	}
+	return create_stream_remaining_packet_index(td, file_stream,
+			filestats.st_size);
+}
+
+/*
+ * Complete the opening of a stream deferred by lazy open: index its
+ * remaining packets and create its definitions.
+ */
+int ctf_file_stream_load(struct ctf_file_stream *file_stream)
+{
+	struct ctf_trace *td = file_stream->parent.stream_class->trace;
+	struct ctf_stream_pos *pos = &file_stream->pos;
+	struct stat filestats;
+	int ret;
+
+	if (likely(!file_stream->index_pending
+			&& file_stream->parent.stream_definitions_created))
+		return 0;
+	ret = create_stream_definitions(td, &file_stream->parent);
+	if (ret)
+		return ret;
+	if (!file_stream->index_pending)
+		return 0;
+	if (ctf_file_stream_get_fd(file_stream) < 0)
+		return -errno;
+	ret = fstat(pos->fd, &filestats);
+	if (ret < 0)
+		return -errno;
+	ret = create_stream_remaining_packet_index(td, file_stream,
+			filestats.st_size);
+	if (pos->base_mma) {
+		if (munmap_align(pos->base_mma))
+			perror("Error unmapping packet");
+		pos->base_mma = NULL;
+	}
+	if (ret) {
+		fprintf(stderr, "[error] Stream index creation error.\n");
+		return ret;
+	}
+	file_stream->index_pending = 0;
 	return 0;
 }
 
@@ -1906,9 +2602,13 @@ int import_stream_packet_index(struct ctf_trace *td,
 			goto error;
 		}
 		file_stream->parent.stream_class = stream;
-		ret = create_stream_definitions(td, &file_stream->parent);
-		if (ret)
-			goto error;
+		/* Lazy open: created by ctf_file_stream_load(). */
+		if (!babeltrace_lazy_open) {
+			ret = create_stream_definitions(td,
+					&file_stream->parent);
+			if (ret)
+				goto error;
+		}
 		first_packet = 0;
 		/* add index to packet array */
 		g_array_append_val(file_stream->pos.packet_index, index);
@@ -2041,6 +2741,25 @@ int ctf_open_file_stream_read(struct ctf_trace *td, const char *path, int flags,
 	/* Add stream file to stream class */
 	g_ptr_array_add(file_stream->parent.stream_class->streams,
 			&file_stream->parent);
+	if (babeltrace_lazy_open) {
+		/*
+		 * Release the first packet header mapping and the fd
+		 * until the stream is read.
+		 */
+		if (file_stream->pos.base_mma) {
+			ret = munmap_align(file_stream->pos.base_mma);
+			if (ret)
+				perror("Error unmapping packet");
+			file_stream->pos.base_mma = NULL;
+		}
+		ret = close(fd);
+		if (ret)
+			perror("Error on fd close");
+		file_stream->pos.fd = -1;
+		file_stream->fd_evicted = 1;
+		return 0;
+	}
+	stream_budget_add_fd(file_stream);
 	return 0;
 
 error_index:
@@ -2078,12 +2797,14 @@ int ctf_open_trace_read(struct ctf_trace *td,
 			int whence), FILE *metadata_fp)
 {
 	struct ctf_scanner *scanner;
+	struct bt_bench_sample open_sample, metadata_sample;
 	int ret, closeret;
 	struct dirent *dirent;
 	struct dirent *diriter;
 	size_t dirent_len;
 	char *ext;
 
+	bt_bench_start(&open_sample);
 	td->flags = flags;
 
 	/* Open trace directory */
@@ -2115,8 +2836,10 @@ int ctf_open_trace_read(struct ctf_trace *td,
 		ret = -ENOMEM;
 		goto error_metadata;
 	}
+	bt_bench_start(&metadata_sample);
 	ret = ctf_trace_metadata_read(td, metadata_fp, scanner, 0);
 	ctf_scanner_free(scanner);
+	bt_bench_stop(BT_BENCH_PHASE_METADATA, &metadata_sample);
 	if (ret) {
 		if (ret == -ENOENT) {
 			fprintf(stderr, "[warning] Empty metadata.\n");
@@ -2165,6 +2888,7 @@ int ctf_open_trace_read(struct ctf_trace *td,
 	}
 
 	free(dirent);
+	bt_bench_stop(BT_BENCH_PHASE_OPEN_INDEX, &open_sample);
 	return 0;
 
 readdir_error:
@@ -2180,6 +2904,7 @@ error_dirfd:
 		perror("Error on closedir");
 	}
 error:
+	bt_bench_stop(BT_BENCH_PHASE_OPEN_INDEX, &open_sample);
 	return ret;
 }
 
@@ -2215,8 +2940,8 @@ struct bt_trace_descriptor *ctf_open_trace(const char *path, int flags,
 			goto error;
 		break;
 	case O_RDWR:
-		fprintf(stderr, "[error] Opening CTF traces for output is not supported yet.\n");
-		goto error;
+		g_free(td);
+		return ctf_copy_open_trace(path);
 	default:
 		fprintf(stderr, "[error] Incorrect open flags.\n");
 		goto error;
@@ -2424,7 +3149,8 @@ int ctf_append_trace_metadata(struct bt_trace_descriptor *tdp,
 			struct ctf_stream_definition *stream;
 
 			stream = g_ptr_array_index(stream_class->streams, j);
-			if (!stream)
+			/* Lazily opened streams get them when first read. */
+			if (!stream || !stream->stream_definitions_created)
 				continue;
 			ret = copy_event_declarations_stream_class_to_stream(td,
 				stream_class, stream);
@@ -2485,12 +3211,17 @@ int ctf_close_file_stream(struct ctf_file_stream *file_stream)
 {
 	int ret;
 
+	if (file_stream->pos.base_mma)
+		stream_budget_del_mapping(file_stream);
+	stream_budget_del_fd(file_stream);
 	ret = ctf_fini_pos(&file_stream->pos);
 	if (ret) {
 		fprintf(stderr, "Error on ctf_fini_pos\n");
 		return -1;
 	}
 	if (file_stream->pos.fd >= 0) {
+		if (babeltrace_prefetch)
+			ctf_prefetch_cancel(file_stream->pos.fd);
 		ret = close(file_stream->pos.fd);
 		if (ret) {
 			perror("Error closing file fd");
@@ -2506,6 +3237,9 @@ int ctf_close_trace(struct bt_trace_descriptor *tdp)
 	struct ctf_trace *td = container_of(tdp, struct ctf_trace, parent);
 	int ret;
 
+	if (ctf_copy_is_trace(tdp))
+		return ctf_copy_close_trace(tdp);
+
 	if (td->streams) {
 		int i;
 
@@ -32,9 +32,44 @@
 #include <babeltrace/object-internal.h>
 #include <babeltrace/ref.h>
 #include <babeltrace/compiler.h>
+#include <babeltrace/bitfield.h>
+#include <float.h>
+#include <assert.h>
 
 #define PACKET_LEN_INCREMENT	(getpagesize() * 8 * CHAR_BIT)
 
+/* Largest number of scalar fields of a flat serializer */
+#define LAYOUT_MAX_OPS		1024
+
+enum layout_op_kind {
+	LAYOUT_OP_INTEGER,
+	LAYOUT_OP_FLOAT,
+	LAYOUT_OP_DOUBLE,
+};
+
+/* A scalar field at a fixed offset from the start of its layout */
+struct layout_op {
+	uint64_t offset;	/* in bits */
+	unsigned int len;	/* in bits */
+	enum layout_op_kind kind;
+	int byte_order;
+	int signedness;
+};
+
+/*
+ * Compiled form of a frozen structure type containing only integers,
+ * enumerations, IEEE 754 floats, structures and arrays. Once its start
+ * is aligned, every scalar of such a structure lies at a fixed offset,
+ * so its fields are written in a single pass after one bounds check.
+ */
+struct bt_ctf_field_type_layout {
+	int flat;		/* 0 if the type has a variable layout */
+	unsigned int alignment;	/* in bits */
+	uint64_t size;		/* in bits */
+	size_t nr_ops;
+	struct layout_op ops[];
+};
+
 static
 struct bt_ctf_field *bt_ctf_field_integer_create(struct bt_ctf_field_type *);
 static
@@ -408,6 +443,135 @@ end:
 	return ret;
 }
 
+/*
+ * Whether the set state of fields of this type only changes through the
+ * field setters and can thus be tracked by their structures.
+ */
+static
+int field_type_is_trackable(struct bt_ctf_field_type *type)
+{
+	size_t i;
+	struct bt_ctf_field_type_structure *structure_type;
+
+	switch (bt_ctf_field_type_get_type_id(type)) {
+	case CTF_TYPE_INTEGER:
+	case CTF_TYPE_ENUM:
+	case CTF_TYPE_FLOAT:
+	case CTF_TYPE_STRING:
+		return 1;
+	case CTF_TYPE_STRUCT:
+		break;
+	default:
+		return 0;
+	}
+
+	structure_type = container_of(type, struct bt_ctf_field_type_structure,
+		parent);
+	for (i = 0; i < structure_type->fields->len; i++) {
+		struct structure_field *member =
+			g_ptr_array_index(structure_type->fields, i);
+
+		if (!field_type_is_trackable(member->type)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static
+int field_is_set(struct bt_ctf_field *field)
+{
+	return field && !bt_ctf_field_validate(field);
+}
+
+/* An enumeration's set state is the one of its container. */
+static
+void field_set_owner(struct bt_ctf_field *field, struct bt_ctf_field *owner)
+{
+	field->owner = owner;
+	if (bt_ctf_field_type_get_type_id(field->type) == CTF_TYPE_ENUM) {
+		struct bt_ctf_field_enumeration *enumeration = container_of(
+			field, struct bt_ctf_field_enumeration, parent);
+
+		if (enumeration->payload) {
+			enumeration->payload->owner = owner;
+		}
+	}
+}
+
+/*
+ * Update the unset member counts of the structures containing a field
+ * which was set or reset, up to the first structure whose own state
+ * does not change.
+ */
+static
+void field_update_owners(struct bt_ctf_field *field, int set)
+{
+	struct bt_ctf_field *owner;
+
+	for (owner = field->owner; owner; owner = owner->owner) {
+		struct bt_ctf_field_structure *structure = container_of(owner,
+			struct bt_ctf_field_structure, parent);
+		int was_set = !structure->unset_count;
+
+		if (set) {
+			structure->unset_count--;
+		} else {
+			structure->unset_count++;
+		}
+
+		if (was_set == !structure->unset_count) {
+			break;
+		}
+	}
+}
+
+/* Record that a member of the structure and its owners was modified. */
+static
+void structure_bump_generation(struct bt_ctf_field *field)
+{
+	for (; field; field = field->owner) {
+		struct bt_ctf_field_structure *structure = container_of(field,
+			struct bt_ctf_field_structure, parent);
+
+		structure->generation++;
+	}
+}
+
+/*
+ * Stop tracking a structure whose members may change without it being
+ * notified, along with the structures containing it.
+ */
+static
+void structure_untrack(struct bt_ctf_field *field)
+{
+	for (; field; field = field->owner) {
+		struct bt_ctf_field_structure *structure = container_of(field,
+			struct bt_ctf_field_structure, parent);
+
+		structure->tracked = 0;
+	}
+}
+
+/* Take ownership of a lazily created structure member. */
+static
+void structure_track_member(struct bt_ctf_field *field,
+		struct bt_ctf_field *member)
+{
+	struct bt_ctf_field_structure *structure = container_of(field,
+		struct bt_ctf_field_structure, parent);
+
+	if (!structure->tracked) {
+		return;
+	}
+
+	field_set_owner(member, field);
+	if (field_is_set(member)) {
+		/* Empty structures are set as soon as they exist. */
+		field_update_owners(member, 1);
+	}
+}
+
 struct bt_ctf_field *bt_ctf_field_structure_get_field(
 		struct bt_ctf_field *field, const char *name)
 {
@@ -444,6 +608,7 @@ struct bt_ctf_field *bt_ctf_field_structure_get_field(
 	}
 
 	structure->fields->pdata[index] = new_field;
+	structure_track_member(field, new_field);
 end:
 	bt_get(new_field);
 error:
@@ -497,6 +662,7 @@ struct bt_ctf_field *bt_ctf_field_structure_get_field_by_index(
 	}
 
 	structure->fields->pdata[index] = ret_field;
+	structure_track_member(field, ret_field);
 end:
 	bt_get(ret_field);
 error:
@@ -512,6 +678,7 @@ int bt_ctf_field_structure_set_field(struct bt_ctf_field *field,
 	GQuark field_quark;
 	struct bt_ctf_field_structure *structure;
 	struct bt_ctf_field_type *expected_field_type = NULL;
+	struct bt_ctf_field *old_value;
 	size_t index;
 
 	if (!field || !name || !value ||
@@ -536,8 +703,25 @@ int bt_ctf_field_structure_set_field(struct bt_ctf_field *field,
 		goto end;
 	}
 
-	if (structure->fields->pdata[index]) {
-		bt_put(structure->fields->pdata[index]);
+	old_value = structure->fields->pdata[index];
+	if (structure->tracked && value->owner && value->owner != field) {
+		/* Already tracked by another structure. */
+		structure_untrack(field);
+	} else if (structure->tracked) {
+		int was_set = field_is_set(old_value);
+
+		field_set_owner(value, field);
+		if (field_is_set(value) != was_set) {
+			field_update_owners(value, !was_set);
+		}
+		structure_bump_generation(field);
+	}
+
+	if (old_value) {
+		if (old_value->owner == field && old_value != value) {
+			field_set_owner(old_value, NULL);
+		}
+		bt_put(old_value);
 	}
 
 	structure->fields->pdata[index] = value;
@@ -745,6 +929,9 @@ struct bt_ctf_field *bt_ctf_field_enumeration_get_container(
 			struct bt_ctf_field_type_enumeration, parent);
 		enumeration->payload =
 			bt_ctf_field_create(enumeration_type->container);
+		if (enumeration->payload) {
+			enumeration->payload->owner = field->owner;
+		}
 	}
 
 	container = enumeration->payload;
@@ -869,7 +1056,7 @@ int bt_ctf_field_signed_integer_set_value(struct bt_ctf_field *field,
 	}
 
 	integer->definition.value._signed = value;
-	integer->parent.payload_set = 1;
+	bt_ctf_field_set_payload_set(field, 1);
 end:
 	return ret;
 }
@@ -934,7 +1121,7 @@ int bt_ctf_field_unsigned_integer_set_value(struct bt_ctf_field *field,
 	}
 
 	integer->definition.value._unsigned = value;
-	integer->parent.payload_set = 1;
+	bt_ctf_field_set_payload_set(field, 1);
 end:
 	return ret;
 }
@@ -974,7 +1161,7 @@ int bt_ctf_field_floating_point_set_value(struct bt_ctf_field *field,
 	floating_point = container_of(field, struct bt_ctf_field_floating_point,
 		parent);
 	floating_point->definition.value = value;
-	floating_point->parent.payload_set = 1;
+	bt_ctf_field_set_payload_set(field, 1);
 end:
 	return ret;
 }
@@ -1017,7 +1204,7 @@ int bt_ctf_field_string_set_value(struct bt_ctf_field *field,
 		string->payload = g_string_new(value);
 	}
 
-	string->parent.payload_set = 1;
+	bt_ctf_field_set_payload_set(field, 1);
 end:
 	return ret;
 }
@@ -1043,7 +1230,7 @@ int bt_ctf_field_string_append(struct bt_ctf_field *field,
 		string_field->payload = g_string_new(value);
 	}
 
-	string_field->parent.payload_set = 1;
+	bt_ctf_field_set_payload_set(field, 1);
 
 end:
 	return ret;
@@ -1082,7 +1269,7 @@ int bt_ctf_field_string_append_len(struct bt_ctf_field *field,
 			effective_length);
 	}
 
-	string_field->parent.payload_set = 1;
+	bt_ctf_field_set_payload_set(field, 1);
 
 end:
 	return ret;
@@ -1110,6 +1297,18 @@ end:
 	return ret;
 }
 
+BT_HIDDEN
+void bt_ctf_field_set_payload_set(struct bt_ctf_field *field, int set)
+{
+	structure_bump_generation(field->owner);
+	if (field->payload_set == set) {
+		return;
+	}
+
+	field->payload_set = set;
+	field_update_owners(field, set);
+}
+
 BT_HIDDEN
 int bt_ctf_field_reset(struct bt_ctf_field *field)
 {
@@ -1266,6 +1465,8 @@ struct bt_ctf_field *bt_ctf_field_structure_create(
 		(GDestroyNotify)bt_ctf_field_put);
 	g_ptr_array_set_size(structure->fields,
 		g_hash_table_size(structure->field_name_to_index));
+	structure->tracked = field_type_is_trackable(type);
+	structure->unset_count = structure->fields->len;
 	field = &structure->parent;
 end:
 	return field;
@@ -1387,6 +1588,7 @@ void bt_ctf_field_floating_point_destroy(struct bt_ctf_field *field)
 static
 void bt_ctf_field_structure_destroy(struct bt_ctf_field *field)
 {
+	size_t i;
 	struct bt_ctf_field_structure *structure;
 
 	if (!field) {
@@ -1394,6 +1596,14 @@ void bt_ctf_field_structure_destroy(struct bt_ctf_field *field)
 	}
 
 	structure = container_of(field, struct bt_ctf_field_structure, parent);
+	for (i = 0; i < structure->fields->len; i++) {
+		struct bt_ctf_field *member = structure->fields->pdata[i];
+
+		/* Members may outlive their structure. */
+		if (member && member->owner == field) {
+			field_set_owner(member, NULL);
+		}
+	}
 	g_ptr_array_free(structure->fields, TRUE);
 	g_free(structure);
 }
@@ -1501,12 +1711,28 @@ int bt_ctf_field_structure_validate(struct bt_ctf_field *field)
 	}
 
 	structure = container_of(field, struct bt_ctf_field_structure, parent);
+#ifndef BT_CTF_FIELD_DEBUG
+	if (structure->tracked) {
+		ret = structure->unset_count ? -1 : 0;
+		goto end;
+	}
+#endif
+
 	for (i = 0; i < structure->fields->len; i++) {
 		ret = bt_ctf_field_validate(structure->fields->pdata[i]);
 		if (ret) {
-			goto end;
+			break;
 		}
 	}
+#ifdef BT_CTF_FIELD_DEBUG
+	/*
+	 * Builds defining BT_CTF_FIELD_DEBUG always walk the members and
+	 * reject a structure whose tracked state disagrees with them.
+	 */
+	if (structure->tracked && !ret != !structure->unset_count) {
+		ret = -1;
+	}
+#endif
 end:
 	return ret;
 }
@@ -1584,7 +1810,7 @@ int bt_ctf_field_generic_reset(struct bt_ctf_field *field)
 		goto end;
 	}
 
-	field->payload_set = 0;
+	bt_ctf_field_set_payload_set(field, 0);
 end:
 	return ret;
 }
@@ -1813,6 +2039,309 @@ end:
 	return ret;
 }
 
+static
+int layout_compile(struct bt_ctf_field_type *type, GArray *ops,
+		uint64_t *offset)
+{
+	int ret = 0;
+	size_t i;
+	struct layout_op op;
+
+	switch (bt_ctf_field_type_get_type_id(type)) {
+	case CTF_TYPE_INTEGER:
+	{
+		struct declaration_integer *declaration = container_of(
+			type->declaration, struct declaration_integer, p);
+
+		*offset += offset_align(*offset, declaration->p.alignment);
+		op.offset = *offset;
+		op.len = declaration->len;
+		op.kind = LAYOUT_OP_INTEGER;
+		op.byte_order = declaration->byte_order;
+		op.signedness = declaration->signedness;
+		break;
+	}
+	case CTF_TYPE_ENUM:
+	{
+		struct bt_ctf_field_type_enumeration *enumeration =
+			container_of(type,
+				struct bt_ctf_field_type_enumeration, parent);
+
+		return layout_compile(enumeration->container, ops, offset);
+	}
+	case CTF_TYPE_FLOAT:
+	{
+		struct declaration_float *declaration = container_of(
+			type->declaration, struct declaration_float, p);
+
+		/*
+		 * Only the native float and double formats are copied as is,
+		 * other mantissa and exponent sizes use the generic path.
+		 */
+		if (declaration->mantissa->len + 1 == FLT_MANT_DIG &&
+				declaration->mantissa->len + 1 +
+				declaration->exp->len ==
+				sizeof(float) * CHAR_BIT) {
+			op.kind = LAYOUT_OP_FLOAT;
+			op.len = sizeof(float) * CHAR_BIT;
+		} else if (declaration->mantissa->len + 1 == DBL_MANT_DIG &&
+				declaration->mantissa->len + 1 +
+				declaration->exp->len ==
+				sizeof(double) * CHAR_BIT) {
+			op.kind = LAYOUT_OP_DOUBLE;
+			op.len = sizeof(double) * CHAR_BIT;
+		} else {
+			ret = -1;
+			goto end;
+		}
+		*offset += offset_align(*offset, declaration->p.alignment);
+		op.offset = *offset;
+		op.byte_order = declaration->byte_order;
+		op.signedness = 0;
+		break;
+	}
+	case CTF_TYPE_STRUCT:
+	{
+		struct bt_ctf_field_type_structure *structure = container_of(
+			type, struct bt_ctf_field_type_structure, parent);
+
+		*offset += offset_align(*offset, type->declaration->alignment);
+		for (i = 0; i < structure->fields->len; i++) {
+			struct structure_field *field = g_ptr_array_index(
+				structure->fields, i);
+
+			ret = layout_compile(field->type, ops, offset);
+			if (ret) {
+				goto end;
+			}
+		}
+		goto end;
+	}
+	case CTF_TYPE_ARRAY:
+	{
+		struct bt_ctf_field_type_array *array = container_of(
+			type, struct bt_ctf_field_type_array, parent);
+
+		if (array->length > LAYOUT_MAX_OPS) {
+			ret = -1;
+			goto end;
+		}
+		for (i = 0; i < array->length; i++) {
+			ret = layout_compile(array->element_type, ops, offset);
+			if (ret) {
+				goto end;
+			}
+		}
+		goto end;
+	}
+	default:
+		/* Variants, sequences and strings have a variable size. */
+		ret = -1;
+		goto end;
+	}
+
+	if (ops->len >= LAYOUT_MAX_OPS) {
+		ret = -1;
+		goto end;
+	}
+	g_array_append_val(ops, op);
+	*offset += op.len;
+end:
+	return ret;
+}
+
+/*
+ * Get the flat serializer of a frozen structure type, compiling it on
+ * first use. Concurrent callers may both compile it; only one layout is
+ * published.
+ */
+static
+struct bt_ctf_field_type_layout *get_type_layout(
+		struct bt_ctf_field_type *type)
+{
+	struct bt_ctf_field_type_layout *layout, *expected = NULL;
+	GArray *ops;
+	uint64_t size = 0;
+
+	layout = __atomic_load_n(&type->layout, __ATOMIC_ACQUIRE);
+	if (layout) {
+		goto end;
+	}
+
+	ops = g_array_new(FALSE, FALSE, sizeof(struct layout_op));
+	if (layout_compile(type, ops, &size)) {
+		g_array_set_size(ops, 0);
+		layout = g_malloc0(sizeof(*layout));
+	} else {
+		layout = g_malloc0(sizeof(*layout) +
+			ops->len * sizeof(struct layout_op));
+		layout->flat = 1;
+		layout->alignment = type->declaration->alignment;
+		layout->size = size;
+		layout->nr_ops = ops->len;
+		memcpy(layout->ops, ops->data,
+			ops->len * sizeof(struct layout_op));
+	}
+	g_array_free(ops, TRUE);
+
+	if (!__atomic_compare_exchange_n(&type->layout, &expected, layout,
+			FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		g_free(layout);
+		layout = expected;
+	}
+end:
+	return layout;
+}
+
+static
+void layout_write_unsigned(char *base, uint64_t offset,
+		const struct layout_op *op, uint64_t value)
+{
+	if (op->byte_order == LITTLE_ENDIAN) {
+		bt_bitfield_write_le(base, unsigned char, offset, op->len,
+			value);
+	} else {
+		bt_bitfield_write_be(base, unsigned char, offset, op->len,
+			value);
+	}
+}
+
+/*
+ * Store the scalars of a field in the order in which they were
+ * compiled. "start" is the offset of the layout in the packet, in bits.
+ */
+static
+int layout_write_field(struct bt_ctf_field *field,
+		const struct layout_op **op, char *base, uint64_t start)
+{
+	int ret = 0;
+	size_t i;
+
+	if (!field) {
+		ret = -1;
+		goto end;
+	}
+
+	switch (bt_ctf_field_type_get_type_id(field->type)) {
+	case CTF_TYPE_INTEGER:
+	{
+		struct bt_ctf_field_integer *integer = container_of(field,
+			struct bt_ctf_field_integer, parent);
+		uint64_t offset = start + (*op)->offset;
+
+		if (!(*op)->signedness) {
+			layout_write_unsigned(base, offset, *op,
+				integer->definition.value._unsigned);
+		} else if ((*op)->byte_order == LITTLE_ENDIAN) {
+			bt_bitfield_write_le(base, unsigned char, offset,
+				(*op)->len, integer->definition.value._signed);
+		} else {
+			bt_bitfield_write_be(base, unsigned char, offset,
+				(*op)->len, integer->definition.value._signed);
+		}
+		(*op)++;
+		break;
+	}
+	case CTF_TYPE_ENUM:
+	{
+		struct bt_ctf_field_enumeration *enumeration = container_of(
+			field, struct bt_ctf_field_enumeration, parent);
+
+		ret = layout_write_field(enumeration->payload, op, base,
+			start);
+		break;
+	}
+	case CTF_TYPE_FLOAT:
+	{
+		struct bt_ctf_field_floating_point *floating_point =
+			container_of(field, struct bt_ctf_field_floating_point,
+				parent);
+		union {
+			float f;
+			double d;
+			uint32_t u32;
+			uint64_t u64;
+		} u;
+
+		if ((*op)->kind == LAYOUT_OP_FLOAT) {
+			u.f = floating_point->definition.value;
+			layout_write_unsigned(base, start + (*op)->offset, *op,
+				u.u32);
+		} else {
+			u.d = floating_point->definition.value;
+			layout_write_unsigned(base, start + (*op)->offset, *op,
+				u.u64);
+		}
+		(*op)++;
+		break;
+	}
+	case CTF_TYPE_STRUCT:
+	{
+		struct bt_ctf_field_structure *structure = container_of(
+			field, struct bt_ctf_field_structure, parent);
+
+		for (i = 0; i < structure->fields->len && !ret; i++) {
+			ret = layout_write_field(g_ptr_array_index(
+				structure->fields, i), op, base, start);
+		}
+		break;
+	}
+	case CTF_TYPE_ARRAY:
+	{
+		struct bt_ctf_field_array *array = container_of(
+			field, struct bt_ctf_field_array, parent);
+
+		for (i = 0; i < array->elements->len && !ret; i++) {
+			ret = layout_write_field(g_ptr_array_index(
+				array->elements, i), op, base, start);
+		}
+		break;
+	}
+	default:
+		ret = -1;
+	}
+end:
+	return ret;
+}
+
+static
+int layout_serialize(struct bt_ctf_field *field,
+		struct bt_ctf_field_type_layout *layout,
+		struct ctf_stream_pos *pos)
+{
+	int ret = 0;
+	const struct layout_op *op = layout->ops;
+
+	while (!ctf_pos_access_ok(pos,
+		offset_align(pos->offset, layout->alignment) +
+			layout->size)) {
+		ret = increase_packet_size(pos);
+		if (ret) {
+			goto end;
+		}
+	}
+
+	if (!ctf_align_pos(pos, layout->alignment)) {
+		ret = -1;
+		goto end;
+	}
+
+	if (!pos->dummy) {
+		ret = layout_write_field(field, &op,
+			mmap_align_addr(pos->base_mma) + pos->mmap_base_offset,
+			pos->offset);
+		if (ret) {
+			goto end;
+		}
+	}
+
+	if (!ctf_move_pos(pos, layout->size)) {
+		ret = -1;
+	}
+end:
+	return ret;
+}
+
 static
 int bt_ctf_field_structure_serialize(struct bt_ctf_field *field,
 		struct ctf_stream_pos *pos)
@@ -1822,6 +2351,16 @@ int bt_ctf_field_structure_serialize(struct bt_ctf_field *field,
 	struct bt_ctf_field_structure *structure = container_of(
 		field, struct bt_ctf_field_structure, parent);
 
+	if (field->type->frozen) {
+		struct bt_ctf_field_type_layout *layout =
+			get_type_layout(field->type);
+
+		if (layout->flat) {
+			ret = layout_serialize(field, layout, pos);
+			goto end;
+		}
+	}
+
 	while (!ctf_pos_access_ok(pos,
 		offset_align(pos->offset,
 			field->type->declaration->alignment))) {
@@ -2016,6 +2555,21 @@ int bt_ctf_field_structure_copy(struct bt_ctf_field *src,
 
 		g_ptr_array_index(struct_dst->fields, i) = field_copy;
 	}
+
+	/* The copy tracks its own members. */
+	struct_dst->unset_count = 0;
+	for (i = 0; i < struct_dst->fields->len; i++) {
+		struct bt_ctf_field *field_copy =
+			g_ptr_array_index(struct_dst->fields, i);
+
+		if (struct_dst->tracked && field_copy) {
+			field_set_owner(field_copy, dst);
+		}
+
+		if (!field_is_set(field_copy)) {
+			struct_dst->unset_count++;
+		}
+	}
 end:
 	return ret;
 }
@@ -2161,26 +2715,18 @@ end:
 static
 int increase_packet_size(struct ctf_stream_pos *pos)
 {
-	int ret;
+	uint64_t packet_size;
 
 	assert(pos);
-	ret = munmap_align(pos->base_mma);
-	if (ret) {
-		goto end;
-	}
-
-	pos->packet_size += PACKET_LEN_INCREMENT;
-	ret = posix_fallocate(pos->fd, pos->mmap_offset,
-		pos->packet_size / CHAR_BIT);
-	if (ret) {
-		goto end;
-	}
 
-	pos->base_mma = mmap_align(pos->packet_size / CHAR_BIT, pos->prot,
-		pos->flags, pos->fd, pos->mmap_offset);
-	if (pos->base_mma == MAP_FAILED) {
-		ret = -1;
+	/*
+	 * Grow geometrically so that large packets only need a few
+	 * remapping cycles.
+	 */
+	if (pos->packet_size < PACKET_LEN_INCREMENT) {
+		packet_size = pos->packet_size + PACKET_LEN_INCREMENT;
+	} else {
+		packet_size = pos->packet_size << 1;
 	}
-end:
-	return ret;
+	return ctf_pos_map_packet(pos, packet_size);
 }
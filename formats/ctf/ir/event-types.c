@@ -358,6 +358,7 @@ void bt_ctf_field_type_destroy(struct bt_object *obj)
 		return;
 	}
 
+	g_free(type->layout);
 	type_destroy_funcs[type_id](type);
 }
 
@@ -45,6 +45,11 @@ void bt_ctf_event_class_destroy(struct bt_object *obj);
 static
 void bt_ctf_event_destroy(struct bt_object *obj);
 static
+void event_free(struct bt_ctf_event *event);
+static
+struct bt_ctf_event *event_class_pool_get(
+		struct bt_ctf_event_class *event_class);
+static
 int set_integer_field_value(struct bt_ctf_field *field, uint64_t value);
 
 struct bt_ctf_event_class *bt_ctf_event_class_create(const char *name)
@@ -63,6 +68,8 @@ struct bt_ctf_event_class *bt_ctf_event_class_create(const char *name)
 	}
 
 	bt_object_init(event_class, bt_ctf_event_class_destroy);
+	event_class->event_pool = g_ptr_array_new();
+	pthread_mutex_init(&event_class->pool_lock, NULL);
 	event_class->fields = bt_ctf_field_type_structure_create();
 	if (!event_class->fields) {
 		goto error;
@@ -552,6 +559,11 @@ struct bt_ctf_event *bt_ctf_event_create(struct bt_ctf_event_class *event_class)
 		goto end;
 	}
 	assert(event_class->stream_class->event_header_type);
+	event = event_class_pool_get(event_class);
+	if (event) {
+		goto end;
+	}
+
 	event = g_new0(struct bt_ctf_event, 1);
 	if (!event) {
 		goto end;
@@ -874,23 +886,117 @@ void bt_ctf_event_class_destroy(struct bt_object *obj)
 	 * bt_ctf_event_class_set_stream_class for explanation.
 	 */
 	event_class = container_of(obj, struct bt_ctf_event_class, base);
+	if (event_class->event_pool) {
+		int i;
+
+		for (i = 0; i < event_class->event_pool->len; i++) {
+			struct bt_ctf_event *event = g_ptr_array_index(
+				event_class->event_pool, i);
+
+			event_free(event);
+		}
+		g_ptr_array_free(event_class->event_pool, TRUE);
+	}
+	pthread_mutex_destroy(&event_class->pool_lock);
 	bt_ctf_attributes_destroy(event_class->attributes);
 	bt_put(event_class->context);
 	bt_put(event_class->fields);
+	if (event_class->metadata) {
+		g_string_free(event_class->metadata, TRUE);
+	}
 	g_free(event_class);
 }
 
+static
+void event_free(struct bt_ctf_event *event)
+{
+	bt_put(event->event_header);
+	bt_put(event->context_payload);
+	bt_put(event->fields_payload);
+	g_free(event);
+}
+
+/*
+ * Take an event from its class' pool. The event's fields were reset
+ * when it was recycled.
+ */
+static
+struct bt_ctf_event *event_class_pool_get(
+		struct bt_ctf_event_class *event_class)
+{
+	struct bt_ctf_event *event = NULL;
+	GPtrArray *pool = event_class->event_pool;
+
+	pthread_mutex_lock(&event_class->pool_lock);
+	if (pool->len) {
+		event = g_ptr_array_index(pool, pool->len - 1);
+		g_ptr_array_set_size(pool, pool->len - 1);
+	}
+	pthread_mutex_unlock(&event_class->pool_lock);
+
+	if (event) {
+		bt_object_init(event, bt_ctf_event_destroy);
+		bt_get(event_class);
+	}
+	return event;
+}
+
+/*
+ * Reset a released event and add it to its class' pool. Returns 0 if
+ * the event must be freed instead.
+ */
+static
+int event_class_pool_put(struct bt_ctf_event *event)
+{
+	int pooled = 0;
+	struct bt_ctf_event_class *event_class = event->event_class;
+
+	if (bt_ctf_field_reset(event->event_header) ||
+		(event->context_payload &&
+			bt_ctf_field_reset(event->context_payload)) ||
+		bt_ctf_field_reset(event->fields_payload)) {
+		goto end;
+	}
+
+	event->stream = NULL;
+	event->recycle = 0;
+	pthread_mutex_lock(&event_class->pool_lock);
+	if (event_class->event_pool->len < BT_CTF_EVENT_CLASS_POOL_MAX_LEN) {
+		g_ptr_array_add(event_class->event_pool, event);
+		pooled = 1;
+	}
+	pthread_mutex_unlock(&event_class->pool_lock);
+
+	if (pooled) {
+		/* May destroy the class, and the pool along with it. */
+		bt_put(event_class);
+	}
+end:
+	return pooled;
+}
+
 static
 void bt_ctf_event_destroy(struct bt_object *obj)
 {
 	struct bt_ctf_event *event;
 
 	event = container_of(obj, struct bt_ctf_event, base);
+	if (event->recycle && event_class_pool_put(event)) {
+		return;
+	}
+
 	bt_put(event->event_class);
-	bt_put(event->event_header);
-	bt_put(event->context_payload);
-	bt_put(event->fields_payload);
-	g_free(event);
+	event_free(event);
+}
+
+void bt_ctf_event_recycle(struct bt_ctf_event *event)
+{
+	if (!event) {
+		return;
+	}
+
+	event->recycle = 1;
+	bt_put(event);
 }
 
 static
@@ -939,8 +1045,20 @@ end:
 BT_HIDDEN
 void bt_ctf_event_class_freeze(struct bt_ctf_event_class *event_class)
 {
+	int expected = 0;
+
 	assert(event_class);
-	event_class->frozen = 1;
+	/*
+	 * Events are created concurrently from frozen classes: only the
+	 * first caller freezes the class, the others only read it.
+	 */
+	if (__atomic_load_n(&event_class->frozen, __ATOMIC_ACQUIRE) ||
+			!__atomic_compare_exchange_n(&event_class->frozen,
+			&expected, 1, FALSE, __ATOMIC_ACQ_REL,
+			__ATOMIC_ACQUIRE)) {
+		return;
+	}
+
 	bt_ctf_field_type_freeze(event_class->context);
 	bt_ctf_field_type_freeze(event_class->fields);
 	bt_ctf_attributes_freeze(event_class->attributes);
@@ -964,6 +1082,11 @@ int bt_ctf_event_class_set_stream_class(struct bt_ctf_event_class *event_class,
 	}
 
 	event_class->stream_class = stream_class;
+	/* The cached declaration refers to the previous stream class. */
+	if (event_class->metadata) {
+		g_string_free(event_class->metadata, TRUE);
+		event_class->metadata = NULL;
+	}
 	/*
 	 * We don't get() the stream_class since doing so would introduce
 	 * a circular ownership between event classes and stream classes.
@@ -983,11 +1106,20 @@ int bt_ctf_event_class_serialize(struct bt_ctf_event_class *event_class,
 	int i;
 	int count;
 	int ret = 0;
+	size_t start;
 	struct bt_value *attr_value = NULL;
 
 	assert(event_class);
 	assert(context);
 
+	if (event_class->metadata) {
+		g_string_append_len(context->string,
+			event_class->metadata->str,
+			event_class->metadata->len);
+		goto end;
+	}
+
+	start = context->string->len;
 	context->current_indentation_level = 1;
 	g_string_assign(context->field_name, "");
 	g_string_append(context->string, "event {\n");
@@ -1071,6 +1203,14 @@ int bt_ctf_event_class_serialize(struct bt_ctf_event_class *event_class,
 	}
 
 	g_string_append(context->string, "};\n\n");
+
+	/* Types are frozen and resolved once in a trace. */
+	if (event_class->frozen && event_class->stream_class &&
+		event_class->stream_class->trace) {
+		event_class->metadata = g_string_new_len(
+			context->string->str + start,
+			context->string->len - start);
+	}
 end:
 	context->current_indentation_level = 0;
 	BT_PUT(attr_value);
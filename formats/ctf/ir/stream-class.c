@@ -62,6 +62,8 @@ struct bt_ctf_stream_class *bt_ctf_stream_class_create(const char *name)
 		goto error;
 	}
 
+	pthread_mutex_init(&stream_class->lock, NULL);
+
 	stream_class->name = g_string_new(name);
 	stream_class->event_classes = g_ptr_array_new_with_free_func(
 		(GDestroyNotify) bt_put);
@@ -69,6 +71,15 @@ struct bt_ctf_stream_class *bt_ctf_stream_class_create(const char *name)
 		goto error;
 	}
 
+	stream_class->event_classes_by_name = g_hash_table_new(g_str_hash,
+		g_str_equal);
+	stream_class->event_classes_by_id = g_hash_table_new(g_direct_hash,
+		g_direct_equal);
+	if (!stream_class->event_classes_by_name ||
+			!stream_class->event_classes_by_id) {
+		goto error;
+	}
+
 	ret = init_event_header(stream_class);
 	if (ret) {
 		goto error;
@@ -245,8 +256,10 @@ int bt_ctf_stream_class_set_id_no_check(
 	 * Make sure all event classes have their "stream_id" attribute
 	 * set to this value.
 	 */
+	pthread_mutex_lock(&stream_class->lock);
 	g_ptr_array_foreach(stream_class->event_classes,
 		event_class_set_stream_id, &data);
+	pthread_mutex_unlock(&stream_class->lock);
 	ret = data.ret;
 	if (ret) {
 		goto end;
@@ -275,50 +288,6 @@ end:
 	return ret;
 }
 
-static
-void event_class_exists(gpointer element, gpointer query)
-{
-	struct bt_ctf_event_class *event_class_a = element;
-	struct search_query *search_query = query;
-	struct bt_ctf_event_class *event_class_b = search_query->value;
-	int64_t id_a, id_b;
-
-	if (search_query->value == element) {
-		search_query->found = 1;
-		goto end;
-	}
-
-	/*
-	 * Two event classes cannot share the same name in a given
-	 * stream class.
-	 */
-	if (!strcmp(bt_ctf_event_class_get_name(event_class_a),
-			bt_ctf_event_class_get_name(event_class_b))) {
-		search_query->found = 1;
-		goto end;
-	}
-
-	/*
-	 * Two event classes cannot share the same ID in a given
-	 * stream class.
-	 */
-	id_a = bt_ctf_event_class_get_id(event_class_a);
-	id_b = bt_ctf_event_class_get_id(event_class_b);
-
-	if (id_a < 0 || id_b < 0) {
-		/* at least one ID is not set: will be automatically set later */
-		goto end;
-	}
-
-	if (id_a == id_b) {
-		search_query->found = 1;
-		goto end;
-	}
-
-end:
-	return;
-}
-
 int bt_ctf_stream_class_add_event_class(
 		struct bt_ctf_stream_class *stream_class,
 		struct bt_ctf_event_class *event_class)
@@ -326,18 +295,24 @@ int bt_ctf_stream_class_add_event_class(
 	int ret = 0;
 	int64_t event_id;
 
-	if (!stream_class || !event_class) {
+	if (!stream_class || !event_class || event_class->stream_class) {
 		ret = -1;
 		goto end;
 	}
 
-	/* Check for duplicate event classes */
-	struct search_query query = { .value = event_class, .found = 0 };
-	g_ptr_array_foreach(stream_class->event_classes, event_class_exists,
-		&query);
-	if (query.found) {
+	pthread_mutex_lock(&stream_class->lock);
+	/*
+	 * Two event classes cannot share the same name or ID in a given
+	 * stream class. An ID which is not set yet is set below.
+	 */
+	event_id = bt_ctf_event_class_get_id(event_class);
+	if (g_hash_table_lookup(stream_class->event_classes_by_name,
+			bt_ctf_event_class_get_name(event_class)) ||
+			(event_id >= 0 && g_hash_table_lookup(
+			stream_class->event_classes_by_id,
+			GUINT_TO_POINTER((uint32_t) event_id)))) {
 		ret = -1;
-		goto end;
+		goto end_unlock;
 	}
 
 	/*
@@ -350,34 +325,24 @@ int bt_ctf_stream_class_add_event_class(
 		ret = bt_ctf_event_class_resolve_types(event_class,
 			stream_class->trace, stream_class);
 		if (ret) {
-			goto end;
+			goto end_unlock;
 		}
 	}
 
 	/* Only set an event id if none was explicitly set before */
-	event_id = bt_ctf_event_class_get_id(event_class);
 	if (event_id < 0) {
-		if (bt_ctf_event_class_set_id(event_class,
-			stream_class->next_event_id++)) {
+		event_id = stream_class->next_event_id++;
+		if (bt_ctf_event_class_set_id(event_class, event_id)) {
 			ret = -1;
-			goto end;
+			goto end_unlock;
 		}
 	}
 
-	ret = bt_ctf_event_class_set_stream_class(event_class, stream_class);
-	if (ret) {
-		goto end;
-	}
-
 	ret = bt_ctf_event_class_set_stream_id(event_class, stream_class->id);
 	if (ret) {
-		goto end;
+		goto end_unlock;
 	}
 
-	bt_get(event_class);
-	g_ptr_array_add(stream_class->event_classes, event_class);
-	bt_ctf_event_class_freeze(event_class);
-
 	if (stream_class->byte_order) {
 		/*
 		 * Only set native byte order if it has been initialized
@@ -389,6 +354,26 @@ int bt_ctf_stream_class_add_event_class(
 		bt_ctf_event_class_set_native_byte_order(event_class,
 			stream_class->byte_order);
 	}
+
+	/*
+	 * Events may be created from the event class as soon as it has
+	 * a stream class: freeze it first.
+	 */
+	bt_ctf_event_class_freeze(event_class);
+	ret = bt_ctf_event_class_set_stream_class(event_class, stream_class);
+	if (ret) {
+		goto end_unlock;
+	}
+
+	bt_get(event_class);
+	g_ptr_array_add(stream_class->event_classes, event_class);
+	g_hash_table_insert(stream_class->event_classes_by_name,
+		(gpointer) bt_ctf_event_class_get_name(event_class),
+		event_class);
+	g_hash_table_insert(stream_class->event_classes_by_id,
+		GUINT_TO_POINTER((uint32_t) event_id), event_class);
+end_unlock:
+	pthread_mutex_unlock(&stream_class->lock);
 end:
 	return ret;
 }
@@ -403,7 +388,9 @@ int bt_ctf_stream_class_get_event_class_count(
 		goto end;
 	}
 
+	pthread_mutex_lock(&stream_class->lock);
 	ret = (int) stream_class->event_classes->len;
+	pthread_mutex_unlock(&stream_class->lock);
 end:
 	return ret;
 }
@@ -413,13 +400,17 @@ struct bt_ctf_event_class *bt_ctf_stream_class_get_event_class(
 {
 	struct bt_ctf_event_class *event_class = NULL;
 
-	if (!stream_class || index < 0 ||
-		index >= stream_class->event_classes->len) {
+	if (!stream_class || index < 0) {
 		goto end;
 	}
 
-	event_class = g_ptr_array_index(stream_class->event_classes, index);
-	bt_get(event_class);
+	pthread_mutex_lock(&stream_class->lock);
+	if (index < stream_class->event_classes->len) {
+		event_class = g_ptr_array_index(stream_class->event_classes,
+			index);
+		bt_get(event_class);
+	}
+	pthread_mutex_unlock(&stream_class->lock);
 end:
 	return event_class;
 }
@@ -427,25 +418,17 @@ end:
 struct bt_ctf_event_class *bt_ctf_stream_class_get_event_class_by_name(
 		struct bt_ctf_stream_class *stream_class, const char *name)
 {
-	size_t i;
 	struct bt_ctf_event_class *event_class = NULL;
 
 	if (!stream_class || !name) {
 		goto end;
 	}
 
-	for (i = 0; i < stream_class->event_classes->len; i++) {
-		struct bt_ctf_event_class *cur_event_class =
-			g_ptr_array_index(stream_class->event_classes, i);
-		const char *cur_event_class_name =
-			bt_ctf_event_class_get_name(cur_event_class);
-
-		if (!strcmp(name, cur_event_class_name)) {
-			event_class = cur_event_class;
-			bt_get(event_class);
-			goto end;
-		}
-	}
+	pthread_mutex_lock(&stream_class->lock);
+	event_class = g_hash_table_lookup(stream_class->event_classes_by_name,
+		name);
+	bt_get(event_class);
+	pthread_mutex_unlock(&stream_class->lock);
 end:
 	return event_class;
 }
@@ -453,23 +436,17 @@ end:
 struct bt_ctf_event_class *bt_ctf_stream_class_get_event_class_by_id(
 		struct bt_ctf_stream_class *stream_class, uint32_t id)
 {
-	size_t i;
 	struct bt_ctf_event_class *event_class = NULL;
 
 	if (!stream_class) {
 		goto end;
 	}
 
-	for (i = 0; i < stream_class->event_classes->len; i++) {
-		struct bt_ctf_event_class *current_event_class =
-			g_ptr_array_index(stream_class->event_classes, i);
-
-		if (bt_ctf_event_class_get_id(current_event_class) == id) {
-			event_class = current_event_class;
-			bt_get(event_class);
-			goto end;
-		}
-	}
+	pthread_mutex_lock(&stream_class->lock);
+	event_class = g_hash_table_lookup(stream_class->event_classes_by_id,
+		GUINT_TO_POINTER(id));
+	bt_get(event_class);
+	pthread_mutex_unlock(&stream_class->lock);
 end:
 	return event_class;
 }
@@ -618,11 +595,18 @@ void bt_ctf_stream_class_put(struct bt_ctf_stream_class *stream_class)
 BT_HIDDEN
 void bt_ctf_stream_class_freeze(struct bt_ctf_stream_class *stream_class)
 {
-	if (!stream_class) {
+	int expected = 0;
+
+	/* Same as bt_ctf_event_class_freeze(). */
+	if (!stream_class ||
+			__atomic_load_n(&stream_class->frozen,
+			__ATOMIC_ACQUIRE) ||
+			!__atomic_compare_exchange_n(&stream_class->frozen,
+			&expected, 1, FALSE, __ATOMIC_ACQ_REL,
+			__ATOMIC_ACQUIRE)) {
 		return;
 	}
 
-	stream_class->frozen = 1;
 	bt_ctf_field_type_freeze(stream_class->event_header_type);
 	bt_ctf_field_type_freeze(stream_class->packet_context_type);
 	bt_ctf_field_type_freeze(stream_class->event_context_type);
@@ -667,6 +651,7 @@ int bt_ctf_stream_class_set_byte_order(struct bt_ctf_stream_class *stream_class,
 		stream_class->event_context_type, stream_class->byte_order);
 
 	/* Set all events' native byte order */
+	pthread_mutex_lock(&stream_class->lock);
 	for (i = 0; i < stream_class->event_classes->len; i++) {
 		bt_ctf_event_class_set_native_byte_order(
 			g_ptr_array_index(stream_class->event_classes, i),
@@ -674,6 +659,7 @@ int bt_ctf_stream_class_set_byte_order(struct bt_ctf_stream_class *stream_class,
 		bt_ctf_event_class_freeze(
 			g_ptr_array_index(stream_class->event_classes, i));
 	}
+	pthread_mutex_unlock(&stream_class->lock);
 end:
 	return ret;
 }
@@ -683,7 +669,7 @@ int bt_ctf_stream_class_serialize(struct bt_ctf_stream_class *stream_class,
 		struct metadata_context *context)
 {
 	int64_t ret = 0;
-	size_t i;
+	size_t i, start;
 
 	g_string_assign(context->field_name, "");
 	context->current_indentation_level = 1;
@@ -692,6 +678,14 @@ int bt_ctf_stream_class_serialize(struct bt_ctf_stream_class *stream_class,
 		goto end;
 	}
 
+	if (stream_class->metadata) {
+		g_string_append_len(context->string,
+			stream_class->metadata->str,
+			stream_class->metadata->len);
+		goto serialize_event_classes;
+	}
+
+	start = context->string->len;
 	g_string_append_printf(context->string,
 		"stream {\n\tid = %" PRIu32 ";\n\tevent.header := ",
 		stream_class->id);
@@ -718,15 +712,26 @@ int bt_ctf_stream_class_serialize(struct bt_ctf_stream_class *stream_class,
 	}
 
 	g_string_append(context->string, ";\n};\n\n");
+
+	/* Types are frozen and resolved once in a trace. */
+	if (stream_class->frozen && stream_class->trace) {
+		stream_class->metadata = g_string_new_len(
+			context->string->str + start,
+			context->string->len - start);
+	}
+
+serialize_event_classes:
+	pthread_mutex_lock(&stream_class->lock);
 	for (i = 0; i < stream_class->event_classes->len; i++) {
 		struct bt_ctf_event_class *event_class =
 			stream_class->event_classes->pdata[i];
 
 		ret = bt_ctf_event_class_serialize(event_class, context);
 		if (ret) {
-			goto end;
+			break;
 		}
 	}
+	pthread_mutex_unlock(&stream_class->lock);
 end:
 	context->current_indentation_level = 0;
 	return ret;
@@ -777,13 +782,26 @@ void bt_ctf_stream_class_destroy(struct bt_object *obj)
 		g_ptr_array_free(stream_class->event_classes, TRUE);
 	}
 
+	if (stream_class->event_classes_by_name) {
+		g_hash_table_destroy(stream_class->event_classes_by_name);
+	}
+
+	if (stream_class->event_classes_by_id) {
+		g_hash_table_destroy(stream_class->event_classes_by_id);
+	}
+
 	if (stream_class->name) {
 		g_string_free(stream_class->name, TRUE);
 	}
 
+	if (stream_class->metadata) {
+		g_string_free(stream_class->metadata, TRUE);
+	}
+
 	bt_put(stream_class->event_header_type);
 	bt_put(stream_class->packet_context_type);
 	bt_put(stream_class->event_context_type);
+	pthread_mutex_destroy(&stream_class->lock);
 	g_free(stream_class);
 }
 
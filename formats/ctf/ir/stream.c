@@ -40,11 +40,45 @@
 #include <babeltrace/compiler.h>
 #include <babeltrace/align.h>
 #include <babeltrace/ctf/ctf-index.h>
+#include <babeltrace/endian.h>
+#include <babeltrace/mmap-align.h>
+#include <pthread.h>
+#include <float.h>
 
 static
 void bt_ctf_stream_destroy(struct bt_object *obj);
 static
 int set_structure_field_integer(struct bt_ctf_field *, char *, uint64_t);
+static
+int get_structure_field_integer(struct bt_ctf_field *, char *, uint64_t *);
+static
+int get_event_header_timestamp(struct bt_ctf_field *, uint64_t *);
+static
+int stream_close_packet(struct bt_ctf_stream *);
+
+/*
+ * Completed packets waiting to be written by a stream's flush thread.
+ * The lock protects every field but the thread handle.
+ */
+struct bt_ctf_stream_flush_queue {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;	/* signaled when a packet is queued */
+	pthread_cond_t done_cond;	/* signaled when a packet is written */
+	/* Queue of struct ctf_stream_pos, one per packet */
+	GQueue *packets;
+	/*
+	 * Queue of struct mmap_align, packet buffers written by the
+	 * thread and waiting to be reused by the producer. With at most
+	 * max_pending packets in flight and one being built, no more than
+	 * max_pending + 1 buffers are ever allocated.
+	 */
+	GQueue *free_buffers;
+	unsigned int max_pending;
+	unsigned int pending;		/* queued or being written */
+	int error;			/* first write error, sticky */
+	int quit;
+};
 
 static
 int set_packet_header_magic(struct bt_ctf_stream *stream)
@@ -288,6 +322,7 @@ struct bt_ctf_stream *bt_ctf_stream_create(
 	}
 
 	stream->pos.fd = -1;
+	stream->index_fd = -1;
 	stream->id = stream_class->next_stream_id++;
 	stream->stream_class = stream_class;
 	bt_get(stream_class);
@@ -345,6 +380,31 @@ end:
 	return ret;
 }
 
+BT_HIDDEN
+int bt_ctf_stream_set_index_fd(struct bt_ctf_stream *stream, int fd)
+{
+	int ret = 0;
+	struct ctf_packet_index_file_hdr header;
+
+	if (stream->index_fd != -1) {
+		ret = -1;
+		goto end;
+	}
+
+	header.magic = htobe32(CTF_INDEX_MAGIC);
+	header.index_major = htobe32(CTF_INDEX_MAJOR);
+	header.index_minor = htobe32(CTF_INDEX_MINOR);
+	header.packet_index_len = htobe32(sizeof(struct ctf_packet_index));
+	if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+		perror("write");
+		ret = -1;
+		goto end;
+	}
+	stream->index_fd = fd;
+end:
+	return ret;
+}
+
 struct bt_ctf_stream_class *bt_ctf_stream_get_class(
 		struct bt_ctf_stream *stream)
 {
@@ -479,253 +539,338 @@ end:
 	bt_put(events_discarded_field_type);
 }
 
-int bt_ctf_stream_append_event(struct bt_ctf_stream *stream,
-		struct bt_ctf_event *event)
+int bt_ctf_stream_set_packet_size(struct bt_ctf_stream *stream,
+		uint64_t packet_size)
 {
 	int ret = 0;
-	struct bt_ctf_field *event_context_copy = NULL;
 
-	if (!stream || !event) {
+	if (!stream) {
 		ret = -1;
 		goto end;
 	}
 
-	ret = bt_ctf_event_set_stream(event, stream);
-	if (ret) {
-		/* Event was already associated to a stream */
-		ret = -1;
-		goto end;
-	}
+	stream->packet_size_target = ALIGN(packet_size, PAGE_SIZE) * CHAR_BIT;
+end:
+	return ret;
+}
 
-	ret = bt_ctf_event_populate_event_header(event);
-	if (ret) {
-		goto end;
-	}
+/*
+ * Size of the next packet to map, in bits, given the size of its
+ * content if known. 0 selects the default packet size.
+ */
+static
+uint64_t get_next_packet_size(struct bt_ctf_stream *stream,
+		uint64_t content_size)
+{
+	uint64_t packet_size = stream->packet_size_target;
 
-	/* Make sure the event's payload is set */
-	ret = bt_ctf_event_validate(event);
-	if (ret) {
-		goto end;
+	if (!packet_size && stream->streaming_packet_size) {
+		/* Fit the packets cut in streaming mode. */
+		packet_size = ALIGN(stream->streaming_packet_size,
+			PAGE_SIZE * CHAR_BIT);
 	}
+	content_size = ALIGN(content_size, PAGE_SIZE * CHAR_BIT);
+	return packet_size > content_size ? packet_size : content_size;
+}
 
-	/* Sample the current stream event context by copying it */
-	if (stream->event_context) {
-		/* Make sure the event context's payload is set */
-		ret = bt_ctf_field_validate(stream->event_context);
+/*
+ * Compute the exact content size of the current packet once the pending
+ * events are written after its header and context, by serializing them
+ * in a dummy position, which does not write anything. This avoids
+ * enlarging and remapping the packet event by event during the flush.
+ */
+static
+int get_pending_content_size(struct bt_ctf_stream *stream,
+		uint64_t *content_size)
+{
+	int ret = 0;
+	size_t i;
+	struct ctf_stream_pos dummy;
+
+	ctf_dummy_pos(&stream->pos, &dummy);
+	dummy.packet_size = INT64_MAX;
+	for (i = 0; i < stream->events->len; i++) {
+		struct bt_ctf_event *event = g_ptr_array_index(
+			stream->events, i);
+
+		ret = bt_ctf_field_serialize(event->event_header, &dummy);
 		if (ret) {
 			goto end;
 		}
 
-		event_context_copy = bt_ctf_field_copy(stream->event_context);
-		if (!event_context_copy) {
-			ret = -1;
-			goto end;
+		if (stream->event_contexts) {
+			ret = bt_ctf_field_serialize(
+				g_ptr_array_index(stream->event_contexts, i),
+				&dummy);
+			if (ret) {
+				goto end;
+			}
 		}
-	}
 
-	bt_get(event);
-	/* Save the new event along with its associated stream event context */
-	g_ptr_array_add(stream->events, event);
-	if (event_context_copy) {
-		g_ptr_array_add(stream->event_contexts, event_context_copy);
+		ret = bt_ctf_event_serialize(event, &dummy);
+		if (ret) {
+			goto end;
+		}
 	}
+	*content_size = dummy.offset;
 end:
-	if (ret) {
-		(void) bt_ctf_event_set_stream(event, NULL);
-	}
 	return ret;
 }
 
-struct bt_ctf_field *bt_ctf_stream_get_packet_context(
-		struct bt_ctf_stream *stream)
+int bt_ctf_stream_enable_streaming(struct bt_ctf_stream *stream,
+		uint64_t packet_size)
 {
-	struct bt_ctf_field *packet_context = NULL;
+	int ret = 0;
 
-	if (!stream) {
+	if (!stream || stream->pos.fd < 0 || stream->events->len) {
+		ret = -1;
 		goto end;
 	}
 
-	packet_context = stream->packet_context;
-	if (packet_context) {
-		bt_get(packet_context);
-	}
+	stream->streaming = 1;
+	stream->streaming_packet_size = packet_size * CHAR_BIT;
 end:
-	return packet_context;
+	return ret;
 }
 
-int bt_ctf_stream_set_packet_context(struct bt_ctf_stream *stream,
-		struct bt_ctf_field *field)
+static
+void *flush_thread_func(void *data)
 {
-	int ret = 0;
-	struct bt_ctf_field_type *field_type;
+	struct bt_ctf_stream_flush_queue *queue = data;
 
-	if (!stream || !field) {
-		ret = -1;
-		goto end;
-	}
+	pthread_mutex_lock(&queue->lock);
+	for (;;) {
+		struct ctf_stream_pos *packet;
+		int ret;
 
-	field_type = bt_ctf_field_get_type(field);
-	if (field_type != stream->stream_class->packet_context_type) {
-		ret = -1;
-		goto end;
-	}
+		while (g_queue_is_empty(queue->packets) && !queue->quit) {
+			pthread_cond_wait(&queue->work_cond, &queue->lock);
+		}
+		packet = g_queue_pop_head(queue->packets);
+		if (!packet) {
+			break;
+		}
 
-	bt_put(field_type);
-	bt_get(field);
-	bt_put(stream->packet_context);
-	stream->packet_context = field;
-end:
-	return ret;
+		pthread_mutex_unlock(&queue->lock);
+		ret = ctf_pos_write_packet(packet);
+		pthread_mutex_lock(&queue->lock);
+
+		/* Hand the buffer back to the producer. */
+		g_queue_push_tail(queue->free_buffers, packet->base_mma);
+		g_free(packet);
+		if (ret && !queue->error) {
+			queue->error = ret;
+		}
+		queue->pending--;
+		pthread_cond_broadcast(&queue->done_cond);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return NULL;
 }
 
-struct bt_ctf_field *bt_ctf_stream_get_event_context(
-		struct bt_ctf_stream *stream)
+/*
+ * Append the index entry of the current packet, whose context is
+ * complete, to the stream's packet index.
+ */
+static
+int stream_write_packet_index(struct bt_ctf_stream *stream)
 {
-	struct bt_ctf_field *event_context = NULL;
+	int ret = 0;
+	uint64_t value;
+	struct ctf_packet_index index;
 
-	if (!stream) {
+	if (stream->index_fd < 0) {
 		goto end;
 	}
 
-	event_context = stream->event_context;
-	if (event_context) {
-		bt_get(event_context);
+	memset(&index, 0, sizeof(index));
+	index.offset = htobe64(stream->pos.mmap_offset);
+	index.packet_size = htobe64(stream->pos.packet_size);
+	index.content_size = htobe64(stream->pos.offset);
+	if (!get_structure_field_integer(stream->packet_context,
+			"timestamp_begin", &value)) {
+		index.timestamp_begin = htobe64(value);
+	}
+	if (!get_structure_field_integer(stream->packet_context,
+			"timestamp_end", &value)) {
+		index.timestamp_end = htobe64(value);
+	}
+	if (!get_structure_field_integer(stream->packet_context,
+			"events_discarded", &value)) {
+		index.events_discarded = htobe64(value);
+	}
+	index.stream_id = htobe64(stream->stream_class->id);
+
+	if (write(stream->index_fd, &index, sizeof(index)) != sizeof(index)) {
+		perror("write");
+		ret = -1;
 	}
 end:
-	return event_context;
+	return ret;
 }
 
-int bt_ctf_stream_set_event_context(struct bt_ctf_stream *stream,
-		struct bt_ctf_field *field)
+/*
+ * Write the current packet once it is complete. With an asynchronous
+ * flush, the packet buffer is handed to the flush thread and the next
+ * packet is built in a buffer the thread is done with, if any. Blocks
+ * while the queue is full.
+ */
+static
+int stream_write_packet(struct bt_ctf_stream *stream)
 {
 	int ret = 0;
-	struct bt_ctf_field_type *field_type = NULL;
+	struct ctf_stream_pos *packet;
+	struct bt_ctf_stream_flush_queue *queue = stream->flush_queue;
 
-	if (!stream || !field) {
-		ret = -1;
+	ret = stream_write_packet_index(stream);
+	if (ret) {
 		goto end;
 	}
 
-	field_type = bt_ctf_field_get_type(field);
-	if (field_type != stream->stream_class->event_context_type) {
-		ret = -1;
+	if (!queue) {
+		ret = ctf_pos_write_packet(&stream->pos);
 		goto end;
 	}
 
-	bt_get(field);
-	bt_put(stream->event_context);
-	stream->event_context = field;
-end:
-	bt_put(field_type);
-	return ret;
-}
-
-struct bt_ctf_field *bt_ctf_stream_get_packet_header(
-		struct bt_ctf_stream *stream)
-{
-	struct bt_ctf_field *packet_header = NULL;
+	packet = g_new(struct ctf_stream_pos, 1);
+	*packet = stream->pos;
+	packet->spare_mma = NULL;
+	packet->packet_index = NULL;
+	packet->content_size_loc = NULL;
+	/* The flush thread now owns the packet buffer. */
+	stream->pos.base_mma = NULL;
 
-	if (!stream) {
+	pthread_mutex_lock(&queue->lock);
+	while (queue->pending >= queue->max_pending && !queue->error) {
+		pthread_cond_wait(&queue->done_cond, &queue->lock);
+	}
+	if (queue->error) {
+		ret = queue->error;
+		pthread_mutex_unlock(&queue->lock);
+		(void) ctf_fini_pos(packet);
+		g_free(packet);
 		goto end;
 	}
-
-	packet_header = stream->packet_header;
-	if (packet_header) {
-		bt_get(packet_header);
+	g_queue_push_tail(queue->packets, packet);
+	queue->pending++;
+	pthread_cond_signal(&queue->work_cond);
+	if (!stream->pos.spare_mma) {
+		stream->pos.spare_mma = g_queue_pop_head(queue->free_buffers);
 	}
+	pthread_mutex_unlock(&queue->lock);
 end:
-	return packet_header;
+	return ret;
 }
 
-int bt_ctf_stream_set_packet_header(struct bt_ctf_stream *stream,
-		struct bt_ctf_field *field)
+/*
+ * Write the queued packets and stop the flush thread.
+ */
+static
+int stream_stop_flush_thread(struct bt_ctf_stream *stream)
+{
+	int ret;
+	struct bt_ctf_stream_flush_queue *queue = stream->flush_queue;
+
+	pthread_mutex_lock(&queue->lock);
+	queue->quit = 1;
+	pthread_cond_signal(&queue->work_cond);
+	pthread_mutex_unlock(&queue->lock);
+	pthread_join(queue->thread, NULL);
+
+	ret = queue->error;
+	g_queue_free(queue->packets);
+	while (!g_queue_is_empty(queue->free_buffers)) {
+		struct mmap_align *mma = g_queue_pop_head(queue->free_buffers);
+
+		free(mma->page_aligned_addr);
+		free(mma);
+	}
+	g_queue_free(queue->free_buffers);
+	pthread_cond_destroy(&queue->done_cond);
+	pthread_cond_destroy(&queue->work_cond);
+	pthread_mutex_destroy(&queue->lock);
+	g_free(queue);
+	stream->flush_queue = NULL;
+	return ret;
+}
+
+int bt_ctf_stream_enable_async_flush(struct bt_ctf_stream *stream,
+		unsigned int max_pending)
 {
 	int ret = 0;
-	struct bt_ctf_field_type *field_type = NULL;
+	struct bt_ctf_stream_flush_queue *queue = NULL;
 
-	if (!stream || !field) {
+	/*
+	 * Packets are handed over as heap buffers; a stream which already
+	 * mapped a packet of its file can't switch to buffered I/O.
+	 */
+	if (!stream || stream->pos.fd < 0 || stream->flush_queue ||
+			!max_pending ||
+			(!stream->pos.buffered && stream->pos.base_mma)) {
 		ret = -1;
 		goto end;
 	}
 
-	field_type = bt_ctf_field_get_type(field);
-	if (field_type != stream->trace->packet_header_type) {
+	queue = g_new0(struct bt_ctf_stream_flush_queue, 1);
+	queue->packets = g_queue_new();
+	queue->free_buffers = g_queue_new();
+	queue->max_pending = max_pending;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->work_cond, NULL);
+	pthread_cond_init(&queue->done_cond, NULL);
+	if (pthread_create(&queue->thread, NULL, flush_thread_func, queue)) {
+		pthread_cond_destroy(&queue->done_cond);
+		pthread_cond_destroy(&queue->work_cond);
+		pthread_mutex_destroy(&queue->lock);
+		g_queue_free(queue->free_buffers);
+		g_queue_free(queue->packets);
+		g_free(queue);
 		ret = -1;
 		goto end;
 	}
 
-	bt_get(field);
-	bt_put(stream->packet_header);
-	stream->packet_header = field;
+	stream->pos.buffered = 1;
+	stream->flush_queue = queue;
 end:
-	bt_put(field_type);
 	return ret;
 }
 
-static
-int get_event_header_timestamp(struct bt_ctf_field *event_header, uint64_t *timestamp)
+int bt_ctf_stream_flush_wait(struct bt_ctf_stream *stream)
 {
 	int ret = 0;
-	struct bt_ctf_field *timestamp_field = NULL;
-	struct bt_ctf_field_type *timestamp_field_type = NULL;
+	struct bt_ctf_stream_flush_queue *queue;
 
-	timestamp_field = bt_ctf_field_structure_get_field(event_header,
-		"timestamp");
-	if (!timestamp_field) {
+	if (!stream) {
 		ret = -1;
 		goto end;
 	}
 
-	timestamp_field_type = bt_ctf_field_get_type(timestamp_field);
-	assert(timestamp_field_type);
-	if (bt_ctf_field_type_get_type_id(timestamp_field_type) !=
-		CTF_TYPE_INTEGER) {
-		ret = -1;
+	queue = stream->flush_queue;
+	if (!queue) {
 		goto end;
 	}
 
-	if (bt_ctf_field_type_integer_get_signed(timestamp_field_type)) {
-		int64_t val;
-
-		ret = bt_ctf_field_signed_integer_get_value(timestamp_field,
-			&val);
-		if (ret) {
-			goto end;
-		}
-		*timestamp = (uint64_t) val;
-	} else {
-		ret = bt_ctf_field_unsigned_integer_get_value(timestamp_field,
-			timestamp);
-		if (ret) {
-			goto end;
-		}
+	pthread_mutex_lock(&queue->lock);
+	while (queue->pending) {
+		pthread_cond_wait(&queue->done_cond, &queue->lock);
 	}
+	ret = queue->error;
+	pthread_mutex_unlock(&queue->lock);
 end:
-	bt_put(timestamp_field);
-	bt_put(timestamp_field_type);
 	return ret;
 }
 
-int bt_ctf_stream_flush(struct bt_ctf_stream *stream)
+/*
+ * Write the packet header and context of a new packet in streaming
+ * mode. The packet context fields which are only known once the packet
+ * is complete are overwritten by stream_close_packet().
+ */
+static
+int stream_open_packet(struct bt_ctf_stream *stream,
+		struct bt_ctf_event *event)
 {
-	int ret = 0;
-	size_t i;
-	uint64_t timestamp_begin, timestamp_end, events_discarded;
-	struct bt_ctf_field *integer = NULL;
-	struct ctf_stream_pos packet_context_pos;
-
-	if (!stream || stream->pos.fd < 0) {
-		/*
-		 * Stream does not have an associated fd. It is,
-		 * therefore, not a stream being used to write events.
-		 */
-		ret = -1;
-		goto end;
-	}
-
-	if (!stream->events->len) {
-		goto end;
-	}
+	int ret;
+	uint64_t events_discarded;
 
 	ret = bt_ctf_field_validate(stream->packet_header);
 	if (ret) {
@@ -733,35 +878,35 @@ int bt_ctf_stream_flush(struct bt_ctf_stream *stream)
 	}
 
 	/* mmap the next packet */
+	stream->pos.next_packet_size = get_next_packet_size(stream, 0);
 	ctf_packet_seek(&stream->pos.parent, 0, SEEK_CUR);
+	if (stream->pos.offset == EOF) {
+		ret = -1;
+		goto end;
+	}
 
 	ret = bt_ctf_field_serialize(stream->packet_header, &stream->pos);
 	if (ret) {
 		goto end;
 	}
 
-	/* Set the default context attributes if present and unset. */
-	if (!get_event_header_timestamp(
-		((struct bt_ctf_event *) g_ptr_array_index(
-		stream->events, 0))->event_header, &timestamp_begin)) {
+	stream->packet_has_timestamp = !get_event_header_timestamp(
+		event->event_header, &stream->packet_timestamp_begin);
+	if (stream->packet_has_timestamp) {
+		stream->packet_timestamp_end = stream->packet_timestamp_begin;
 		ret = set_structure_field_integer(stream->packet_context,
-			"timestamp_begin", timestamp_begin);
+			"timestamp_begin", stream->packet_timestamp_begin);
 		if (ret) {
 			goto end;
 		}
-	}
-
-	if (!get_event_header_timestamp(
-		((struct bt_ctf_event *) g_ptr_array_index(
-		stream->events, stream->events->len - 1))->event_header,
-		&timestamp_end)) {
 
 		ret = set_structure_field_integer(stream->packet_context,
-			"timestamp_end", timestamp_end);
+			"timestamp_end", stream->packet_timestamp_end);
 		if (ret) {
 			goto end;
 		}
 	}
+
 	ret = set_structure_field_integer(stream->packet_context,
 		"content_size", UINT64_MAX);
 	if (ret) {
@@ -774,11 +919,9 @@ int bt_ctf_stream_flush(struct bt_ctf_stream *stream)
 		goto end;
 	}
 
-	/* Write packet context */
-	memcpy(&packet_context_pos, &stream->pos,
+	memcpy(&stream->packet_context_pos, &stream->pos,
 	       sizeof(struct ctf_stream_pos));
-	ret = bt_ctf_field_serialize(stream->packet_context,
-		&stream->pos);
+	ret = bt_ctf_field_serialize(stream->packet_context, &stream->pos);
 	if (ret) {
 		goto end;
 	}
@@ -789,20 +932,842 @@ int bt_ctf_stream_flush(struct bt_ctf_stream *stream)
 		goto end;
 	}
 
-	/* Unset the packet context's fields. */
+	/* Unset the fields set on close. */
 	ret = bt_ctf_field_reset(stream->packet_context);
 	if (ret) {
 		goto end;
 	}
 
-	/* Set the previous number of discarded events. */
 	ret = set_structure_field_integer(stream->packet_context,
 		"events_discarded", events_discarded);
 	if (ret) {
 		goto end;
 	}
-
-	for (i = 0; i < stream->events->len; i++) {
+	stream->packet_open = 1;
+end:
+	return ret;
+}
+
+/*
+ * Update the current packet's context with its final time range and
+ * sizes. Events appended afterwards go to a new packet.
+ */
+static
+int stream_close_packet(struct bt_ctf_stream *stream)
+{
+	int ret = 0;
+	uint64_t events_discarded;
+
+	if (!stream->packet_open) {
+		goto end;
+	}
+	stream->packet_open = 0;
+
+	if (stream->packet_has_timestamp) {
+		ret = set_structure_field_integer(stream->packet_context,
+			"timestamp_begin", stream->packet_timestamp_begin);
+		if (ret) {
+			goto end;
+		}
+
+		ret = set_structure_field_integer(stream->packet_context,
+			"timestamp_end", stream->packet_timestamp_end);
+		if (ret) {
+			goto end;
+		}
+	}
+
+	/*
+	 * Copy base_mma as the packet may have been remapped (e.g. when a
+	 * packet is resized).
+	 */
+	stream->packet_context_pos.base_mma = stream->pos.base_mma;
+	ret = set_structure_field_integer(stream->packet_context,
+		"content_size", stream->pos.offset);
+	if (ret) {
+		goto end;
+	}
+
+	ret = set_structure_field_integer(stream->packet_context,
+		"packet_size", stream->pos.packet_size);
+	if (ret) {
+		goto end;
+	}
+
+	ret = bt_ctf_field_serialize(stream->packet_context,
+		&stream->packet_context_pos);
+	if (ret) {
+		goto end;
+	}
+
+	ret = stream_write_packet(stream);
+	if (ret) {
+		goto end;
+	}
+
+	ret = bt_ctf_stream_get_discarded_events_count(stream,
+		&events_discarded);
+	if (ret) {
+		goto end;
+	}
+
+	/* Unset the packet context's fields for the next packet. */
+	ret = bt_ctf_field_reset(stream->packet_context);
+	if (ret) {
+		goto end;
+	}
+
+	ret = set_structure_field_integer(stream->packet_context,
+		"events_discarded", events_discarded);
+	if (ret) {
+		goto end;
+	}
+	stream->flushed_packet_count++;
+end:
+	return ret;
+}
+
+/*
+ * Serialize an event in the current packet in streaming mode, opening a
+ * packet if needed and closing it once it reaches the configured size.
+ */
+static
+int stream_serialize_event(struct bt_ctf_stream *stream,
+		struct bt_ctf_event *event)
+{
+	int ret = 0;
+	int64_t offset;
+	uint64_t timestamp, packet_size;
+
+	if (!stream->packet_open) {
+		ret = stream_open_packet(stream, event);
+		if (ret) {
+			goto end;
+		}
+	}
+
+	if (stream->packet_has_timestamp &&
+		!get_event_header_timestamp(event->event_header, &timestamp)) {
+		stream->packet_timestamp_end = timestamp;
+	}
+
+	offset = stream->pos.offset;
+	ret = bt_ctf_field_reset(event->event_header);
+	if (ret) {
+		goto error;
+	}
+
+	/* Write event header */
+	ret = bt_ctf_field_serialize(event->event_header, &stream->pos);
+	if (ret) {
+		goto error;
+	}
+
+	/* Write stream event context */
+	if (stream->event_context) {
+		ret = bt_ctf_field_serialize(stream->event_context,
+			&stream->pos);
+		if (ret) {
+			goto error;
+		}
+	}
+
+	/* Write event content */
+	ret = bt_ctf_event_serialize(event, &stream->pos);
+	if (ret) {
+		goto error;
+	}
+
+	/*
+	 * Outside of streaming mode, only bulk appends serialize events
+	 * directly; their packets are cut at the stream's packet size.
+	 */
+	packet_size = stream->streaming ? stream->streaming_packet_size :
+		stream->packet_size_target;
+	if (packet_size && stream->pos.offset >= packet_size) {
+		ret = stream_close_packet(stream);
+	}
+end:
+	return ret;
+error:
+	/* Drop the partially written event from the packet. */
+	stream->pos.offset = offset;
+	return ret;
+}
+
+/*
+ * Get a copy of the stream event context as it is now. The copy is
+ * shared with the previously appended events unless the context was
+ * modified since, which is only known for tracked structures.
+ */
+static
+struct bt_ctf_field *stream_sample_event_context(struct bt_ctf_stream *stream)
+{
+	struct bt_ctf_field_structure *event_context = container_of(
+		stream->event_context, struct bt_ctf_field_structure, parent);
+
+	if (stream->event_context_snapshot && event_context->tracked &&
+		event_context->generation ==
+			stream->event_context_generation) {
+		goto end;
+	}
+
+	BT_PUT(stream->event_context_snapshot);
+	stream->event_context_snapshot = bt_ctf_field_copy(
+		stream->event_context);
+	stream->event_context_generation = event_context->generation;
+end:
+	bt_get(stream->event_context_snapshot);
+	return stream->event_context_snapshot;
+}
+
+int bt_ctf_stream_append_event(struct bt_ctf_stream *stream,
+		struct bt_ctf_event *event)
+{
+	int ret = 0;
+	struct bt_ctf_field *event_context_copy = NULL;
+
+	if (!stream || !event) {
+		ret = -1;
+		goto end;
+	}
+
+	ret = bt_ctf_event_set_stream(event, stream);
+	if (ret) {
+		/* Event was already associated to a stream */
+		ret = -1;
+		goto end;
+	}
+
+	ret = bt_ctf_event_populate_event_header(event);
+	if (ret) {
+		goto end;
+	}
+
+	/* Make sure the event's payload is set */
+	ret = bt_ctf_event_validate(event);
+	if (ret) {
+		goto end;
+	}
+
+	if (stream->event_context) {
+		/* Make sure the event context's payload is set */
+		ret = bt_ctf_field_validate(stream->event_context);
+		if (ret) {
+			goto end;
+		}
+	}
+
+	if (stream->streaming) {
+		/* The event is not kept: it may be appended again. */
+		ret = stream_serialize_event(stream, event);
+		(void) bt_ctf_event_set_stream(event, NULL);
+		goto end;
+	}
+
+	/* Sample the current stream event context */
+	if (stream->event_context) {
+		event_context_copy = stream_sample_event_context(stream);
+		if (!event_context_copy) {
+			ret = -1;
+			goto end;
+		}
+	}
+
+	bt_get(event);
+	/* Save the new event along with its associated stream event context */
+	g_ptr_array_add(stream->events, event);
+	if (event_context_copy) {
+		g_ptr_array_add(stream->event_contexts, event_context_copy);
+	}
+end:
+	if (ret) {
+		(void) bt_ctf_event_set_stream(event, NULL);
+	}
+	return ret;
+}
+
+enum column_kind {
+	COLUMN_UNSIGNED,
+	COLUMN_SIGNED,
+	COLUMN_FLOAT,
+	COLUMN_DOUBLE,
+};
+
+/* A payload field filled from a column of values */
+struct stream_column {
+	struct bt_ctf_field *field;	/* integer or floating point field */
+	enum column_kind kind;
+	unsigned int width;		/* size of a value, in bytes */
+	unsigned int size;		/* size of an integer field, in bits */
+	const void *values;
+};
+
+/*
+ * Check that a payload field can be filled from a column and get the
+ * scalar field which receives its values.
+ */
+static
+int stream_column_init(struct stream_column *column,
+		struct bt_ctf_field *field, const void *values)
+{
+	int ret = 0;
+	struct bt_ctf_field_type *type = bt_ctf_field_get_type(field);
+
+	column->values = values;
+	switch (bt_ctf_field_type_get_type_id(type)) {
+	case CTF_TYPE_ENUM:
+		field = bt_ctf_field_enumeration_get_container(field);
+		if (!field) {
+			ret = -1;
+			goto end;
+		}
+		/* Keep the container alive along with its enumeration. */
+		bt_put(field);
+		bt_put(type);
+		type = bt_ctf_field_get_type(field);
+		/* Fall-through */
+	case CTF_TYPE_INTEGER:
+	{
+		int size = bt_ctf_field_type_integer_get_size(type);
+
+		column->kind = bt_ctf_field_type_integer_get_signed(type) ?
+			COLUMN_SIGNED : COLUMN_UNSIGNED;
+		column->width = size <= 8 ? 1 : size <= 16 ? 2 :
+			size <= 32 ? 4 : 8;
+		column->size = size;
+		break;
+	}
+	case CTF_TYPE_FLOAT:
+		if (bt_ctf_field_type_floating_point_get_mantissa_digits(
+				type) == FLT_MANT_DIG) {
+			column->kind = COLUMN_FLOAT;
+			column->width = sizeof(float);
+		} else {
+			column->kind = COLUMN_DOUBLE;
+			column->width = sizeof(double);
+		}
+		break;
+	default:
+		ret = -1;
+		goto end;
+	}
+	column->field = field;
+end:
+	bt_put(type);
+	return ret;
+}
+
+/*
+ * Set a column's field to the value of a row. Values are stored
+ * directly since the column was checked against the field's type, once
+ * checked against the range of the integer field, as
+ * bt_ctf_field_*_integer_set_value() would.
+ */
+static
+int stream_column_set_value(struct stream_column *column, size_t row)
+{
+	int ret = 0;
+	const char *value = (const char *) column->values +
+		row * column->width;
+
+	switch (column->kind) {
+	case COLUMN_UNSIGNED:
+	{
+		uint64_t v;
+		struct bt_ctf_field_integer *integer = container_of(
+			column->field, struct bt_ctf_field_integer, parent);
+
+		switch (column->width) {
+		case 1:
+			v = *(const uint8_t *) value;
+			break;
+		case 2:
+			v = *(const uint16_t *) value;
+			break;
+		case 4:
+			v = *(const uint32_t *) value;
+			break;
+		default:
+			v = *(const uint64_t *) value;
+		}
+		if (column->size < 64 && v > (1ULL << column->size) - 1) {
+			ret = -1;
+			goto end;
+		}
+		integer->definition.value._unsigned = v;
+		break;
+	}
+	case COLUMN_SIGNED:
+	{
+		int64_t v;
+		struct bt_ctf_field_integer *integer = container_of(
+			column->field, struct bt_ctf_field_integer, parent);
+
+		switch (column->width) {
+		case 1:
+			v = *(const int8_t *) value;
+			break;
+		case 2:
+			v = *(const int16_t *) value;
+			break;
+		case 4:
+			v = *(const int32_t *) value;
+			break;
+		default:
+			v = *(const int64_t *) value;
+		}
+		if (column->size < 64 &&
+				(v < -((int64_t) 1 << (column->size - 1)) ||
+				v > ((int64_t) 1 << (column->size - 1)) - 1)) {
+			ret = -1;
+			goto end;
+		}
+		integer->definition.value._signed = v;
+		break;
+	}
+	case COLUMN_FLOAT:
+	case COLUMN_DOUBLE:
+	{
+		struct bt_ctf_field_floating_point *floating_point =
+			container_of(column->field,
+				struct bt_ctf_field_floating_point, parent);
+
+		floating_point->definition.value =
+			column->kind == COLUMN_FLOAT ?
+			*(const float *) value : *(const double *) value;
+		break;
+	}
+	}
+	bt_ctf_field_set_payload_set(column->field, 1);
+end:
+	return ret;
+}
+
+int bt_ctf_stream_append_events_columnar(struct bt_ctf_stream *stream,
+		struct bt_ctf_event_class *event_class, size_t count,
+		const uint64_t *timestamps, const void * const *columns)
+{
+	int ret = 0;
+	size_t i, j, field_count;
+	struct bt_ctf_event *event = NULL;
+	struct bt_ctf_field *timestamp_field = NULL;
+	struct stream_column *stream_columns = NULL;
+	struct stream_column timestamp_column;
+
+	if (!stream || !event_class || stream->pos.fd < 0 ||
+			event_class->stream_class != stream->stream_class ||
+			event_class->context) {
+		ret = -1;
+		goto end;
+	}
+
+	ret = bt_ctf_field_type_structure_get_field_count(event_class->fields);
+	if (ret < 0 || (ret && !columns)) {
+		ret = -1;
+		goto end;
+	}
+	field_count = ret;
+	ret = 0;
+
+	event = bt_ctf_event_create(event_class);
+	if (!event) {
+		ret = -1;
+		goto end;
+	}
+
+	/* Check the columns against the event class once. */
+	stream_columns = g_new0(struct stream_column, field_count);
+	for (i = 0; i < field_count; i++) {
+		struct bt_ctf_field *field =
+			bt_ctf_event_get_payload_by_index(event, i);
+
+		ret = field && columns[i] ? stream_column_init(
+			&stream_columns[i], field, columns[i]) : -1;
+		bt_put(field);
+		if (ret) {
+			goto end;
+		}
+	}
+
+	/* Timestamps are 64-bit values checked against the field's size. */
+	if (timestamps) {
+		timestamp_field = bt_ctf_field_structure_get_field(
+			event->event_header, "timestamp");
+		ret = timestamp_field ? stream_column_init(&timestamp_column,
+			timestamp_field, timestamps) : -1;
+		if (ret || timestamp_column.kind != COLUMN_UNSIGNED) {
+			ret = -1;
+			goto end;
+		}
+		timestamp_column.width = sizeof(uint64_t);
+	}
+
+	if (stream->event_context) {
+		ret = bt_ctf_field_validate(stream->event_context);
+		if (ret) {
+			goto end;
+		}
+	}
+
+	/* Keep the events in order with the pending ones. */
+	if (!stream->streaming && stream->events->len) {
+		ret = bt_ctf_stream_flush(stream);
+		if (ret) {
+			goto end;
+		}
+	}
+
+	(void) bt_ctf_event_set_stream(event, stream);
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < field_count && !ret; j++) {
+			ret = stream_column_set_value(&stream_columns[j], i);
+		}
+		if (ret) {
+			break;
+		}
+
+		if (timestamp_field) {
+			ret = stream_column_set_value(&timestamp_column, i);
+			if (ret) {
+				break;
+			}
+		}
+
+		ret = bt_ctf_event_populate_event_header(event);
+		if (ret) {
+			break;
+		}
+
+		ret = stream_serialize_event(stream, event);
+		if (ret) {
+			break;
+		}
+	}
+	(void) bt_ctf_event_set_stream(event, NULL);
+
+	if (!stream->streaming && stream->packet_open) {
+		int close_ret = stream_close_packet(stream);
+
+		ret = ret ? ret : close_ret;
+	}
+end:
+	bt_put(timestamp_field);
+	bt_put(event);
+	g_free(stream_columns);
+	return ret;
+}
+
+struct bt_ctf_field *bt_ctf_stream_get_packet_context(
+		struct bt_ctf_stream *stream)
+{
+	struct bt_ctf_field *packet_context = NULL;
+
+	if (!stream) {
+		goto end;
+	}
+
+	packet_context = stream->packet_context;
+	if (packet_context) {
+		bt_get(packet_context);
+	}
+end:
+	return packet_context;
+}
+
+int bt_ctf_stream_set_packet_context(struct bt_ctf_stream *stream,
+		struct bt_ctf_field *field)
+{
+	int ret = 0;
+	struct bt_ctf_field_type *field_type;
+
+	if (!stream || !field) {
+		ret = -1;
+		goto end;
+	}
+
+	field_type = bt_ctf_field_get_type(field);
+	if (field_type != stream->stream_class->packet_context_type) {
+		ret = -1;
+		goto end;
+	}
+
+	bt_put(field_type);
+	bt_get(field);
+	bt_put(stream->packet_context);
+	stream->packet_context = field;
+end:
+	return ret;
+}
+
+struct bt_ctf_field *bt_ctf_stream_get_event_context(
+		struct bt_ctf_stream *stream)
+{
+	struct bt_ctf_field *event_context = NULL;
+
+	if (!stream) {
+		goto end;
+	}
+
+	event_context = stream->event_context;
+	if (event_context) {
+		bt_get(event_context);
+	}
+end:
+	return event_context;
+}
+
+int bt_ctf_stream_set_event_context(struct bt_ctf_stream *stream,
+		struct bt_ctf_field *field)
+{
+	int ret = 0;
+	struct bt_ctf_field_type *field_type = NULL;
+
+	if (!stream || !field) {
+		ret = -1;
+		goto end;
+	}
+
+	field_type = bt_ctf_field_get_type(field);
+	if (field_type != stream->stream_class->event_context_type) {
+		ret = -1;
+		goto end;
+	}
+
+	bt_get(field);
+	bt_put(stream->event_context);
+	stream->event_context = field;
+	BT_PUT(stream->event_context_snapshot);
+end:
+	bt_put(field_type);
+	return ret;
+}
+
+struct bt_ctf_field *bt_ctf_stream_get_packet_header(
+		struct bt_ctf_stream *stream)
+{
+	struct bt_ctf_field *packet_header = NULL;
+
+	if (!stream) {
+		goto end;
+	}
+
+	packet_header = stream->packet_header;
+	if (packet_header) {
+		bt_get(packet_header);
+	}
+end:
+	return packet_header;
+}
+
+int bt_ctf_stream_set_packet_header(struct bt_ctf_stream *stream,
+		struct bt_ctf_field *field)
+{
+	int ret = 0;
+	struct bt_ctf_field_type *field_type = NULL;
+
+	if (!stream || !field) {
+		ret = -1;
+		goto end;
+	}
+
+	field_type = bt_ctf_field_get_type(field);
+	if (field_type != stream->trace->packet_header_type) {
+		ret = -1;
+		goto end;
+	}
+
+	bt_get(field);
+	bt_put(stream->packet_header);
+	stream->packet_header = field;
+end:
+	bt_put(field_type);
+	return ret;
+}
+
+/* Get the value of an integer member of a structure, -1 if unset. */
+static
+int get_structure_field_integer(struct bt_ctf_field *structure, char *name,
+		uint64_t *value)
+{
+	int ret = 0;
+	struct bt_ctf_field *integer = NULL;
+	struct bt_ctf_field_type *integer_type = NULL;
+
+	integer = bt_ctf_field_structure_get_field(structure, name);
+	if (!integer) {
+		ret = -1;
+		goto end;
+	}
+
+	integer_type = bt_ctf_field_get_type(integer);
+	assert(integer_type);
+	if (bt_ctf_field_type_get_type_id(integer_type) !=
+		CTF_TYPE_INTEGER) {
+		ret = -1;
+		goto end;
+	}
+
+	if (bt_ctf_field_type_integer_get_signed(integer_type)) {
+		int64_t val;
+
+		ret = bt_ctf_field_signed_integer_get_value(integer, &val);
+		if (ret) {
+			goto end;
+		}
+		*value = (uint64_t) val;
+	} else {
+		ret = bt_ctf_field_unsigned_integer_get_value(integer, value);
+		if (ret) {
+			goto end;
+		}
+	}
+end:
+	bt_put(integer);
+	bt_put(integer_type);
+	return ret;
+}
+
+static
+int get_event_header_timestamp(struct bt_ctf_field *event_header, uint64_t *timestamp)
+{
+	return get_structure_field_integer(event_header, "timestamp",
+		timestamp);
+}
+
+int bt_ctf_stream_flush(struct bt_ctf_stream *stream)
+{
+	int ret = 0;
+	size_t i;
+	uint64_t timestamp_begin, timestamp_end, events_discarded;
+	uint64_t content_size;
+	int has_timestamp_begin, has_timestamp_end;
+	struct bt_ctf_field *integer = NULL;
+	struct ctf_stream_pos packet_context_pos;
+
+	if (!stream || stream->pos.fd < 0) {
+		/*
+		 * Stream does not have an associated fd. It is,
+		 * therefore, not a stream being used to write events.
+		 */
+		ret = -1;
+		goto end;
+	}
+
+	if (stream->streaming) {
+		/* Events were already written, only close the packet. */
+		ret = stream_close_packet(stream);
+		goto end;
+	}
+
+	if (!stream->events->len) {
+		goto end;
+	}
+
+	ret = bt_ctf_field_validate(stream->packet_header);
+	if (ret) {
+		goto end;
+	}
+
+	/* mmap the next packet */
+	stream->pos.next_packet_size = get_next_packet_size(stream, 0);
+	ctf_packet_seek(&stream->pos.parent, 0, SEEK_CUR);
+	if (stream->pos.offset == EOF) {
+		ret = -1;
+		goto end;
+	}
+
+	ret = bt_ctf_field_serialize(stream->packet_header, &stream->pos);
+	if (ret) {
+		goto end;
+	}
+
+	/* Set the default context attributes if present and unset. */
+	if (!get_event_header_timestamp(
+		((struct bt_ctf_event *) g_ptr_array_index(
+		stream->events, 0))->event_header, &timestamp_begin)) {
+		ret = set_structure_field_integer(stream->packet_context,
+			"timestamp_begin", timestamp_begin);
+		if (ret) {
+			goto end;
+		}
+	}
+
+	if (!get_event_header_timestamp(
+		((struct bt_ctf_event *) g_ptr_array_index(
+		stream->events, stream->events->len - 1))->event_header,
+		&timestamp_end)) {
+
+		ret = set_structure_field_integer(stream->packet_context,
+			"timestamp_end", timestamp_end);
+		if (ret) {
+			goto end;
+		}
+	}
+	ret = set_structure_field_integer(stream->packet_context,
+		"content_size", UINT64_MAX);
+	if (ret) {
+		goto end;
+	}
+
+	ret = set_structure_field_integer(stream->packet_context,
+		"packet_size", UINT64_MAX);
+	if (ret) {
+		goto end;
+	}
+
+	/* Write packet context */
+	memcpy(&packet_context_pos, &stream->pos,
+	       sizeof(struct ctf_stream_pos));
+	ret = bt_ctf_field_serialize(stream->packet_context,
+		&stream->pos);
+	if (ret) {
+		goto end;
+	}
+
+	/* Enlarge the packet once if the pending events do not fit. */
+	ret = get_pending_content_size(stream, &content_size);
+	if (ret) {
+		goto end;
+	}
+
+	if (content_size > stream->pos.packet_size) {
+		ret = ctf_pos_map_packet(&stream->pos,
+			get_next_packet_size(stream, content_size));
+		if (ret) {
+			goto end;
+		}
+	}
+
+	ret = bt_ctf_stream_get_discarded_events_count(stream,
+		&events_discarded);
+	if (ret) {
+		goto end;
+	}
+
+	/*
+	 * Keep the packet's time range, set again once the events are
+	 * written so that the packet index entry holds it.
+	 */
+	has_timestamp_begin = !get_structure_field_integer(
+		stream->packet_context, "timestamp_begin", &timestamp_begin);
+	has_timestamp_end = !get_structure_field_integer(
+		stream->packet_context, "timestamp_end", &timestamp_end);
+
+	/* Unset the packet context's fields. */
+	ret = bt_ctf_field_reset(stream->packet_context);
+	if (ret) {
+		goto end;
+	}
+
+	/* Set the previous number of discarded events. */
+	ret = set_structure_field_integer(stream->packet_context,
+		"events_discarded", events_discarded);
+	if (ret) {
+		goto end;
+	}
+
+	for (i = 0; i < stream->events->len; i++) {
 		struct bt_ctf_event *event = g_ptr_array_index(
 			stream->events, i);
 
@@ -842,6 +1807,22 @@ int bt_ctf_stream_flush(struct bt_ctf_stream *stream)
 	 * packet is resized).
 	 */
 	packet_context_pos.base_mma = stream->pos.base_mma;
+	if (has_timestamp_begin) {
+		ret = set_structure_field_integer(stream->packet_context,
+			"timestamp_begin", timestamp_begin);
+		if (ret) {
+			goto end;
+		}
+	}
+
+	if (has_timestamp_end) {
+		ret = set_structure_field_integer(stream->packet_context,
+			"timestamp_end", timestamp_end);
+		if (ret) {
+			goto end;
+		}
+	}
+
 	ret = set_structure_field_integer(stream->packet_context,
 		"content_size", stream->pos.offset);
 	if (ret) {
@@ -860,6 +1841,23 @@ int bt_ctf_stream_flush(struct bt_ctf_stream *stream)
 		goto end;
 	}
 
+	ret = stream_write_packet(stream);
+	if (ret) {
+		goto end;
+	}
+
+	/* Unset the packet context's fields for the next packet. */
+	ret = bt_ctf_field_reset(stream->packet_context);
+	if (ret) {
+		goto end;
+	}
+
+	ret = set_structure_field_integer(stream->packet_context,
+		"events_discarded", events_discarded);
+	if (ret) {
+		goto end;
+	}
+
 	g_ptr_array_set_size(stream->events, 0);
 	if (stream->event_contexts) {
 		g_ptr_array_set_size(stream->event_contexts, 0);
@@ -886,10 +1884,19 @@ void bt_ctf_stream_destroy(struct bt_object *obj)
 	struct bt_ctf_stream *stream;
 
 	stream = container_of(obj, struct bt_ctf_stream, base);
+	if (stream->packet_open) {
+		(void) stream_close_packet(stream);
+	}
+	if (stream->flush_queue) {
+		(void) stream_stop_flush_thread(stream);
+	}
 	ctf_fini_pos(&stream->pos);
 	if (stream->pos.fd >= 0 && close(stream->pos.fd)) {
 		perror("close");
 	}
+	if (stream->index_fd >= 0 && close(stream->index_fd)) {
+		perror("close");
+	}
 
 	bt_put(stream->stream_class);
 	if (stream->events) {
@@ -901,6 +1908,7 @@ void bt_ctf_stream_destroy(struct bt_object *obj)
 	bt_put(stream->packet_header);
 	bt_put(stream->packet_context);
 	bt_put(stream->event_context);
+	bt_put(stream->event_context_snapshot);
 	g_free(stream);
 }
 
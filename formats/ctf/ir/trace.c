@@ -30,6 +30,7 @@
 #include <babeltrace/ctf-ir/clock-internal.h>
 #include <babeltrace/ctf-ir/stream-internal.h>
 #include <babeltrace/ctf-ir/stream-class-internal.h>
+#include <babeltrace/ctf-ir/event-internal.h>
 #include <babeltrace/ctf-writer/functor-internal.h>
 #include <babeltrace/ctf-ir/event-types-internal.h>
 #include <babeltrace/ctf-ir/attributes-internal.h>
@@ -732,6 +733,25 @@ loop_next:
 	g_string_append(context->string, "};\n\n");
 }
 
+/* Serialize the declarations preceding the stream classes. */
+static
+int append_header_metadata(struct bt_ctf_trace *trace,
+		struct metadata_context *context)
+{
+	int ret;
+
+	g_string_append(context->string, "/* CTF 1.8 */\n\n");
+	ret = append_trace_metadata(trace, context);
+	if (ret) {
+		goto end;
+	}
+	append_env_metadata(trace, context);
+	g_ptr_array_foreach(trace->clocks,
+		(GFunc)bt_ctf_clock_serialize, context);
+end:
+	return ret;
+}
+
 char *bt_ctf_trace_get_metadata_string(struct bt_ctf_trace *trace)
 {
 	char *metadata = NULL;
@@ -750,13 +770,9 @@ char *bt_ctf_trace_get_metadata_string(struct bt_ctf_trace *trace)
 
 	context->field_name = g_string_sized_new(DEFAULT_IDENTIFIER_SIZE);
 	context->string = g_string_sized_new(DEFAULT_METADATA_STRING_SIZE);
-	g_string_append(context->string, "/* CTF 1.8 */\n\n");
-	if (append_trace_metadata(trace, context)) {
+	if (append_header_metadata(trace, context)) {
 		goto error;
 	}
-	append_env_metadata(trace, context);
-	g_ptr_array_foreach(trace->clocks,
-		(GFunc)bt_ctf_clock_serialize, context);
 
 	for (i = 0; i < trace->stream_classes->len; i++) {
 		err = bt_ctf_stream_class_serialize(
@@ -775,6 +791,128 @@ end:
 	return metadata;
 }
 
+BT_HIDDEN
+void bt_ctf_trace_metadata_state_init(
+		struct bt_ctf_trace_metadata_state *state)
+{
+	state->header = g_string_new(NULL);
+	state->classes = g_hash_table_new(g_direct_hash, g_direct_equal);
+}
+
+BT_HIDDEN
+void bt_ctf_trace_metadata_state_fini(
+		struct bt_ctf_trace_metadata_state *state)
+{
+	if (state->header) {
+		g_string_free(state->header, TRUE);
+	}
+	if (state->classes) {
+		g_hash_table_destroy(state->classes);
+	}
+}
+
+BT_HIDDEN
+void bt_ctf_trace_metadata_state_reset(
+		struct bt_ctf_trace_metadata_state *state)
+{
+	g_string_truncate(state->header, 0);
+	g_hash_table_remove_all(state->classes);
+}
+
+static
+int metadata_state_add_class(struct bt_ctf_trace_metadata_state *state,
+		void *class)
+{
+	if (g_hash_table_lookup(state->classes, class)) {
+		return 0;
+	}
+
+	g_hash_table_insert(state->classes, class, class);
+	return 1;
+}
+
+BT_HIDDEN
+char *bt_ctf_trace_get_metadata_update(struct bt_ctf_trace *trace,
+		struct bt_ctf_trace_metadata_state *state, int *full)
+{
+	char *metadata = NULL;
+	struct metadata_context *context = NULL;
+	int err = 0;
+	size_t i, j;
+
+	if (!trace || !state || !full) {
+		goto end;
+	}
+
+	context = g_new0(struct metadata_context, 1);
+	if (!context) {
+		goto end;
+	}
+
+	context->field_name = g_string_sized_new(DEFAULT_IDENTIFIER_SIZE);
+	context->string = g_string_sized_new(DEFAULT_METADATA_STRING_SIZE);
+	err = append_header_metadata(trace, context);
+	if (err) {
+		goto error;
+	}
+
+	*full = !state->header->len || strcmp(state->header->str,
+		context->string->str);
+	if (*full) {
+		bt_ctf_trace_metadata_state_reset(state);
+		g_string_assign(state->header, context->string->str);
+	} else {
+		g_string_truncate(context->string, 0);
+	}
+
+	for (i = 0; i < trace->stream_classes->len; i++) {
+		struct bt_ctf_stream_class *stream_class =
+			trace->stream_classes->pdata[i];
+
+		if (metadata_state_add_class(state, stream_class)) {
+			err = bt_ctf_stream_class_serialize(stream_class,
+				context);
+			if (err) {
+				goto error;
+			}
+
+			for (j = 0; j < stream_class->event_classes->len; j++) {
+				metadata_state_add_class(state,
+					stream_class->event_classes->pdata[j]);
+			}
+			continue;
+		}
+
+		/* Event classes added to a stream class already written */
+		for (j = 0; j < stream_class->event_classes->len; j++) {
+			struct bt_ctf_event_class *event_class =
+				stream_class->event_classes->pdata[j];
+
+			if (!metadata_state_add_class(state, event_class)) {
+				continue;
+			}
+
+			err = bt_ctf_event_class_serialize(event_class,
+				context);
+			if (err) {
+				goto error;
+			}
+		}
+	}
+
+	metadata = context->string->str;
+error:
+	if (err) {
+		/* Some declarations are marked as written but were not. */
+		bt_ctf_trace_metadata_state_reset(state);
+	}
+	g_string_free(context->string, err ? TRUE : FALSE);
+	g_string_free(context->field_name, TRUE);
+	g_free(context);
+end:
+	return metadata;
+}
+
 enum bt_ctf_byte_order bt_ctf_trace_get_byte_order(struct bt_ctf_trace *trace)
 {
 	enum bt_ctf_byte_order ret = BT_CTF_BYTE_ORDER_UNKNOWN;
@@ -3093,7 +3093,9 @@ int ctf_destroy_metadata(struct ctf_trace *trace)
 				stream_def = g_ptr_array_index(stream->streams, j);
 				if (!stream_def)
 					continue;
-				for (k = 0; k < stream_def->events_by_id->len; k++) {
+				/* Not created for streams opened lazily and never read. */
+				for (k = 0; stream_def->events_by_id
+						&& k < stream_def->events_by_id->len; k++) {
 					struct ctf_event_definition *event;
 
 					event = g_ptr_array_index(stream_def->events_by_id, k);
@@ -3113,7 +3115,8 @@ int ctf_destroy_metadata(struct ctf_trace *trace)
 					bt_definition_unref(&stream_def->stream_packet_context->p);
 				if (&stream_def->stream_event_context->p)
 					bt_definition_unref(&stream_def->stream_event_context->p);
-				g_ptr_array_free(stream_def->events_by_id, TRUE);
+				if (stream_def->events_by_id)
+					g_ptr_array_free(stream_def->events_by_id, TRUE);
 				g_free(stream_def);
 			}
 			if (stream->event_header_decl)
@@ -0,0 +1,45 @@
+#ifndef _CTF_PREFETCH_PRIVATE_H
+#define _CTF_PREFETCH_PRIVATE_H
+
+/*
+ * ctf/prefetch-private.h
+ *
+ * Babeltrace Library - Asynchronous packet prefetch
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <babeltrace/babeltrace-internal.h>
+#include <sys/types.h>
+
+/*
+ * Queue an asynchronous read of a file range, so it is in the page cache
+ * when it is later mapped. Requests are dropped when the queue is full.
+ */
+BT_HIDDEN
+void ctf_prefetch_range(int fd, off_t offset, size_t len);
+
+/*
+ * Discard the queued requests on fd and wait for the ones in progress to
+ * complete. Must be called before closing fd.
+ */
+BT_HIDDEN
+void ctf_prefetch_cancel(int fd);
+
+#endif /* _CTF_PREFETCH_PRIVATE_H */
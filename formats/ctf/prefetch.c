@@ -0,0 +1,206 @@
+/*
+ * prefetch.c
+ *
+ * Babeltrace Library - Asynchronous packet prefetch
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <babeltrace/babeltrace-internal.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <glib.h>
+#include "prefetch-private.h"
+
+/*
+ * Packets ahead of the ones being decoded are read into the page cache
+ * by a small pool of threads, so the reader does not stall on I/O when
+ * it moves to the next packet of a stream.
+ */
+#define PREFETCH_NR_THREADS	4
+#define PREFETCH_QUEUE_MAX	1024
+#define PREFETCH_CHUNK_LEN	(256 * 1024)
+
+struct prefetch_request {
+	int fd;
+	off_t offset;
+	size_t len;
+};
+
+static pthread_once_t prefetch_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t prefetch_done_cond = PTHREAD_COND_INITIALIZER;
+
+/* Protected by prefetch_lock. */
+static GQueue *prefetch_queue;
+static int prefetch_busy_fd[PREFETCH_NR_THREADS];
+static int prefetch_stop;
+
+static pthread_t prefetch_threads[PREFETCH_NR_THREADS];
+static int prefetch_nr_threads;
+
+static
+void prefetch_read(struct prefetch_request *req, char *buf)
+{
+	off_t offset = req->offset;
+	size_t len = req->len;
+
+	while (len > 0) {
+		ssize_t ret;
+
+		ret = pread(req->fd, buf,
+			len < PREFETCH_CHUNK_LEN ? len : PREFETCH_CHUNK_LEN,
+			offset);
+		if (ret <= 0)
+			break;
+		offset += ret;
+		len -= ret;
+	}
+}
+
+static
+void *prefetch_thread(void *arg)
+{
+	long id = (long) arg;
+	char *buf;
+
+	buf = malloc(PREFETCH_CHUNK_LEN);
+	pthread_mutex_lock(&prefetch_lock);
+	for (;;) {
+		struct prefetch_request *req;
+
+		while (!prefetch_stop && g_queue_is_empty(prefetch_queue))
+			pthread_cond_wait(&prefetch_work_cond, &prefetch_lock);
+		if (prefetch_stop)
+			break;
+		req = g_queue_pop_head(prefetch_queue);
+		prefetch_busy_fd[id] = req->fd;
+		pthread_mutex_unlock(&prefetch_lock);
+
+		if (buf)
+			prefetch_read(req, buf);
+		g_free(req);
+
+		pthread_mutex_lock(&prefetch_lock);
+		prefetch_busy_fd[id] = -1;
+		pthread_cond_broadcast(&prefetch_done_cond);
+	}
+	pthread_mutex_unlock(&prefetch_lock);
+	free(buf);
+	return NULL;
+}
+
+static
+void prefetch_init(void)
+{
+	long i;
+
+	pthread_mutex_lock(&prefetch_lock);
+	prefetch_queue = g_queue_new();
+	for (i = 0; i < PREFETCH_NR_THREADS; i++)
+		prefetch_busy_fd[i] = -1;
+	pthread_mutex_unlock(&prefetch_lock);
+
+	for (i = 0; i < PREFETCH_NR_THREADS; i++) {
+		if (pthread_create(&prefetch_threads[i], NULL,
+				prefetch_thread, (void *) i))
+			break;
+	}
+	prefetch_nr_threads = i;
+	if (!prefetch_nr_threads)
+		fprintf(stderr, "[warning] Unable to start prefetch threads.\n");
+}
+
+static
+void __attribute__((destructor)) prefetch_fini(void)
+{
+	int i;
+
+	if (!prefetch_nr_threads)
+		return;
+	pthread_mutex_lock(&prefetch_lock);
+	prefetch_stop = 1;
+	pthread_cond_broadcast(&prefetch_work_cond);
+	pthread_mutex_unlock(&prefetch_lock);
+	for (i = 0; i < prefetch_nr_threads; i++)
+		pthread_join(prefetch_threads[i], NULL);
+	while (!g_queue_is_empty(prefetch_queue))
+		g_free(g_queue_pop_head(prefetch_queue));
+	g_queue_free(prefetch_queue);
+}
+
+void ctf_prefetch_range(int fd, off_t offset, size_t len)
+{
+	struct prefetch_request *req;
+
+	pthread_once(&prefetch_once, prefetch_init);
+	if (!prefetch_nr_threads)
+		return;
+
+	pthread_mutex_lock(&prefetch_lock);
+	if (g_queue_get_length(prefetch_queue) >= PREFETCH_QUEUE_MAX) {
+		/* Only a hint: the packet will be read when mapped. */
+		pthread_mutex_unlock(&prefetch_lock);
+		return;
+	}
+	req = g_new(struct prefetch_request, 1);
+	req->fd = fd;
+	req->offset = offset;
+	req->len = len;
+	g_queue_push_tail(prefetch_queue, req);
+	pthread_cond_signal(&prefetch_work_cond);
+	pthread_mutex_unlock(&prefetch_lock);
+}
+
+static
+int prefetch_fd_busy(int fd)
+{
+	int i;
+
+	for (i = 0; i < PREFETCH_NR_THREADS; i++) {
+		if (prefetch_busy_fd[i] == fd)
+			return 1;
+	}
+	return 0;
+}
+
+void ctf_prefetch_cancel(int fd)
+{
+	GList *node, *next;
+
+	pthread_mutex_lock(&prefetch_lock);
+	if (!prefetch_queue)
+		goto end;
+	for (node = prefetch_queue->head; node; node = next) {
+		struct prefetch_request *req = node->data;
+
+		next = node->next;
+		if (req->fd == fd) {
+			g_free(req);
+			g_queue_delete_link(prefetch_queue, node);
+		}
+	}
+	while (prefetch_fd_busy(fd))
+		pthread_cond_wait(&prefetch_done_cond, &prefetch_lock);
+end:
+	pthread_mutex_unlock(&prefetch_lock);
+}
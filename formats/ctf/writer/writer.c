@@ -26,6 +26,7 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include <babeltrace/ctf-ir/clock-internal.h>
 #include <babeltrace/ctf-writer/writer-internal.h>
 #include <babeltrace/ctf-ir/event-types-internal.h>
@@ -64,6 +65,8 @@ struct bt_ctf_writer *bt_ctf_writer_create(const char *path)
 	}
 
 	bt_object_init(writer, bt_ctf_writer_destroy);
+	pthread_mutex_init(&writer->lock, NULL);
+	bt_ctf_trace_metadata_state_init(&writer->metadata_state);
 	writer->path = g_string_new(path);
 	if (!writer->path) {
 		goto error_destroy;
@@ -122,6 +125,8 @@ void bt_ctf_writer_destroy(struct bt_object *obj)
 	}
 
 	bt_put(writer->trace);
+	bt_ctf_trace_metadata_state_fini(&writer->metadata_state);
+	pthread_mutex_destroy(&writer->lock);
 	g_free(writer);
 }
 
@@ -146,9 +151,10 @@ struct bt_ctf_stream *bt_ctf_writer_create_stream(struct bt_ctf_writer *writer,
 	struct bt_ctf_stream *stream = NULL;
 
 	if (!writer || !stream_class) {
-		goto error;
+		goto end;
 	}
 
+	pthread_mutex_lock(&writer->lock);
 	stream = bt_ctf_trace_create_stream(writer->trace, stream_class);
 	if (!stream) {
 		goto error;
@@ -159,10 +165,20 @@ struct bt_ctf_stream *bt_ctf_writer_create_stream(struct bt_ctf_writer *writer,
 		goto error;
 	}
 
+	if (writer->io_mode != BT_CTF_WRITER_IO_MODE_MMAP) {
+		stream->pos.buffered = 1;
+#ifdef O_DIRECT
+		stream->pos.direct = !!(fcntl(stream_fd, F_GETFL) & O_DIRECT);
+#endif
+	}
+
 	writer->frozen = 1;
+	pthread_mutex_unlock(&writer->lock);
+end:
 	return stream;
 
 error:
+	pthread_mutex_unlock(&writer->lock);
         BT_PUT(stream);
 	return stream;
 }
@@ -177,8 +193,10 @@ int bt_ctf_writer_add_environment_field(struct bt_ctf_writer *writer,
 		goto end;
 	}
 
+	pthread_mutex_lock(&writer->lock);
 	ret = bt_ctf_trace_set_environment_field_string(writer->trace,
 		name, value);
+	pthread_mutex_unlock(&writer->lock);
 end:
 	return ret;
 }
@@ -192,7 +210,9 @@ int bt_ctf_writer_add_clock(struct bt_ctf_writer *writer,
 		goto end;
 	}
 
+	pthread_mutex_lock(&writer->lock);
 	ret = bt_ctf_trace_add_clock(writer->trace, clock);
+	pthread_mutex_unlock(&writer->lock);
 end:
 	return ret;
 }
@@ -205,45 +225,60 @@ char *bt_ctf_writer_get_metadata_string(struct bt_ctf_writer *writer)
 		goto end;
 	}
 
+	pthread_mutex_lock(&writer->lock);
 	metadata_string = bt_ctf_trace_get_metadata_string(
 		writer->trace);
+	pthread_mutex_unlock(&writer->lock);
 end:
 	return metadata_string;
 }
 
 void bt_ctf_writer_flush_metadata(struct bt_ctf_writer *writer)
 {
-	int ret;
+	ssize_t ret;
+	int full;
+	size_t len;
 	char *metadata_string = NULL;
 
 	if (!writer) {
 		goto end;
 	}
 
-	metadata_string = bt_ctf_trace_get_metadata_string(
-		writer->trace);
+	pthread_mutex_lock(&writer->lock);
+	/* Only append the declarations added since the last flush. */
+	metadata_string = bt_ctf_trace_get_metadata_update(writer->trace,
+		&writer->metadata_state, &full);
 	if (!metadata_string) {
-		goto end;
+		goto end_unlock;
 	}
 
-	if (lseek(writer->metadata_fd, 0, SEEK_SET) == (off_t)-1) {
-		perror("lseek");
-		goto end;
-	}
+	if (full) {
+		if (lseek(writer->metadata_fd, 0, SEEK_SET) == (off_t)-1) {
+			perror("lseek");
+			goto error;
+		}
 
-	if (ftruncate(writer->metadata_fd, 0)) {
-		perror("ftruncate");
-		goto end;
+		if (ftruncate(writer->metadata_fd, 0)) {
+			perror("ftruncate");
+			goto error;
+		}
 	}
 
-	ret = write(writer->metadata_fd, metadata_string,
-		strlen(metadata_string));
-	if (ret < 0) {
+	len = strlen(metadata_string);
+	ret = write(writer->metadata_fd, metadata_string, len);
+	if (ret < 0 || ret != len) {
 		perror("write");
-		goto end;
+		goto error;
 	}
+end_unlock:
+	pthread_mutex_unlock(&writer->lock);
 end:
 	g_free(metadata_string);
+	return;
+error:
+	/* Rewrite the whole metadata file on the next flush. */
+	bt_ctf_trace_metadata_state_reset(&writer->metadata_state);
+	goto end_unlock;
 }
 
 int bt_ctf_writer_set_byte_order(struct bt_ctf_writer *writer,
@@ -262,6 +297,29 @@ end:
 	return ret;
 }
 
+int bt_ctf_writer_set_io_mode(struct bt_ctf_writer *writer,
+		enum bt_ctf_writer_io_mode io_mode)
+{
+	int ret = 0;
+
+	if (!writer || writer->frozen) {
+		ret = -1;
+		goto end;
+	}
+
+	switch (io_mode) {
+	case BT_CTF_WRITER_IO_MODE_MMAP:
+	case BT_CTF_WRITER_IO_MODE_PWRITE:
+	case BT_CTF_WRITER_IO_MODE_PWRITE_DIRECT:
+		writer->io_mode = io_mode;
+		break;
+	default:
+		ret = -1;
+	}
+end:
+	return ret;
+}
+
 void bt_ctf_writer_get(struct bt_ctf_writer *writer)
 {
 	bt_get(writer);
@@ -272,6 +330,39 @@ void bt_ctf_writer_put(struct bt_ctf_writer *writer)
 	bt_put(writer);
 }
 
+/*
+ * Open the packet index of a stream file, index/<stream file>.idx. The
+ * index is optional; readers scan the stream file when it is missing.
+ */
+static
+void create_stream_index_file(struct bt_ctf_writer *writer,
+		struct bt_ctf_stream *stream, const char *stream_filename)
+{
+	int fd;
+	GString *filename;
+
+	if (mkdirat(writer->trace_dir_fd, "index", S_IRWXU | S_IRWXG) &&
+		errno != EEXIST) {
+		perror("mkdirat");
+		return;
+	}
+
+	filename = g_string_new(NULL);
+	g_string_printf(filename, "index/%s.idx", stream_filename);
+	fd = openat(writer->trace_dir_fd, filename->str,
+		O_WRONLY | O_CREAT | O_TRUNC,
+		S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	g_string_free(filename, TRUE);
+	if (fd < 0) {
+		perror("openat");
+		return;
+	}
+
+	if (bt_ctf_stream_set_index_fd(stream, fd) && close(fd)) {
+		perror("close");
+	}
+}
+
 static
 int create_stream_file(struct bt_ctf_writer *writer,
 		struct bt_ctf_stream *stream)
@@ -292,9 +383,23 @@ int create_stream_file(struct bt_ctf_writer *writer,
 	}
 
 	g_string_append_printf(filename, "_%" PRIu32, stream->id);
-	fd = openat(writer->trace_dir_fd, filename->str,
-		O_RDWR | O_CREAT | O_TRUNC,
-		S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	fd = -1;
+#ifdef O_DIRECT
+	if (writer->io_mode == BT_CTF_WRITER_IO_MODE_PWRITE_DIRECT) {
+		fd = openat(writer->trace_dir_fd, filename->str,
+			O_RDWR | O_CREAT | O_TRUNC | O_DIRECT,
+			S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+		/* Fall back to buffered I/O if O_DIRECT is not supported. */
+	}
+#endif
+	if (fd < 0) {
+		fd = openat(writer->trace_dir_fd, filename->str,
+			O_RDWR | O_CREAT | O_TRUNC,
+			S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	}
+	if (fd >= 0) {
+		create_stream_index_file(writer, stream, filename->str);
+	}
 error:
 	g_string_free(filename, TRUE);
 	return fd;
@@ -33,6 +33,28 @@
 
 extern int babeltrace_verbose, babeltrace_debug;
 
+/*
+ * Reader mapping options: pre-fault packet mappings, ask for huge pages
+ * on large mappings, and number of packets to read ahead of the current
+ * one, per stream, either as a hint to the kernel (readahead) or with
+ * asynchronous reads (prefetch).
+ */
+extern int babeltrace_mmap_populate, babeltrace_mmap_hugepage;
+extern unsigned int babeltrace_readahead, babeltrace_prefetch;
+
+/*
+ * Reader resource budget: maximum number of stream files kept open and
+ * of bytes of packets kept mapped across all traces, 0 for no limit.
+ */
+extern unsigned int babeltrace_max_open_files;
+extern uint64_t babeltrace_max_mapped_size;
+
+/*
+ * Lazy trace opening: stream files are only indexed and get their
+ * definitions when first read.
+ */
+extern int babeltrace_lazy_open;
+
 #define printf_verbose(fmt, args...)					\
 	do {								\
 		if (babeltrace_verbose)					\
@@ -191,10 +213,13 @@ extern int opt_all_field_names,
 	opt_clock_seconds,
 	opt_clock_date,
 	opt_clock_gmt,
-	opt_clock_force_correlate;
+	opt_clock_force_correlate,
+	opt_skip_payload;
 
 extern uint64_t opt_clock_offset;
 extern uint64_t opt_clock_offset_ns;
+extern uint64_t opt_trim_begin, opt_trim_end;
+extern char *opt_copy_streams;
 extern int babeltrace_ctf_console_output;
 
 #endif
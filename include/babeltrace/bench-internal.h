@@ -0,0 +1,121 @@
+#ifndef _BABELTRACE_BENCH_INTERNAL_H
+#define _BABELTRACE_BENCH_INTERNAL_H
+
+/*
+ * babeltrace/bench-internal.h
+ *
+ * Benchmark accounting of the trace reading phases.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+enum bt_bench_phase {
+	BT_BENCH_PHASE_OPEN_INDEX,
+	BT_BENCH_PHASE_METADATA,
+	BT_BENCH_PHASE_PACKET_MAP,
+	BT_BENCH_PHASE_DECODE,
+	BT_BENCH_PHASE_MERGE,
+	BT_BENCH_PHASE_OUTPUT,
+	BT_BENCH_NR_PHASES,
+};
+
+struct bt_bench_time {
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+};
+
+/*
+ * Phases can nest (e.g. a packet is mapped while decoding an event,
+ * itself within the merge). Each phase is only charged its exclusive
+ * time: "accounted" sums the time already charged to any phase, so the
+ * time charged to nested phases can be subtracted from the outer one.
+ */
+struct bt_bench_sample {
+	struct bt_bench_time start;
+	struct bt_bench_time accounted;
+};
+
+struct bt_bench_stats {
+	struct bt_bench_time phases[BT_BENCH_NR_PHASES];
+	struct bt_bench_time accounted;
+	uint64_t events;		/* Events decoded */
+	uint64_t packets_mapped;
+	uint64_t bytes_mapped;		/* Packet content mapped, in bytes */
+};
+
+extern int babeltrace_bench;
+extern struct bt_bench_stats babeltrace_bench_stats;
+
+static inline
+uint64_t bt_bench_clock_ns(clockid_t clock_id)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock_id, &ts))
+		return 0;
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline
+void bt_bench_now(struct bt_bench_time *time)
+{
+	time->wall_ns = bt_bench_clock_ns(CLOCK_MONOTONIC);
+	time->cpu_ns = bt_bench_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+static inline
+void bt_bench_start(struct bt_bench_sample *sample)
+{
+	if (!babeltrace_bench)
+		return;
+	bt_bench_now(&sample->start);
+	sample->accounted = babeltrace_bench_stats.accounted;
+}
+
+static inline
+void bt_bench_stop(enum bt_bench_phase phase, struct bt_bench_sample *sample)
+{
+	struct bt_bench_stats *stats = &babeltrace_bench_stats;
+	struct bt_bench_time now;
+	uint64_t wall, cpu;
+
+	if (!babeltrace_bench)
+		return;
+	bt_bench_now(&now);
+	wall = now.wall_ns - sample->start.wall_ns
+		- (stats->accounted.wall_ns - sample->accounted.wall_ns);
+	cpu = now.cpu_ns - sample->start.cpu_ns
+		- (stats->accounted.cpu_ns - sample->accounted.cpu_ns);
+	stats->phases[phase].wall_ns += wall;
+	stats->phases[phase].cpu_ns += cpu;
+	stats->accounted.wall_ns += wall;
+	stats->accounted.cpu_ns += cpu;
+}
+
+/*
+ * Print the benchmark report. "total" is the wall and CPU time elapsed
+ * since the beginning of the run.
+ */
+void bt_bench_fprint(FILE *fp, const struct bt_bench_time *total);
+
+#endif /* _BABELTRACE_BENCH_INTERNAL_H */
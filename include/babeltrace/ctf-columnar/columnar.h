@@ -0,0 +1,86 @@
+#ifndef _BABELTRACE_CTF_COLUMNAR_H
+#define _BABELTRACE_CTF_COLUMNAR_H
+
+/*
+ * BabelTrace
+ *
+ * Columnar export file format
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+
+/*
+ * One file is written per event class. Its layout is:
+ *
+ *   struct ctf_columnar_file_hdr
+ *   event name (name_len bytes, NUL-terminated)
+ *   nr_columns times:
+ *     struct ctf_columnar_column_hdr
+ *     column name (name_len bytes, NUL-terminated)
+ *   row groups, until end of file:
+ *     struct ctf_columnar_group_hdr
+ *     nr_columns times: nr_rows 64-bit cells (one column after the other)
+ *     string blob (blob_len bytes)
+ *
+ * Each variable-length part is padded with zeroes to a multiple of
+ * CTF_COLUMNAR_ALIGN bytes, so every column can be mapped and scanned
+ * directly. All integers, including the cells, are stored in the byte
+ * order of the host which wrote the file: readers compare
+ * byte_order_mark against CTF_COLUMNAR_BYTE_ORDER_MARK to detect it.
+ */
+
+#define CTF_COLUMNAR_MAGIC		0xC1FC01A5
+#define CTF_COLUMNAR_MAJOR		1
+#define CTF_COLUMNAR_MINOR		0
+#define CTF_COLUMNAR_BYTE_ORDER_MARK	0x01020304
+#define CTF_COLUMNAR_ALIGN		8
+
+enum ctf_columnar_type {
+	CTF_COLUMNAR_UINT64	= 0,
+	CTF_COLUMNAR_INT64	= 1,
+	CTF_COLUMNAR_DOUBLE	= 2,
+	/* Cell is a byte offset of a NUL-terminated string in the group blob */
+	CTF_COLUMNAR_STRING	= 3,
+};
+
+struct ctf_columnar_file_hdr {
+	uint32_t magic;
+	uint16_t major;
+	uint16_t minor;
+	uint32_t byte_order_mark;
+	uint32_t nr_columns;
+	uint64_t stream_id;		/* stream class ID */
+	uint64_t event_id;		/* event ID within the stream class */
+	uint32_t name_len;		/* event name length, including NUL */
+	uint32_t reserved;
+} __attribute__((__packed__));
+
+struct ctf_columnar_column_hdr {
+	uint32_t type;			/* enum ctf_columnar_type */
+	uint32_t name_len;		/* column name length, including NUL */
+} __attribute__((__packed__));
+
+struct ctf_columnar_group_hdr {
+	uint64_t nr_rows;
+	uint64_t blob_len;		/* string blob length, in bytes */
+} __attribute__((__packed__));
+
+#endif /* _BABELTRACE_CTF_COLUMNAR_H */
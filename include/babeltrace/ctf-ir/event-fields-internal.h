@@ -37,6 +37,11 @@ struct bt_ctf_field {
 	struct bt_object base;
 	struct bt_ctf_field_type *type;
 	int payload_set;
+	/*
+	 * Structure tracking whether this field is set, if any (see
+	 * struct bt_ctf_field_structure). Not a reference.
+	 */
+	struct bt_ctf_field *owner;
 };
 
 struct bt_ctf_field_integer {
@@ -59,6 +64,16 @@ struct bt_ctf_field_structure {
 	struct bt_ctf_field parent;
 	GHashTable *field_name_to_index;
 	GPtrArray *fields; /* Array of pointers to struct bt_ctf_field */
+	/*
+	 * A tracked structure owns its members and counts the ones which
+	 * are not set as they are set and reset, so that it is validated
+	 * without walking its members. Structures containing variants,
+	 * arrays or sequences are not tracked.
+	 */
+	int tracked;
+	size_t unset_count;
+	/* Bumped whenever a member of a tracked structure is modified */
+	uint64_t generation;
 };
 
 struct bt_ctf_field_variant {
@@ -94,6 +109,13 @@ int bt_ctf_field_structure_set_field(struct bt_ctf_field *structure,
 BT_HIDDEN
 int bt_ctf_field_validate(struct bt_ctf_field *field);
 
+/*
+ * Mark a field's payload as set or unset after it is modified, updating
+ * the structures tracking it.
+ */
+BT_HIDDEN
+void bt_ctf_field_set_payload_set(struct bt_ctf_field *field, int set);
+
 /* Mark field payload as unset. */
 BT_HIDDEN
 int bt_ctf_field_reset(struct bt_ctf_field *field);
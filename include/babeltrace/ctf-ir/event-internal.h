@@ -36,10 +36,14 @@
 #include <babeltrace/ctf-ir/stream.h>
 #include <babeltrace/object-internal.h>
 #include <glib.h>
+#include <pthread.h>
 
 #define BT_CTF_EVENT_CLASS_ATTR_ID_INDEX	0
 #define BT_CTF_EVENT_CLASS_ATTR_NAME_INDEX	1
 
+/* Maximal number of recycled events kept by an event class */
+#define BT_CTF_EVENT_CLASS_POOL_MAX_LEN	4096
+
 struct bt_ctf_event_class {
 	struct bt_object base;
 	struct bt_value *attributes;
@@ -53,6 +57,18 @@ struct bt_ctf_event_class {
 	/* Structure type containing the event's fields */
 	struct bt_ctf_field_type *fields;
 	int frozen;
+	/*
+	 * Recycled events (see bt_ctf_event_recycle), returned by
+	 * bt_ctf_event_create. Pooled events don't hold a reference to
+	 * their event class.
+	 */
+	GPtrArray *event_pool;
+	pthread_mutex_t pool_lock;
+	/*
+	 * TSDL declaration, cached once the class is frozen and belongs to
+	 * a trace.
+	 */
+	GString *metadata;
 };
 
 struct bt_ctf_event {
@@ -63,6 +79,8 @@ struct bt_ctf_event {
 	struct bt_ctf_field *event_header;
 	struct bt_ctf_field *context_payload;
 	struct bt_ctf_field *fields_payload;
+	/* Return to the event class' pool once released */
+	int recycle;
 };
 
 BT_HIDDEN
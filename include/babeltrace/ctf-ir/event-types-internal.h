@@ -71,6 +71,8 @@ struct bt_ctf_field_type {
 	 * a field has been instanciated from it.
 	 */
 	int frozen;
+	/* Flat serializer, compiled on first use once frozen */
+	struct bt_ctf_field_type_layout *layout;
 };
 
 struct bt_ctf_field_type_integer {
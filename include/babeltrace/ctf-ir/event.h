@@ -510,6 +510,22 @@ extern int bt_ctf_event_set_event_context(struct bt_ctf_event *event,
  */
 extern struct bt_ctf_event *bt_ctf_event_copy(struct bt_ctf_event *event);
 
+/*
+ * bt_ctf_event_recycle: release an event for reuse.
+ *
+ * Release the caller's reference to the event, as bt_ctf_event_put does.
+ * Once the event is no longer referenced, e.g. after the stream to which
+ * it was appended is flushed, its fields are reset and the event is kept
+ * by its event class instead of being freed. A later call to
+ * bt_ctf_event_create on the same event class returns it, saving the
+ * allocation of its fields.
+ *
+ * References to the event's fields must not be kept past this call.
+ *
+ * @param event Event.
+ */
+extern void bt_ctf_event_recycle(struct bt_ctf_event *event);
+
 /*
  * bt_ctf_event_get and bt_ctf_event_put: increment and decrement
  * the event's reference count.
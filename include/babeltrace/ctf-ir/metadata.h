@@ -296,6 +296,13 @@ struct ctf_event_declaration {
 		CTF_EVENT_loglevel =		(1 << 4),
 		CTF_EVENT_model_emf_uri =	(1 << 5),
 	} field_mask;
+
+	/* Whether events can be skipped without decoding them (cached) */
+	enum {
+		CTF_EVENT_SKIP_UNKNOWN = 0,
+		CTF_EVENT_SKIP_LAYOUT,		/* Skip using the layout only */
+		CTF_EVENT_SKIP_DECODE,		/* Must be decoded */
+	} skip;
 };
 
 #endif /* _BABELTRACE_CTF_IR_METADATA_H */
@@ -35,12 +35,21 @@
 #include <babeltrace/babeltrace-internal.h>
 #include <babeltrace/ctf/types.h>
 #include <glib.h>
+#include <pthread.h>
 
 struct bt_ctf_stream_class {
 	struct bt_object base;
 	GString *name;
 	struct bt_ctf_clock *clock;
 	GPtrArray *event_classes; /* Array of pointers to bt_ctf_event_class */
+	/* Weak references to the event classes, by name and by ID */
+	GHashTable *event_classes_by_name;
+	GHashTable *event_classes_by_id;
+	/*
+	 * Protects the event classes against concurrent additions and
+	 * lookups.
+	 */
+	pthread_mutex_t lock;
 	int id_set;
 	uint32_t id;
 	uint32_t next_event_id;
@@ -52,6 +61,11 @@ struct bt_ctf_stream_class {
 	struct bt_ctf_field_type *event_context_type;
 	int frozen;
 	int byte_order;
+	/*
+	 * TSDL declaration, without the event classes, cached once the
+	 * class belongs to a trace.
+	 */
+	GString *metadata;
 };
 
 BT_HIDDEN
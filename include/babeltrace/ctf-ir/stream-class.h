@@ -157,6 +157,9 @@ extern int bt_ctf_stream_class_set_id(
  * Note that an event class may only be added to one stream class. It
  * also becomes immutable.
  *
+ * Event classes may be added while other threads create events from the
+ * stream class' event classes, or look them up.
+ *
  * @param stream_class Stream class.
  * @param event_class Event class to add to the provided stream class.
  *
@@ -36,6 +36,8 @@
 #include <babeltrace/ctf/types.h>
 #include <glib.h>
 
+struct bt_ctf_stream_flush_queue;
+
 struct bt_ctf_stream {
 	struct bt_object base;
 	/* Trace owning this stream. A stream does not own a trace. */
@@ -48,11 +50,30 @@ struct bt_ctf_stream {
 	GPtrArray *event_headers;
 	GPtrArray *event_contexts;
 	struct ctf_stream_pos pos;
+	uint64_t packet_size_target;	/* in bits, 0 for default */
 	unsigned int flushed_packet_count;
 	struct bt_ctf_field *packet_header;
 	struct bt_ctf_field *packet_context;
 	struct bt_ctf_field *event_header;
 	struct bt_ctf_field *event_context;
+	/*
+	 * Copy of the event context shared by the appended events as long
+	 * as the context's generation does not change.
+	 */
+	struct bt_ctf_field *event_context_snapshot;
+	uint64_t event_context_generation;
+	/* Streaming mode: events are serialized as they are appended */
+	int streaming;
+	uint64_t streaming_packet_size;	/* in bits, 0 if unlimited */
+	int packet_open;
+	/* Position of the current packet's context, overwritten on close */
+	struct ctf_stream_pos packet_context_pos;
+	int packet_has_timestamp;
+	uint64_t packet_timestamp_begin, packet_timestamp_end;
+	/* Packets written by a background thread, NULL if flush is sync */
+	struct bt_ctf_stream_flush_queue *flush_queue;
+	/* Packet index file, -1 if the stream is not indexed */
+	int index_fd;
 };
 
 /* Stream class should be frozen by the caller after creating a stream */
@@ -64,4 +85,12 @@ struct bt_ctf_stream *bt_ctf_stream_create(
 BT_HIDDEN
 int bt_ctf_stream_set_fd(struct bt_ctf_stream *stream, int fd);
 
+/*
+ * Write the header of a packet index file to which an index entry is
+ * appended for each packet written to the stream. The stream owns the
+ * file descriptor on success.
+ */
+BT_HIDDEN
+int bt_ctf_stream_set_index_fd(struct bt_ctf_stream *stream, int fd);
+
 #endif /* BABELTRACE_CTF_WRITER_STREAM_INTERNAL_H */
@@ -32,6 +32,7 @@
 
 #include <babeltrace/ctf-ir/stream-class.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -90,6 +91,10 @@ extern void bt_ctf_stream_append_discarded_events(struct bt_ctf_stream *stream,
  * The stream event context will be sampled for every appended event if
  * a stream event context was defined.
  *
+ * In streaming mode (see bt_ctf_stream_enable_streaming), the event is
+ * serialized in the current packet by this call and the stream does not
+ * keep a reference to it.
+ *
  * @param stream Stream instance.
  * @param event Event instance to append to the stream's current packet.
  *
@@ -98,6 +103,87 @@ extern void bt_ctf_stream_append_discarded_events(struct bt_ctf_stream *stream,
 extern int bt_ctf_stream_append_event(struct bt_ctf_stream *stream,
 		struct bt_ctf_event *event);
 
+/*
+ * bt_ctf_stream_append_events_columnar: append events from columns of values.
+ *
+ * Serialize "count" events of class "event_class" in the stream's packets,
+ * taking the payload of the event at index i from row i of "columns". The
+ * events are serialized directly, without creating an event per row, and
+ * packets are closed once they reach the stream's packet size (see
+ * bt_ctf_stream_set_packet_size) or, in streaming mode, the streaming
+ * packet size. Events appended beforehand are flushed first, and the
+ * stream's last packet is closed on return unless the stream is in
+ * streaming mode.
+ *
+ * "columns" holds one array of values per payload field, in the order of
+ * the event class' fields. The payload fields must be integers,
+ * enumerations or floating points; an integer column holds the smallest
+ * of the 8, 16, 32 or 64-bit C integers, of the field's signedness, that
+ * can hold the field, and a floating point column holds floats if the
+ * field has the mantissa of a float, doubles otherwise. The event class
+ * must not have a context, and the stream event context, if any, is
+ * written as set for every event. An integer value or a timestamp out of
+ * the range of its field fails the append at its row, the events of the
+ * previous rows being kept.
+ *
+ * @param stream Stream instance.
+ * @param event_class Class of the events, which must belong to the stream's
+ *	class.
+ * @param count Number of events to append.
+ * @param timestamps Event header timestamps, one per event, or NULL to
+ *	sample the stream's clock. The event header's timestamp field must
+ *	be an unsigned integer.
+ * @param columns Arrays of values, one per payload field.
+ *
+ * Returns 0 on success, a negative value on error.
+ */
+extern int bt_ctf_stream_append_events_columnar(struct bt_ctf_stream *stream,
+		struct bt_ctf_event_class *event_class, size_t count,
+		const uint64_t *timestamps, const void * const *columns);
+
+/*
+ * bt_ctf_stream_enable_streaming: serialize events as they are appended.
+ *
+ * Instead of keeping the appended events until the next flush, serialize
+ * the event header, stream event context, event context and payload of
+ * each event in the stream's current packet when it is appended. The
+ * packet header and context are written when the first event of a packet
+ * is appended, and the packet context's timestamp_begin, timestamp_end,
+ * content_size and packet_size fields are updated when the packet is
+ * closed. The packet context fields must therefore be set before
+ * appending the first event of a packet.
+ *
+ * A packet is closed by bt_ctf_stream_flush, or automatically once its
+ * content reaches "packet_size" bytes, in which case the next appended
+ * event opens a new packet.
+ *
+ * Streaming must be enabled before events are appended to the stream.
+ *
+ * @param stream Stream instance.
+ * @param packet_size Content size, in bytes, at which packets are closed
+ *	automatically. 0 to close packets only on flush.
+ *
+ * Returns 0 on success, a negative value on error.
+ */
+extern int bt_ctf_stream_enable_streaming(struct bt_ctf_stream *stream,
+		uint64_t packet_size);
+
+/*
+ * bt_ctf_stream_set_packet_size: set the size of a stream's packets.
+ *
+ * Set the size, rounded up to the page size, with which the stream's
+ * packets are created. A packet is enlarged if its content does not fit,
+ * and a packet written by bt_ctf_stream_flush is sized after its events
+ * when they do not fit in the packet size.
+ *
+ * @param stream Stream instance.
+ * @param packet_size Packet size, in bytes. 0 to use the default size.
+ *
+ * Returns 0 on success, a negative value on error.
+ */
+extern int bt_ctf_stream_set_packet_size(struct bt_ctf_stream *stream,
+		uint64_t packet_size);
+
 /*
  * bt_ctf_stream_get_packet_header: get a stream's packet header.
  *
@@ -215,6 +301,42 @@ extern int bt_ctf_stream_set_event_context(
  */
 extern int bt_ctf_stream_flush(struct bt_ctf_stream *stream);
 
+/*
+ * bt_ctf_stream_enable_async_flush: write packets from a background thread.
+ *
+ * Once a packet is complete (bt_ctf_stream_flush, or a packet closed in
+ * streaming mode), hand its buffer to a thread which writes it to the
+ * stream's file while the caller fills a new packet buffer. At most
+ * "max_pending" packets may be waiting to be written; closing another
+ * packet blocks until one of them is written. The buffers of written
+ * packets are reused for the next packets, so that a stream allocates
+ * at most "max_pending" + 1 of them.
+ *
+ * The stream's packets are built in memory (see
+ * BT_CTF_WRITER_IO_MODE_PWRITE), so async flush must be enabled before
+ * the stream's first flush unless its writer already uses this I/O mode.
+ *
+ * @param stream Stream instance.
+ * @param max_pending Maximal number of packets waiting to be written.
+ *
+ * Returns 0 on success, a negative value on error.
+ */
+extern int bt_ctf_stream_enable_async_flush(struct bt_ctf_stream *stream,
+		unsigned int max_pending);
+
+/*
+ * bt_ctf_stream_flush_wait: wait for a stream's packets to be written.
+ *
+ * Block until the packets handed to the stream's flush thread are
+ * written. Returns immediately if async flush is not enabled.
+ *
+ * @param stream Stream instance.
+ *
+ * Returns 0 on success, a negative value on error, including a write
+ * error of the flush thread.
+ */
+extern int bt_ctf_stream_flush_wait(struct bt_ctf_stream *stream);
+
 /*
  * bt_ctf_stream_get and bt_ctf_stream_put: increment and decrement the
  * stream's reference count.
@@ -66,6 +66,44 @@ struct metadata_context {
 	unsigned int current_indentation_level;
 };
 
+/*
+ * Metadata already written out for a trace. Stream and event classes are
+ * frozen once in a trace, so only the classes added since the last
+ * write need to be appended, as long as the trace, environment and
+ * clock declarations did not change.
+ */
+struct bt_ctf_trace_metadata_state {
+	/* Trace, environment and clock declarations last written */
+	GString *header;
+	/* Set of the stream and event classes written */
+	GHashTable *classes;
+};
+
+BT_HIDDEN
+void bt_ctf_trace_metadata_state_init(
+		struct bt_ctf_trace_metadata_state *state);
+
+BT_HIDDEN
+void bt_ctf_trace_metadata_state_fini(
+		struct bt_ctf_trace_metadata_state *state);
+
+/* Have the next update serialize the whole metadata. */
+BT_HIDDEN
+void bt_ctf_trace_metadata_state_reset(
+		struct bt_ctf_trace_metadata_state *state);
+
+/*
+ * Serialize the declarations which were not written according to
+ * "state", and mark them as written. "full" is set if the whole
+ * metadata was serialized and replaces what was written; otherwise the
+ * returned declarations are to be appended to it.
+ *
+ * Returns a string to free with g_free, NULL on error.
+ */
+BT_HIDDEN
+char *bt_ctf_trace_get_metadata_update(struct bt_ctf_trace *trace,
+		struct bt_ctf_trace_metadata_state *state, int *full);
+
 BT_HIDDEN
 const char *get_byte_order_string(int byte_order);
 
@@ -32,7 +32,9 @@
 #include <glib.h>
 #include <dirent.h>
 #include <sys/types.h>
+#include <pthread.h>
 #include <babeltrace/ctf-ir/trace.h>
+#include <babeltrace/ctf-ir/trace-internal.h>
 #include <babeltrace/object-internal.h>
 
 struct bt_ctf_writer {
@@ -42,6 +44,15 @@ struct bt_ctf_writer {
 	GString *path;
 	int trace_dir_fd;
 	int metadata_fd;
+	/* Declarations written to the metadata file */
+	struct bt_ctf_trace_metadata_state metadata_state;
+	enum bt_ctf_writer_io_mode io_mode;
+	/*
+	 * Protects the trace against concurrent stream creation and
+	 * metadata generation. Streams are appended to and flushed
+	 * without it.
+	 */
+	pthread_mutex_t lock;
 };
 
 #endif /* BABELTRACE_CTF_WRITER_WRITER_INTERNAL_H */
@@ -42,6 +42,15 @@ struct bt_ctf_stream;
 struct bt_ctf_stream_class;
 struct bt_ctf_clock;
 
+enum bt_ctf_writer_io_mode {
+	/* Packets are memory mapped from the stream files (default). */
+	BT_CTF_WRITER_IO_MODE_MMAP = 0,
+	/* Packets are built in memory and written with pwrite(). */
+	BT_CTF_WRITER_IO_MODE_PWRITE,
+	/* Same as BT_CTF_WRITER_IO_MODE_PWRITE, bypassing the page cache. */
+	BT_CTF_WRITER_IO_MODE_PWRITE_DIRECT,
+};
+
 /*
  * bt_ctf_writer_create: create a writer instance.
  *
@@ -70,6 +79,11 @@ extern struct bt_ctf_trace *bt_ctf_writer_get_trace(
  * Allocate a new stream instance and register it to the writer. The creation of
  * a stream sets its reference count to 1.
  *
+ * Streams may be created, and the writer's metadata flushed, while other
+ * threads append events to and flush the writer's streams. Each stream
+ * must only be used by one thread at a time, and a clock shared by the
+ * stream classes of several threads must not be set concurrently.
+ *
  * @param writer Writer instance.
  * @param stream_class Stream class to instantiate.
  *
@@ -149,6 +163,23 @@ extern void bt_ctf_writer_flush_metadata(struct bt_ctf_writer *writer);
 extern int bt_ctf_writer_set_byte_order(struct bt_ctf_writer *writer,
 		enum bt_ctf_byte_order byte_order);
 
+/*
+ * bt_ctf_writer_set_io_mode: set how stream packets are written to disk.
+ *
+ * Set the I/O mode used by the streams created by this writer. Defaults to
+ * BT_CTF_WRITER_IO_MODE_MMAP. BT_CTF_WRITER_IO_MODE_PWRITE_DIRECT opens the
+ * stream files with O_DIRECT where supported and falls back to
+ * BT_CTF_WRITER_IO_MODE_PWRITE otherwise.
+ *
+ * @param writer Writer instance.
+ * @param io_mode I/O mode.
+ *
+ * Returns 0 on success, a negative value on error (e.g. a stream was
+ * already created).
+ */
+extern int bt_ctf_writer_set_io_mode(struct bt_ctf_writer *writer,
+		enum bt_ctf_writer_io_mode io_mode);
+
 /*
  * bt_ctf_writer_get and bt_ctf_writer_put: increment and decrement the
  * writer's reference count.
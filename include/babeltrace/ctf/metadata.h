@@ -33,6 +33,7 @@
 #include <babeltrace/ctf-ir/metadata.h>
 #include <babeltrace/trace-handle-internal.h>
 #include <babeltrace/context-internal.h>
+#include <babeltrace/list.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <assert.h>
@@ -44,8 +45,32 @@
 struct ctf_file_stream {
 	struct ctf_stream_definition parent;
 	struct ctf_stream_pos pos;	/* current stream position */
+
+	/* Reader resource budget (see babeltrace_max_open_files). */
+	struct bt_list_head fd_node;	/* node in open stream LRU */
+	struct bt_list_head map_node;	/* node in mapped stream LRU */
+	int fd_tracked;			/* fd_node is in the LRU */
+	int map_tracked;		/* map_node is in the LRU */
+	int fd_evicted;			/* fd closed by the budget */
+	int map_evicted;		/* packet unmapped by the budget */
+
+	int index_pending;		/* lazy open: packets left to index */
 };
 
+/*
+ * Return the fd of a stream file, reopening it if it was closed to stay
+ * within the open file budget. Returns a negative value on error.
+ */
+BT_HIDDEN
+int ctf_file_stream_get_fd(struct ctf_file_stream *file_stream);
+
+/*
+ * Index the remaining packets and create the definitions of a stream
+ * opened lazily. Does nothing if the stream is already complete.
+ */
+BT_HIDDEN
+int ctf_file_stream_load(struct ctf_file_stream *file_stream);
+
 #define HEADER_END		char end_field
 #define header_sizeof(type)	offsetof(typeof(type), end_field)
 
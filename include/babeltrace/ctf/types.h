@@ -77,16 +77,21 @@ struct ctf_stream_pos {
 	uint64_t packet_size;	/* current packet size, in bits */
 	uint64_t content_size;	/* current content size, in bits */
 	uint64_t *content_size_loc; /* pointer to current content size */
+	uint64_t next_packet_size; /* size of next written packet, in bits. 0 for default */
 	struct mmap_align *base_mma;/* mmap base address */
 	int64_t offset;		/* offset from base, in bits. EOF for end of file. */
 	int64_t last_offset;	/* offset before the last read_event */
 	int64_t data_offset;	/* offset of data in current packet */
 	uint64_t cur_index;	/* current index in packet index */
+	uint64_t readahead_index; /* reader: end of packets read ahead */
 	uint64_t last_events_discarded;	/* last known amount of event discarded */
 	void (*packet_seek)(struct bt_stream_pos *pos, size_t index,
 			int whence); /* function called to switch packet */
 
 	int dummy;		/* dummy position, for length calculation */
+	int buffered;		/* writer: packets built in memory, written with pwrite */
+	int direct;		/* writer: fd opened with O_DIRECT */
+	struct mmap_align *spare_mma; /* writer: recycled packet buffer, NULL if none */
 	struct bt_stream_callbacks *cb;	/* Callbacks registered for iterator. */
 	void *priv;
 };
@@ -131,6 +136,10 @@ void ctf_packet_seek(struct bt_stream_pos *pos, size_t index, int whence);
 int ctf_init_pos(struct ctf_stream_pos *pos, struct bt_trace_descriptor *trace,
 		int fd, int open_flags);
 int ctf_fini_pos(struct ctf_stream_pos *pos);
+BT_HIDDEN
+int ctf_pos_map_packet(struct ctf_stream_pos *pos, uint64_t packet_size);
+BT_HIDDEN
+int ctf_pos_write_packet(struct ctf_stream_pos *pos);
 
 static inline
 int ctf_pos_access_ok(struct ctf_stream_pos *pos, uint64_t bit_len)
@@ -46,20 +46,28 @@ void bt_ref_init(struct bt_ref *ref, bt_object_release_func release)
 	ref->release = release;
 }
 
+/*
+ * Reference counts are updated atomically so that objects shared by
+ * several threads (e.g. frozen stream and event classes used by streams
+ * written concurrently) can be acquired and released without locking.
+ */
 static inline
 void bt_ref_get(struct bt_ref *ref)
 {
 	assert(ref);
-	ref->count++;
+	__atomic_add_fetch(&ref->count, 1, __ATOMIC_RELAXED);
 }
 
 static inline
 void bt_ref_put(struct bt_ref *ref)
 {
+	long count;
+
 	assert(ref);
+	count = __atomic_sub_fetch(&ref->count, 1, __ATOMIC_ACQ_REL);
 	/* Only assert if the object has opted-in for reference counting. */
-	assert(!ref->release || ref->count > 0);
-	if ((--ref->count) == 0 && ref->release) {
+	assert(!ref->release || count >= 0);
+	if (count == 0 && ref->release) {
 		ref->release((struct bt_object *) ref);
 	}
 }
@@ -55,7 +55,7 @@ const char *bt_trace_handle_get_path(struct bt_context *ctx, int handle_id);
 /*
  * bt_trace_handle_get_timestamp_begin : returns the creation time (in
  * nanoseconds or cycles depending on type) of the buffers of a trace
- * or -1ULL on error.
+ * or -1ULL on error, or while streams opened lazily are not all read.
  */
 uint64_t bt_trace_handle_get_timestamp_begin(struct bt_context *ctx,
 		int handle_id, enum bt_clock_type type);
@@ -63,7 +63,7 @@ uint64_t bt_trace_handle_get_timestamp_begin(struct bt_context *ctx,
 /*
  * bt_trace_handle_get_timestamp_end : returns the destruction timestamp
  * (in nanoseconds or cycles depending on type) of the buffers of a trace
- * or -1ULL on error.
+ * or -1ULL on error, or while streams opened lazily are not all read.
  */
 uint64_t bt_trace_handle_get_timestamp_end(struct bt_context *ctx,
 		int handle_id, enum bt_clock_type type);
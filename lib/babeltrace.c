@@ -32,6 +32,11 @@
 #include <stdlib.h>
 
 int babeltrace_verbose, babeltrace_debug;
+int babeltrace_mmap_populate, babeltrace_mmap_hugepage;
+unsigned int babeltrace_readahead, babeltrace_prefetch;
+unsigned int babeltrace_max_open_files;
+uint64_t babeltrace_max_mapped_size;
+int babeltrace_lazy_open;
 
 static
 void __attribute__((constructor)) init_babeltrace_lib(void)
@@ -40,4 +45,23 @@ void __attribute__((constructor)) init_babeltrace_lib(void)
 		babeltrace_verbose = 1;
 	if (getenv("BABELTRACE_DEBUG"))
 		babeltrace_debug = 1;
+	if (getenv("BABELTRACE_MMAP_POPULATE"))
+		babeltrace_mmap_populate = 1;
+	if (getenv("BABELTRACE_MMAP_HUGEPAGE"))
+		babeltrace_mmap_hugepage = 1;
+	if (getenv("BABELTRACE_READAHEAD"))
+		babeltrace_readahead = strtoul(getenv("BABELTRACE_READAHEAD"),
+				NULL, 10);
+	if (getenv("BABELTRACE_PREFETCH"))
+		babeltrace_prefetch = strtoul(getenv("BABELTRACE_PREFETCH"),
+				NULL, 10);
+	if (getenv("BABELTRACE_MAX_OPEN_FILES"))
+		babeltrace_max_open_files =
+			strtoul(getenv("BABELTRACE_MAX_OPEN_FILES"), NULL, 10);
+	if (getenv("BABELTRACE_MAX_MAPPED_SIZE"))
+		babeltrace_max_mapped_size =
+			strtoull(getenv("BABELTRACE_MAX_MAPPED_SIZE"), NULL, 10)
+			* 1024;
+	if (getenv("BABELTRACE_LAZY_OPEN"))
+		babeltrace_lazy_open = 1;
 }
@@ -0,0 +1,77 @@
+/*
+ * bench.c
+ *
+ * Babeltrace Library - Benchmark accounting
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <babeltrace/bench-internal.h>
+#include <inttypes.h>
+
+int babeltrace_bench;
+struct bt_bench_stats babeltrace_bench_stats;
+
+static const char *phase_names[BT_BENCH_NR_PHASES] = {
+	[ BT_BENCH_PHASE_OPEN_INDEX ] = "open+index",
+	[ BT_BENCH_PHASE_METADATA ] = "metadata parse",
+	[ BT_BENCH_PHASE_PACKET_MAP ] = "packet map",
+	[ BT_BENCH_PHASE_DECODE ] = "decode",
+	[ BT_BENCH_PHASE_MERGE ] = "merge",
+	[ BT_BENCH_PHASE_OUTPUT ] = "output",
+};
+
+static
+double bench_rate(uint64_t count, uint64_t ns)
+{
+	if (!ns)
+		return 0;
+	return (double) count * 1000000000.0 / (double) ns;
+}
+
+void bt_bench_fprint(FILE *fp, const struct bt_bench_time *total)
+{
+	struct bt_bench_stats *stats = &babeltrace_bench_stats;
+	uint64_t read_ns;
+	int i;
+
+	/* Throughput of the reading loop: mapping, decoding and merging. */
+	read_ns = stats->phases[BT_BENCH_PHASE_PACKET_MAP].wall_ns
+		+ stats->phases[BT_BENCH_PHASE_DECODE].wall_ns
+		+ stats->phases[BT_BENCH_PHASE_MERGE].wall_ns;
+
+	fprintf(fp, "[bench] events:          %" PRIu64 "\n", stats->events);
+	fprintf(fp, "[bench] packets mapped:  %" PRIu64 "\n",
+		stats->packets_mapped);
+	fprintf(fp, "[bench] bytes mapped:    %" PRIu64 "\n",
+		stats->bytes_mapped);
+	fprintf(fp, "[bench] events/s:        %.0f\n",
+		bench_rate(stats->events, read_ns));
+	fprintf(fp, "[bench] bytes/s:         %.0f\n",
+		bench_rate(stats->bytes_mapped, read_ns));
+	fprintf(fp, "[bench] %-22s %12s %12s\n", "phase", "wall (ms)",
+		"cpu (ms)");
+	for (i = 0; i < BT_BENCH_NR_PHASES; i++) {
+		fprintf(fp, "[bench] %-22s %12.3f %12.3f\n", phase_names[i],
+			stats->phases[i].wall_ns / 1000000.0,
+			stats->phases[i].cpu_ns / 1000000.0);
+	}
+	fprintf(fp, "[bench] %-22s %12.3f %12.3f\n", "total",
+		total->wall_ns / 1000000.0, total->cpu_ns / 1000000.0);
+}
@@ -33,6 +33,7 @@
 #include <babeltrace/iterator-internal.h>
 #include <babeltrace/iterator.h>
 #include <babeltrace/prio_heap.h>
+#include <babeltrace/bench-internal.h>
 #include <babeltrace/ctf/metadata.h>
 #include <babeltrace/ctf/events.h>
 #include <inttypes.h>
@@ -60,9 +61,12 @@ struct bt_saved_pos {
 
 static int stream_read_event(struct ctf_file_stream *sin)
 {
+	struct bt_bench_sample sample;
 	int ret;
 
+	bt_bench_start(&sample);
 	ret = sin->pos.parent.event_cb(&sin->pos.parent, &sin->parent);
+	bt_bench_stop(BT_BENCH_PHASE_DECODE, &sample);
 	if (ret == EOF)
 		return EOF;
 	else if (ret == EAGAIN)
@@ -72,6 +76,8 @@ static int stream_read_event(struct ctf_file_stream *sin)
 		fprintf(stderr, "[error] Reading event failed.\n");
 		return ret;
 	}
+	if (babeltrace_bench)
+		babeltrace_bench_stats.events++;
 	return 0;
 }
 
@@ -120,40 +126,107 @@ void bt_iter_free_pos(struct bt_iter_pos *iter_pos)
  * are looking for (either the exact timestamp or the event just after the
  * timestamp).
  *
- * Return 0 if the seek succeded, EOF if we didn't find any packet
- * containing the timestamp, or a positive integer for error.
+ * Packets are looked up by binary search on their end timestamp, which
+ * is monotonic within a stream. If the packet found starts after "end",
+ * the stream has no event within [timestamp, end] and is not mapped at
+ * all.
  *
- * TODO: this should be turned into a binary search! It is currently
- * doing a linear search in the packets. This is a O(n) operation on a
- * very frequent code path.
+ * Return 0 if the seek succeded, EOF if we didn't find any packet
+ * containing the timestamp (or the event found is after "end"), or a
+ * positive integer for error.
  */
 static int seek_file_stream_by_timestamp(struct ctf_file_stream *cfs,
-		uint64_t timestamp)
+		uint64_t timestamp, uint64_t end)
 {
 	struct ctf_stream_pos *stream_pos;
 	struct packet_index *index;
-	int i, ret;
+	size_t low, high;
+	int ret;
 
 	stream_pos = &cfs->pos;
-	for (i = 0; i < stream_pos->packet_index->len; i++) {
+	/* A lazily opened stream is fully indexed by its first seek. */
+	if (cfs->index_pending)
+		stream_pos->packet_seek(&stream_pos->parent, 0, SEEK_SET);
+	low = 0;
+	high = stream_pos->packet_index->len;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+
 		index = &g_array_index(stream_pos->packet_index,
-				struct packet_index, i);
+				struct packet_index, mid);
 		if (index->ts_real.timestamp_end < timestamp)
-			continue;
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low == stream_pos->packet_index->len) {
+		/*
+		 * Cannot find the timestamp within the stream packets,
+		 * return EOF.
+		 */
+		return EOF;
+	}
+	index = &g_array_index(stream_pos->packet_index,
+			struct packet_index, low);
+	if (index->ts_real.timestamp_begin > end)
+		return EOF;
 
-		stream_pos->packet_seek(&stream_pos->parent, i, SEEK_SET);
-		do {
-			ret = stream_read_event(cfs);
-		} while (cfs->parent.real_timestamp < timestamp && ret == 0);
+	stream_pos->packet_seek(&stream_pos->parent, low, SEEK_SET);
+	do {
+		ret = stream_read_event(cfs);
+	} while (cfs->parent.real_timestamp < timestamp && ret == 0);
+	if (ret == 0 && cfs->parent.real_timestamp > end)
+		return EOF;
 
-		/* Can return either EOF, 0, or error (> 0). */
-		return ret;
-	}
-	/*
-	 * Cannot find the timestamp within the stream packets, return
-	 * EOF.
-	 */
-	return EOF;
+	/* Can return either EOF, 0, or error (> 0). */
+	return ret;
+}
+
+/*
+ * Return the timestamp of the iterator end position, or -1ULL if it has
+ * none.
+ */
+static uint64_t iter_end_timestamp(struct bt_iter *iter)
+{
+	if (iter->end_pos && iter->end_pos->type == BT_SEEK_TIME)
+		return iter->end_pos->u.seek_time;
+	return -1ULL;
+}
+
+/*
+ * Return true if the next event of a stream is known to be after the end
+ * timestamp. When the current packet is consumed, the beginning of the
+ * next packet is taken from the index, so that it is never mapped.
+ */
+static int stream_past_end(struct ctf_file_stream *cfs, uint64_t end)
+{
+	struct ctf_stream_pos *pos = &cfs->pos;
+	struct packet_index *index;
+
+	if (end == -1ULL || !pos->packet_index)
+		return 0;
+	if (pos->offset != pos->content_size
+			|| pos->cur_index + 1 >= pos->packet_index->len)
+		return 0;
+	index = &g_array_index(pos->packet_index, struct packet_index,
+			pos->cur_index + 1);
+	return index->ts_real.timestamp_begin > end;
+}
+
+/*
+ * Return true if a stream starts after the end timestamp. The first
+ * index entry is always known, even for lazily opened streams, so such
+ * streams are neither mapped nor loaded.
+ */
+static int stream_starts_after_end(struct ctf_file_stream *cfs, uint64_t end)
+{
+	struct ctf_stream_pos *pos = &cfs->pos;
+	struct packet_index *index;
+
+	if (end == -1ULL || !pos->packet_index || !pos->packet_index->len)
+		return 0;
+	index = &g_array_index(pos->packet_index, struct packet_index, 0);
+	return index->ts_real.timestamp_begin > end;
 }
 
 /*
@@ -166,7 +239,7 @@ static int seek_file_stream_by_timestamp(struct ctf_file_stream *cfs,
  * On other errors, return positive value.
  */
 static int seek_ctf_trace_by_timestamp(struct ctf_trace *tin,
-		uint64_t timestamp, struct ptr_heap *stream_heap)
+		uint64_t timestamp, uint64_t end, struct ptr_heap *stream_heap)
 {
 	int i, j, ret;
 	int found = 0;
@@ -188,7 +261,8 @@ static int seek_ctf_trace_by_timestamp(struct ctf_trace *tin,
 				continue;
 			cfs = container_of(stream, struct ctf_file_stream,
 					parent);
-			ret = seek_file_stream_by_timestamp(cfs, timestamp);
+			ret = seek_file_stream_by_timestamp(cfs, timestamp,
+					end);
 			if (ret == 0) {
 				/* Add to heap */
 				ret = bt_heap_insert(stream_heap, cfs);
@@ -224,6 +298,9 @@ static int find_max_timestamp_ctf_file_stream(struct ctf_file_stream *cfs,
 	struct ctf_stream_pos *stream_pos;
 
 	stream_pos = &cfs->pos;
+	/* A lazily opened stream is fully indexed by its first seek. */
+	if (cfs->index_pending)
+		stream_pos->packet_seek(&stream_pos->parent, 0, SEEK_SET);
 	/*
 	 * We start by the last packet, and iterate backwards until we
 	 * either find at least one event, or we reach the first packet
@@ -349,7 +426,8 @@ static int seek_last_ctf_trace_collection(struct trace_collection *tc,
 	if (!found) {
 		ret = EOF;
 	} else {
-		ret = seek_file_stream_by_timestamp(*cfsp, max_timestamp);
+		ret = seek_file_stream_by_timestamp(*cfsp, max_timestamp,
+				-1ULL);
 		assert(ret == 0);
 	}
 end:
@@ -446,6 +524,7 @@ int bt_iter_set_pos(struct bt_iter *iter, const struct bt_iter_pos *iter_pos)
 
 			ret = seek_ctf_trace_by_timestamp(tin,
 					iter_pos->u.seek_time,
+					iter_end_timestamp(iter),
 					iter->stream_heap);
 			/*
 			 * Positive errors are failure. Negative value
@@ -668,6 +747,7 @@ int bt_iter_add_trace(struct bt_iter *iter,
 		struct bt_trace_descriptor *td_read)
 {
 	struct ctf_trace *tin;
+	uint64_t end = iter_end_timestamp(iter);
 	int stream_id, ret = 0;
 
 	tin = container_of(td_read, struct ctf_trace, parent);
@@ -690,6 +770,8 @@ int bt_iter_add_trace(struct bt_iter *iter,
 					filenr);
 			if (!file_stream)
 				continue;
+			if (stream_starts_after_end(file_stream, end))
+				continue;
 
 			pos.type = BT_SEEK_BEGIN;
 			ret = babeltrace_filestream_seek(file_stream,
@@ -737,15 +819,22 @@ int bt_iter_init(struct bt_iter *iter,
 	if (ret < 0)
 		goto error_heap_init;
 
-	for (i = 0; i < ctx->tc->array->len; i++) {
-		struct bt_trace_descriptor *td_read;
+	/*
+	 * Any other begin position populates the heap itself: seeking
+	 * every stream to its beginning first would map packets for
+	 * nothing.
+	 */
+	if (!begin_pos || begin_pos->type == BT_SEEK_BEGIN) {
+		for (i = 0; i < ctx->tc->array->len; i++) {
+			struct bt_trace_descriptor *td_read;
 
-		td_read = g_ptr_array_index(ctx->tc->array, i);
-		if (!td_read)
-			continue;
-		ret = bt_iter_add_trace(iter, td_read);
-		if (ret < 0)
-			goto error;
+			td_read = g_ptr_array_index(ctx->tc->array, i);
+			if (!td_read)
+				continue;
+			ret = bt_iter_add_trace(iter, td_read);
+			if (ret < 0)
+				goto error;
+		}
 	}
 
 	ctx->current_iterator = iter;
@@ -804,11 +893,14 @@ void bt_iter_destroy(struct bt_iter *iter)
 int bt_iter_next(struct bt_iter *iter)
 {
 	struct ctf_file_stream *file_stream, *removed;
+	struct bt_bench_sample sample;
+	uint64_t end_timestamp;
 	int ret;
 
 	if (!iter)
 		return -EINVAL;
 
+	bt_bench_start(&sample);
 	file_stream = bt_heap_maximum(iter->stream_heap);
 	if (!file_stream) {
 		/* end of file for all streams */
@@ -816,7 +908,15 @@ int bt_iter_next(struct bt_iter *iter)
 		goto end;
 	}
 
-	ret = stream_read_event(file_stream);
+	end_timestamp = iter_end_timestamp(iter);
+	if (stream_past_end(file_stream, end_timestamp)) {
+		ret = EOF;
+	} else {
+		ret = stream_read_event(file_stream);
+		/* Stop reading this stream as soon as it passes the end. */
+		if (ret == 0 && file_stream->parent.real_timestamp > end_timestamp)
+			ret = EOF;
+	}
 	if (ret == EOF) {
 		removed = bt_heap_remove(iter->stream_heap);
 		assert(removed == file_stream);
@@ -846,5 +946,6 @@ reinsert:
 	removed = bt_heap_replace_max(iter->stream_heap, file_stream);
 	assert(removed == file_stream);
 end:
+	bt_bench_stop(BT_BENCH_PHASE_MERGE, &sample);
 	return ret;
 }
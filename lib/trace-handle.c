@@ -66,6 +66,33 @@ const char *bt_trace_handle_get_path(struct bt_context *ctx, int handle_id)
 	return handle->path;
 }
 
+/*
+ * Compute the timestamps left unknown when the trace was added, as
+ * those of streams opened lazily, which may be known by now.
+ */
+static
+void update_timestamps(struct bt_trace_handle *handle)
+{
+	struct bt_format *fmt = handle->format;
+
+	if (fmt->timestamp_begin) {
+		if (handle->real_timestamp_begin == -1ULL)
+			handle->real_timestamp_begin = fmt->timestamp_begin(
+					handle->td, handle, BT_CLOCK_REAL);
+		if (handle->cycles_timestamp_begin == -1ULL)
+			handle->cycles_timestamp_begin = fmt->timestamp_begin(
+					handle->td, handle, BT_CLOCK_CYCLES);
+	}
+	if (fmt->timestamp_end) {
+		if (handle->real_timestamp_end == -1ULL)
+			handle->real_timestamp_end = fmt->timestamp_end(
+					handle->td, handle, BT_CLOCK_REAL);
+		if (handle->cycles_timestamp_end == -1ULL)
+			handle->cycles_timestamp_end = fmt->timestamp_end(
+					handle->td, handle, BT_CLOCK_CYCLES);
+	}
+}
+
 uint64_t bt_trace_handle_get_timestamp_begin(struct bt_context *ctx,
 		int handle_id, enum bt_clock_type type)
 {
@@ -81,6 +108,7 @@ uint64_t bt_trace_handle_get_timestamp_begin(struct bt_context *ctx,
 		ret = -1ULL;
 		goto end;
 	}
+	update_timestamps(handle);
 	if (type == BT_CLOCK_REAL) {
 		ret = handle->real_timestamp_begin;
 	} else if (type == BT_CLOCK_CYCLES) {
@@ -108,6 +136,7 @@ uint64_t bt_trace_handle_get_timestamp_end(struct bt_context *ctx,
 		ret = -1ULL;
 		goto end;
 	}
+	update_timestamps(handle);
 	if (type == BT_CLOCK_REAL) {
 		ret = handle->real_timestamp_end;
 	} else if (type == BT_CLOCK_CYCLES) {
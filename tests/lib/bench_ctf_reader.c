@@ -0,0 +1,375 @@
+/*
+ * bench_ctf_reader.c
+ *
+ * Lib BabelTrace - Reader throughput benchmark
+ *
+ * Measures, for each trace given on the command line, the time taken to
+ * open and index the trace, the throughput of a full iteration, the
+ * latency of time and restore seeks and the throughput of the text
+ * output. Results are printed as JSON so that runs of different versions
+ * can be compared.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; under version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#define _GNU_SOURCE
+#include <babeltrace/babeltrace-internal.h>	/* For symbol side-effects */
+#include <babeltrace/context.h>
+#include <babeltrace/format.h>
+#include <babeltrace/iterator.h>
+#include <babeltrace/ctf/types.h>
+#include <babeltrace/ctf/iterator.h>
+#include <babeltrace/ctf/events.h>
+#include <babeltrace/ctf/events-internal.h>
+#include <babeltrace/ctf-text/types.h>
+#include <babeltrace/bench-internal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "common.h"
+
+#define DEFAULT_NR_SEEKS	100
+
+struct latency {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+static const char *phase_keys[BT_BENCH_NR_PHASES] = {
+	[ BT_BENCH_PHASE_OPEN_INDEX ] = "open_index",
+	[ BT_BENCH_PHASE_METADATA ] = "metadata",
+	[ BT_BENCH_PHASE_PACKET_MAP ] = "packet_map",
+	[ BT_BENCH_PHASE_DECODE ] = "decode",
+	[ BT_BENCH_PHASE_MERGE ] = "merge",
+	[ BT_BENCH_PHASE_OUTPUT ] = "output",
+};
+
+static
+uint64_t get_time_ns(void)
+{
+	return bt_bench_clock_ns(CLOCK_MONOTONIC);
+}
+
+static
+double rate(uint64_t count, uint64_t ns)
+{
+	return ns ? (double) count * 1000000000.0 / (double) ns : 0;
+}
+
+static
+void latency_add(struct latency *latency, uint64_t ns)
+{
+	latency->count++;
+	latency->total_ns += ns;
+	if (ns > latency->max_ns) {
+		latency->max_ns = ns;
+	}
+}
+
+static
+void print_latency(FILE *out, const char *name, struct latency *latency)
+{
+	fprintf(out, "\t\t\t\"%s\": { \"count\": %" PRIu64
+		", \"mean_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 " },\n",
+		name, latency->count,
+		latency->count ? latency->total_ns / latency->count : 0,
+		latency->max_ns);
+}
+
+static
+void print_json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') {
+			fputc('\\', out);
+		}
+		fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+/*
+ * Seek to "nr_seeks" timestamps evenly spread over [begin, last], then
+ * restore the positions reached by these seeks in reverse order. Each
+ * latency includes the read of the event found at the new position.
+ */
+static
+int bench_seeks(struct bt_ctf_iter *iter, uint64_t begin, uint64_t last,
+		unsigned int nr_seeks, struct latency *seek_time,
+		struct latency *seek_restore)
+{
+	struct bt_iter_pos **positions;
+	struct bt_iter_pos pos;
+	unsigned int i;
+	int ret = 0;
+
+	positions = calloc(nr_seeks, sizeof(*positions));
+	if (!positions) {
+		return -1;
+	}
+
+	pos.type = BT_SEEK_TIME;
+	for (i = 0; i < nr_seeks; i++) {
+		uint64_t start = get_time_ns();
+
+		pos.u.seek_time = begin + (last - begin) / (2 * nr_seeks) *
+			(2 * i + 1);
+		ret = bt_iter_set_pos(bt_ctf_get_iter(iter), &pos);
+		if (ret || !bt_ctf_iter_read_event(iter)) {
+			ret = -1;
+			goto end;
+		}
+		latency_add(seek_time, get_time_ns() - start);
+		positions[i] = bt_iter_get_pos(bt_ctf_get_iter(iter));
+	}
+
+	for (i = nr_seeks; i-- > 0;) {
+		uint64_t start = get_time_ns();
+
+		if (!positions[i]) {
+			continue;
+		}
+		ret = bt_iter_set_pos(bt_ctf_get_iter(iter), positions[i]);
+		if (ret || !bt_ctf_iter_read_event(iter)) {
+			ret = -1;
+			goto end;
+		}
+		latency_add(seek_restore, get_time_ns() - start);
+	}
+end:
+	for (i = 0; i < nr_seeks; i++) {
+		if (positions[i]) {
+			bt_iter_free_pos(positions[i]);
+		}
+	}
+	free(positions);
+	return ret;
+}
+
+/* Print the trace's events as text, to /dev/null, as babeltrace does. */
+static
+int bench_text_output(struct bt_context *ctx, uint64_t *events,
+		uint64_t *ns)
+{
+	struct bt_format *fmt_write;
+	struct bt_trace_descriptor *td_write;
+	struct ctf_text_stream_pos *sout;
+	struct bt_ctf_iter *iter;
+	struct bt_ctf_event *event;
+	uint64_t start;
+	int ret = 0;
+
+	fmt_write = bt_lookup_format(g_quark_from_static_string("text"));
+	if (!fmt_write) {
+		return -1;
+	}
+	td_write = fmt_write->open_trace("/dev/null", O_RDWR, NULL, NULL);
+	if (!td_write) {
+		return -1;
+	}
+	sout = container_of(td_write, struct ctf_text_stream_pos,
+		trace_descriptor);
+
+	iter = bt_ctf_iter_create(ctx, NULL, NULL);
+	if (!iter) {
+		ret = -1;
+		goto end;
+	}
+
+	start = get_time_ns();
+	while ((event = bt_ctf_iter_read_event(iter))) {
+		ret = sout->parent.event_cb(&sout->parent,
+			event->parent->stream);
+		if (ret) {
+			break;
+		}
+		(*events)++;
+		if (bt_iter_next(bt_ctf_get_iter(iter)) < 0) {
+			break;
+		}
+	}
+	*ns = get_time_ns() - start;
+	bt_ctf_iter_destroy(iter);
+end:
+	fmt_write->close_trace(td_write);
+	return ret;
+}
+
+static
+int bench_trace(FILE *out, const char *path, unsigned int nr_seeks,
+		int phases, int first)
+{
+	struct bt_context *ctx;
+	struct bt_ctf_iter *iter = NULL;
+	struct bt_ctf_event *event;
+	struct latency seek_time = { 0 }, seek_restore = { 0 };
+	struct bt_bench_stats iter_stats;
+	uint64_t start, open_ns, iter_ns, text_ns = 0;
+	uint64_t events = 0, text_events = 0, begin = 0, last = 0;
+	int i, ret = 0;
+
+	memset(&babeltrace_bench_stats, 0, sizeof(babeltrace_bench_stats));
+	babeltrace_bench = phases;
+
+	start = get_time_ns();
+	ctx = create_context_with_path(path);
+	open_ns = get_time_ns() - start;
+	if (!ctx) {
+		fprintf(stderr, "Cannot open trace \"%s\"\n", path);
+		return -1;
+	}
+
+	iter = bt_ctf_iter_create(ctx, NULL, NULL);
+	if (!iter) {
+		ret = -1;
+		goto end;
+	}
+
+	start = get_time_ns();
+	while ((event = bt_ctf_iter_read_event(iter))) {
+		last = bt_ctf_get_timestamp(event);
+		if (!events++) {
+			begin = last;
+		}
+		if (bt_iter_next(bt_ctf_get_iter(iter)) < 0) {
+			break;
+		}
+	}
+	iter_ns = get_time_ns() - start;
+	iter_stats = babeltrace_bench_stats;
+
+	/* Seeks and text output are not broken down into phases. */
+	babeltrace_bench = 0;
+	/* Traces without timestamps are only reported with no seeks. */
+	if (events && nr_seeks && begin != -1ULL && last != -1ULL &&
+			begin <= last) {
+		if (bench_seeks(iter, begin, last, nr_seeks, &seek_time,
+				&seek_restore)) {
+			fprintf(stderr, "Seek failed in trace \"%s\"\n", path);
+			memset(&seek_time, 0, sizeof(seek_time));
+			memset(&seek_restore, 0, sizeof(seek_restore));
+		}
+	}
+	bt_ctf_iter_destroy(iter);
+	iter = NULL;
+
+	ret = bench_text_output(ctx, &text_events, &text_ns);
+	if (ret) {
+		fprintf(stderr, "Text output failed for trace \"%s\"\n", path);
+		goto end;
+	}
+
+	fprintf(out, "%s\t\t{\n\t\t\t\"trace\": ", first ? "" : ",\n");
+	print_json_string(out, path);
+	fprintf(out, ",\n\t\t\t\"open_ns\": %" PRIu64 ",\n", open_ns);
+	fprintf(out, "\t\t\t\"iterate\": { \"events\": %" PRIu64
+		", \"ns\": %" PRIu64 ", \"events_per_s\": %.0f",
+		events, iter_ns, rate(events, iter_ns));
+	if (phases) {
+		fprintf(out, ", \"bytes_mapped\": %" PRIu64
+			", \"bytes_per_s\": %.0f, \"phases_ns\": {",
+			iter_stats.bytes_mapped,
+			rate(iter_stats.bytes_mapped, iter_ns));
+		for (i = 0; i < BT_BENCH_NR_PHASES; i++) {
+			fprintf(out, "%s \"%s\": %" PRIu64, i ? "," : "",
+				phase_keys[i], iter_stats.phases[i].wall_ns);
+		}
+		fprintf(out, " }");
+	}
+	fprintf(out, " },\n");
+	print_latency(out, "seek_time", &seek_time);
+	print_latency(out, "seek_restore", &seek_restore);
+	fprintf(out, "\t\t\t\"text\": { \"events\": %" PRIu64
+		", \"ns\": %" PRIu64 ", \"events_per_s\": %.0f }\n\t\t}",
+		text_events, text_ns, rate(text_events, text_ns));
+end:
+	if (iter) {
+		bt_ctf_iter_destroy(iter);
+	}
+	bt_context_put(ctx);
+	return ret;
+}
+
+static
+void usage(void)
+{
+	printf("Usage: bench_ctf_reader [-s NR_SEEKS] [-p] [-o FILE] TRACE...\n\n");
+	printf("Benchmark the reading of CTF traces and print the results as JSON.\n\n");
+	printf("  -s N     Number of time and restore seeks per trace (default %d)\n",
+		DEFAULT_NR_SEEKS);
+	printf("  -p       Break the iteration time down into phases\n");
+	printf("  -o FILE  Write the results to FILE instead of stdout\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_seeks = DEFAULT_NR_SEEKS;
+	int opt, i, phases = 0, failed = 0, first = 1;
+	FILE *out = stdout;
+
+	/*
+	 * Side-effects ensuring libs are not optimized away by static
+	 * linking.
+	 */
+	babeltrace_debug = 0;	/* libbabeltrace.la */
+	opt_clock_offset = 0;	/* libbabeltrace-ctf.la */
+	opt_all_field_names = 0;	/* libbabeltrace-ctf-text.la */
+
+	while ((opt = getopt(argc, argv, "s:po:h")) != -1) {
+		switch (opt) {
+		case 's':
+			nr_seeks = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			phases = 1;
+			break;
+		case 'o':
+			out = fopen(optarg, "w");
+			if (!out) {
+				perror("fopen");
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	fprintf(out, "{\n\t\"traces\": [\n");
+	for (i = optind; i < argc; i++) {
+		if (bench_trace(out, argv[i], nr_seeks, phases, first)) {
+			failed = 1;
+			continue;
+		}
+		first = 0;
+	}
+	fprintf(out, "\n\t]\n}\n");
+
+	if (out != stdout) {
+		fclose(out);
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,519 @@
+/*
+ * bench_ctf_writer.c
+ *
+ * CTF Writer throughput benchmark
+ *
+ * Generates a synthetic trace made of a configurable number of streams,
+ * event classes and payload field mixes, and reports the throughput of
+ * the event append, stream flush and metadata flush operations. The
+ * generated values only depend on the seed, making it possible to
+ * produce the same large traces to benchmark the reader against.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; under version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <babeltrace/ctf-writer/writer.h>
+#include <babeltrace/ctf-writer/clock.h>
+#include <babeltrace/ctf-writer/stream.h>
+#include <babeltrace/ctf-writer/event.h>
+#include <babeltrace/ctf-writer/event-types.h>
+#include <babeltrace/ctf-writer/event-fields.h>
+#include <babeltrace/ctf-ir/stream-class.h>
+#include <babeltrace/ref.h>
+#include <babeltrace/ctf/ctf-index.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "common.h"
+
+#define DEFAULT_NR_STREAMS		4
+#define DEFAULT_NR_EVENT_CLASSES	16
+#define DEFAULT_NR_EVENTS		100000
+#define DEFAULT_FLUSH_INTERVAL		10000
+#define DEFAULT_FIELD_MIX		"iifs"
+#define MAX_STRING_LEN			32
+#define MAX_SEQUENCE_LEN		16
+
+struct bench_options {
+	unsigned int nr_streams;
+	unsigned int nr_event_classes;
+	unsigned long nr_events;	/* per stream */
+	unsigned long flush_interval;
+	uint64_t packet_size;
+	const char *field_mix;
+	uint64_t seed;
+	const char *output_path;
+};
+
+struct bench_phase {
+	const char *name;
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t ns;
+};
+
+static
+uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*, so that the generated trace only depends on the seed */
+static
+uint64_t next_random(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ULL;
+}
+
+static
+void usage(void)
+{
+	printf("Usage: bench_ctf_writer [OPTIONS] [OUTPUT_DIR]\n\n");
+	printf("Generate a synthetic CTF trace and report the writer's throughput.\n");
+	printf("The trace is kept in OUTPUT_DIR if given, deleted otherwise.\n\n");
+	printf("  -s N     Number of streams (default %d)\n",
+		DEFAULT_NR_STREAMS);
+	printf("  -c N     Number of event classes (default %d)\n",
+		DEFAULT_NR_EVENT_CLASSES);
+	printf("  -e N     Number of events per stream (default %d)\n",
+		DEFAULT_NR_EVENTS);
+	printf("  -f N     Flush the streams every N events (default %d)\n",
+		DEFAULT_FLUSH_INTERVAL);
+	printf("  -p SIZE  Packet size, in bytes (default: writer default)\n");
+	printf("  -m MIX   Payload fields, one letter per field: i(nteger),\n");
+	printf("           f(loat), s(tring) or q (sequence) (default \"%s\")\n",
+		DEFAULT_FIELD_MIX);
+	printf("  -r SEED  Seed of the generated values (default 1)\n");
+}
+
+static
+int parse_options(int argc, char **argv, struct bench_options *opts)
+{
+	int opt;
+
+	opts->nr_streams = DEFAULT_NR_STREAMS;
+	opts->nr_event_classes = DEFAULT_NR_EVENT_CLASSES;
+	opts->nr_events = DEFAULT_NR_EVENTS;
+	opts->flush_interval = DEFAULT_FLUSH_INTERVAL;
+	opts->packet_size = 0;
+	opts->field_mix = DEFAULT_FIELD_MIX;
+	opts->seed = 1;
+	opts->output_path = NULL;
+
+	while ((opt = getopt(argc, argv, "s:c:e:f:p:m:r:h")) != -1) {
+		switch (opt) {
+		case 's':
+			opts->nr_streams = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			opts->nr_event_classes = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			opts->nr_events = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			opts->flush_interval = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			opts->packet_size = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			opts->field_mix = optarg;
+			break;
+		case 'r':
+			opts->seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (optind < argc) {
+		opts->output_path = argv[optind];
+	}
+
+	if (!opts->nr_streams || !opts->nr_event_classes ||
+			!opts->flush_interval || !opts->seed ||
+			strspn(opts->field_mix, "ifsq") !=
+			strlen(opts->field_mix)) {
+		return -1;
+	}
+	return 0;
+}
+
+static
+struct bt_ctf_event_class *create_event_class(unsigned int id,
+		const char *field_mix, struct bt_ctf_field_type **types)
+{
+	struct bt_ctf_event_class *event_class;
+	char name[64];
+	int i, ret = 0;
+
+	snprintf(name, sizeof(name), "bench_event_%u", id);
+	event_class = bt_ctf_event_class_create(name);
+	if (!event_class) {
+		goto error;
+	}
+
+	for (i = 0; field_mix[i] && !ret; i++) {
+		struct bt_ctf_field_type *type;
+
+		switch (field_mix[i]) {
+		case 'i':
+			snprintf(name, sizeof(name), "int_%d", i);
+			type = types[0];
+			break;
+		case 'f':
+			snprintf(name, sizeof(name), "float_%d", i);
+			type = types[1];
+			break;
+		case 's':
+			snprintf(name, sizeof(name), "string_%d", i);
+			type = types[2];
+			break;
+		case 'q':
+			/* The length precedes the sequence in the payload. */
+			snprintf(name, sizeof(name), "seq_%d_len", i);
+			ret = bt_ctf_event_class_add_field(event_class,
+				types[0], name);
+			type = bt_ctf_field_type_sequence_create(types[0],
+				name);
+			snprintf(name, sizeof(name), "seq_%d", i);
+			ret |= bt_ctf_event_class_add_field(event_class, type,
+				name);
+			bt_put(type);
+			continue;
+		default:
+			goto error;
+		}
+		ret = bt_ctf_event_class_add_field(event_class, type, name);
+	}
+	if (ret) {
+		goto error;
+	}
+	return event_class;
+error:
+	bt_put(event_class);
+	return NULL;
+}
+
+static
+int set_payload(struct bt_ctf_event *event, const char *field_mix,
+		uint64_t *random_state)
+{
+	struct bt_ctf_field *payload, *field = NULL, *length = NULL;
+	char string[MAX_STRING_LEN + 1];
+	int i, index = 0, ret = 0;
+
+	payload = bt_ctf_event_get_payload_field(event);
+	if (!payload) {
+		return -1;
+	}
+
+	for (i = 0; field_mix[i] && !ret; i++) {
+		uint64_t value = next_random(random_state);
+		size_t j, len;
+
+		field = bt_ctf_field_structure_get_field_by_index(payload,
+			index++);
+		switch (field_mix[i]) {
+		case 'i':
+			ret = bt_ctf_field_unsigned_integer_set_value(field,
+				(uint32_t) value);
+			break;
+		case 'f':
+			ret = bt_ctf_field_floating_point_set_value(field,
+				(double) (value % 1000000) / 1000.0);
+			break;
+		case 's':
+			len = value % (MAX_STRING_LEN + 1);
+			for (j = 0; j < len; j++) {
+				string[j] = 'a' + (next_random(random_state) % 26);
+			}
+			string[len] = '\0';
+			ret = bt_ctf_field_string_set_value(field, string);
+			break;
+		case 'q':
+			length = field;
+			field = bt_ctf_field_structure_get_field_by_index(
+				payload, index++);
+			len = value % (MAX_SEQUENCE_LEN + 1);
+			ret = bt_ctf_field_unsigned_integer_set_value(length,
+				len);
+			ret |= bt_ctf_field_sequence_set_length(field, length);
+			BT_PUT(length);
+			for (j = 0; j < len && !ret; j++) {
+				struct bt_ctf_field *element =
+					bt_ctf_field_sequence_get_field(field,
+						j);
+
+				ret = bt_ctf_field_unsigned_integer_set_value(
+					element,
+					(uint32_t) next_random(random_state));
+				bt_put(element);
+			}
+			break;
+		}
+		BT_PUT(field);
+	}
+
+	bt_put(payload);
+	return ret;
+}
+
+/* Return the number of packets listed in the packet index of a trace. */
+static
+uint64_t get_packet_count(const char *trace_path)
+{
+	DIR *dir;
+	struct dirent *entry;
+	struct stat st;
+	char *index_path;
+	struct ctf_packet_index_file_hdr header;
+	uint64_t count = 0;
+
+	if (asprintf(&index_path, "%s/index", trace_path) < 0) {
+		return 0;
+	}
+	dir = opendir(index_path);
+	free(index_path);
+	if (!dir) {
+		return 0;
+	}
+
+	while ((entry = readdir(dir))) {
+		if (!fstatat(dirfd(dir), entry->d_name, &st, 0) &&
+				S_ISREG(st.st_mode) &&
+				st.st_size >= (off_t) sizeof(header)) {
+			count += (st.st_size - sizeof(header)) /
+				sizeof(struct ctf_packet_index);
+		}
+	}
+
+	closedir(dir);
+	return count;
+}
+
+/* Return the total size of the regular files of a directory, in bytes. */
+static
+uint64_t get_files_size(const char *path, const char *name)
+{
+	DIR *dir;
+	struct dirent *entry;
+	struct stat st;
+	uint64_t size = 0;
+
+	dir = opendir(path);
+	if (!dir) {
+		return 0;
+	}
+
+	while ((entry = readdir(dir))) {
+		if (name && strcmp(entry->d_name, name)) {
+			continue;
+		}
+		if (!name && !strcmp(entry->d_name, "metadata")) {
+			continue;
+		}
+		if (!fstatat(dirfd(dir), entry->d_name, &st, 0) &&
+				S_ISREG(st.st_mode)) {
+			size += st.st_size;
+		}
+	}
+
+	closedir(dir);
+	return size;
+}
+
+static
+void print_phase(struct bench_phase *phase, const char *unit)
+{
+	double seconds = (double) phase->ns / 1000000000.0;
+
+	if (seconds <= 0) {
+		seconds = 1e-9;
+	}
+
+	printf("%-15s %12" PRIu64 " %-7s %10.3f s %14.0f %s/s %14.0f bytes/s\n",
+		phase->name, phase->count, unit, seconds,
+		(double) phase->count / seconds, unit,
+		(double) phase->bytes / seconds);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_options opts;
+	struct bt_ctf_writer *writer = NULL;
+	struct bt_ctf_clock *clock = NULL;
+	struct bt_ctf_stream_class *stream_class = NULL;
+	struct bt_ctf_event_class **event_classes = NULL;
+	struct bt_ctf_stream **streams = NULL;
+	struct bt_ctf_field_type *types[3] = { NULL };
+	struct bench_phase append = { .name = "append" },
+		flush = { .name = "flush" },
+		metadata = { .name = "metadata flush" };
+	char tmp_path[] = "/tmp/bench_ctf_writer_XXXXXX";
+	const char *trace_path;
+	uint64_t random_state, timestamp = 0, begin;
+	unsigned long i;
+	unsigned int s;
+	int ret = 0;
+
+	if (parse_options(argc, argv, &opts)) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if (opts.output_path) {
+		trace_path = opts.output_path;
+	} else {
+		trace_path = mkdtemp(tmp_path);
+		if (!trace_path) {
+			perror("mkdtemp");
+			return EXIT_FAILURE;
+		}
+	}
+
+	writer = bt_ctf_writer_create(trace_path);
+	clock = bt_ctf_clock_create("bench_clock");
+	stream_class = bt_ctf_stream_class_create("bench_stream");
+	types[0] = bt_ctf_field_type_integer_create(32);
+	types[1] = bt_ctf_field_type_floating_point_create();
+	types[2] = bt_ctf_field_type_string_create();
+	event_classes = calloc(opts.nr_event_classes, sizeof(*event_classes));
+	streams = calloc(opts.nr_streams, sizeof(*streams));
+	if (!writer || !clock || !stream_class || !types[0] || !types[1] ||
+			!types[2] || !event_classes || !streams) {
+		fprintf(stderr, "Failed to create the writer objects\n");
+		ret = -1;
+		goto end;
+	}
+
+	/* Timestamps only depend on the number of events appended. */
+	ret = bt_ctf_clock_set_time(clock, 0);
+	ret |= bt_ctf_writer_add_clock(writer, clock);
+	ret |= bt_ctf_stream_class_set_clock(stream_class, clock);
+	for (i = 0; i < opts.nr_event_classes && !ret; i++) {
+		event_classes[i] = create_event_class(i, opts.field_mix,
+			types);
+		if (!event_classes[i]) {
+			ret = -1;
+			break;
+		}
+		ret = bt_ctf_stream_class_add_event_class(stream_class,
+			event_classes[i]);
+	}
+	for (s = 0; s < opts.nr_streams && !ret; s++) {
+		streams[s] = bt_ctf_writer_create_stream(writer, stream_class);
+		if (!streams[s]) {
+			ret = -1;
+			break;
+		}
+		if (opts.packet_size) {
+			ret = bt_ctf_stream_set_packet_size(streams[s],
+				opts.packet_size);
+		}
+	}
+	if (ret) {
+		fprintf(stderr, "Failed to create the trace's schema\n");
+		goto end;
+	}
+
+	/* Events are appended to the streams in turn. */
+	random_state = opts.seed;
+	for (i = 0; i < opts.nr_events && !ret; i++) {
+		begin = get_time_ns();
+		for (s = 0; s < opts.nr_streams && !ret; s++) {
+			struct bt_ctf_event *event;
+			unsigned int id = next_random(&random_state) %
+				opts.nr_event_classes;
+
+			event = bt_ctf_event_create(event_classes[id]);
+			if (!event) {
+				ret = -1;
+				break;
+			}
+			ret = bt_ctf_clock_set_time(clock, ++timestamp);
+			ret |= set_payload(event, opts.field_mix,
+				&random_state);
+			ret |= bt_ctf_stream_append_event(streams[s], event);
+			bt_ctf_event_recycle(event);
+			append.count++;
+		}
+		append.ns += get_time_ns() - begin;
+
+		if ((i + 1) % opts.flush_interval && i + 1 != opts.nr_events) {
+			continue;
+		}
+		begin = get_time_ns();
+		for (s = 0; s < opts.nr_streams && !ret; s++) {
+			ret = bt_ctf_stream_flush(streams[s]);
+		}
+		flush.ns += get_time_ns() - begin;
+	}
+	if (ret) {
+		fprintf(stderr, "Failed to write the events\n");
+		goto end;
+	}
+
+	begin = get_time_ns();
+	bt_ctf_writer_flush_metadata(writer);
+	metadata.ns = get_time_ns() - begin;
+	metadata.count = opts.nr_event_classes;
+
+	append.bytes = flush.bytes = get_files_size(trace_path, NULL);
+	flush.count = get_packet_count(trace_path);
+	metadata.bytes = get_files_size(trace_path, "metadata");
+
+	printf("trace: %s\n", trace_path);
+	printf("streams: %u, event classes: %u, fields: \"%s\", seed: %" PRIu64 "\n",
+		opts.nr_streams, opts.nr_event_classes, opts.field_mix,
+		opts.seed);
+	print_phase(&append, "events");
+	print_phase(&flush, "packets");
+	print_phase(&metadata, "classes");
+end:
+	for (s = 0; streams && s < opts.nr_streams; s++) {
+		bt_put(streams[s]);
+	}
+	for (i = 0; event_classes && i < opts.nr_event_classes; i++) {
+		bt_put(event_classes[i]);
+	}
+	free(streams);
+	free(event_classes);
+	for (s = 0; s < 3; s++) {
+		bt_put(types[s]);
+	}
+	bt_put(stream_class);
+	bt_put(clock);
+	bt_put(writer);
+	if (!opts.output_path) {
+		delete_trace(trace_path);
+	}
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -22,6 +22,14 @@
 
 #include <babeltrace/context.h>
 #include <babeltrace/iterator.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include "common.h"
 
 struct bt_context *create_context_with_path(const char *path)
 {
@@ -40,3 +48,33 @@ struct bt_context *create_context_with_path(const char *path)
 	}
 	return ctx;
 }
+
+void delete_trace(const char *trace_path)
+{
+	DIR *trace_dir;
+	struct dirent *entry;
+
+	trace_dir = opendir(trace_path);
+	if (!trace_dir) {
+		perror("# opendir");
+		return;
+	}
+
+	while ((entry = readdir(trace_dir))) {
+		if (entry->d_type == DT_REG) {
+			unlinkat(dirfd(trace_dir), entry->d_name, 0);
+		} else if (entry->d_type == DT_DIR &&
+				!strcmp(entry->d_name, "index")) {
+			char *index_path;
+
+			if (asprintf(&index_path, "%s/index", trace_path) < 0) {
+				continue;
+			}
+			delete_trace(index_path);
+			free(index_path);
+		}
+	}
+
+	rmdir(trace_path);
+	closedir(trace_dir);
+}
@@ -25,4 +25,7 @@ struct bt_context;
 
 struct bt_context *create_context_with_path(const char *path);
 
+/* Remove a trace's files, packet index included, and its directory. */
+void delete_trace(const char *trace_path);
+
 #endif /* _TESTS_COMMON_H */
@@ -29,10 +29,17 @@
 #include <babeltrace/ctf-ir/stream-class.h>
 #include <babeltrace/ref.h>
 #include <babeltrace/ctf/events.h>
+#include <babeltrace/ctf/iterator.h>
+#include <babeltrace/context.h>
+#include <babeltrace/iterator.h>
 #include <babeltrace/values.h>
+#include <babeltrace/ctf/ctf-index.h>
+#include <babeltrace/endian.h>
+#include <babeltrace/align.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <sys/utsname.h>
 #include <babeltrace/compat/limits.h>
 #include <string.h>
@@ -40,7 +47,9 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <sys/stat.h>
 #include "tap/tap.h"
+#include "common.h"
 #include <math.h>
 #include <float.h>
 
@@ -48,6 +57,7 @@
 #define SEQUENCE_TEST_LENGTH 10
 #define ARRAY_TEST_LENGTH 5
 #define PACKET_RESIZE_TEST_LENGTH 100000
+#define STREAMING_TEST_LENGTH 10000
 
 #define DEFAULT_CLOCK_FREQ 1000000000
 #define DEFAULT_CLOCK_PRECISION 1
@@ -277,6 +287,182 @@ close_fp:
 	}
 }
 
+/* Time range and sizes of a packet, from its index entry or context. */
+struct packet_summary {
+	uint64_t timestamp_begin, timestamp_end;
+	uint64_t content_size, packet_size;
+};
+
+/*
+ * Check that the packet context of each event of a trace, as read by
+ * babeltrace, matches one of the packet index entries.
+ */
+static
+int validate_packet_contexts(const char *trace_path,
+		const struct packet_summary *packets, size_t nr_packets)
+{
+	int ret = 0;
+	size_t i = 0;
+	struct bt_context *ctx;
+	struct bt_ctf_iter *iter = NULL;
+	struct bt_ctf_event *event;
+
+	ctx = create_context_with_path(trace_path);
+	if (!ctx) {
+		return -1;
+	}
+	iter = bt_ctf_iter_create(ctx, NULL, NULL);
+	if (!iter) {
+		ret = -1;
+		goto end;
+	}
+
+	while (!ret && (event = bt_ctf_iter_read_event(iter))) {
+		const struct bt_definition *scope, *begin, *end, *content,
+			*size;
+		struct packet_summary packet;
+		size_t j;
+
+		scope = bt_ctf_get_top_level_scope(event,
+			BT_STREAM_PACKET_CONTEXT);
+		begin = bt_ctf_get_field(event, scope, "timestamp_begin");
+		end = bt_ctf_get_field(event, scope, "timestamp_end");
+		content = bt_ctf_get_field(event, scope, "content_size");
+		size = bt_ctf_get_field(event, scope, "packet_size");
+		if (begin && end && content && size) {
+			packet.timestamp_begin = bt_ctf_get_uint64(begin);
+			packet.timestamp_end = bt_ctf_get_uint64(end);
+			packet.content_size = bt_ctf_get_uint64(content);
+			packet.packet_size = bt_ctf_get_uint64(size);
+
+			/* Consecutive events mostly share their packet. */
+			for (j = 0; j < nr_packets; j++) {
+				if (!memcmp(&packets[(i + j) % nr_packets],
+						&packet, sizeof(packet))) {
+					break;
+				}
+			}
+			if (j == nr_packets) {
+				diag("No packet index entry for packet context [%" PRIu64 ", %" PRIu64 "]",
+					packet.timestamp_begin,
+					packet.timestamp_end);
+				ret = -1;
+			}
+			i = (i + j) % nr_packets;
+		}
+		if (bt_iter_next(bt_ctf_get_iter(iter)) < 0) {
+			ret = -1;
+		}
+	}
+end:
+	if (iter) {
+		bt_ctf_iter_destroy(iter);
+	}
+	bt_context_put(ctx);
+	return ret;
+}
+
+/*
+ * Check the header and size of each of a trace's packet index files, and
+ * that their entries describe contiguous packets, from the start of the
+ * stream file, whose content fits in the packet and whose time range is
+ * set. Each entry must match the packet context written in the stream.
+ */
+void validate_packet_index(const char *trace_path)
+{
+	int ret = 0, index_count = 0;
+	int index_dir_fd;
+	DIR *index_dir = NULL;
+	struct dirent *entry;
+	char *index_path = NULL;
+	struct packet_summary *packets = NULL;
+	size_t nr_packets = 0;
+
+	if (asprintf(&index_path, "%s/index", trace_path) < 0) {
+		ret = -1;
+		goto result;
+	}
+
+	index_dir = opendir(index_path);
+	if (!index_dir) {
+		perror("# opendir");
+		ret = -1;
+		goto result;
+	}
+
+	index_dir_fd = dirfd(index_dir);
+	while ((entry = readdir(index_dir)) && !ret) {
+		int fd;
+		struct stat index_stat;
+		struct ctf_packet_index_file_hdr header;
+		struct ctf_packet_index index;
+		uint64_t offset = 0;
+
+		if (entry->d_type != DT_REG) {
+			continue;
+		}
+
+		fd = openat(index_dir_fd, entry->d_name, O_RDONLY);
+		if (fd < 0) {
+			ret = -1;
+			break;
+		}
+
+		if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+			be32toh(header.magic) != CTF_INDEX_MAGIC ||
+			be32toh(header.packet_index_len) !=
+				sizeof(struct ctf_packet_index) ||
+			fstat(fd, &index_stat) ||
+			(index_stat.st_size - sizeof(header)) %
+				sizeof(struct ctf_packet_index)) {
+			diag("Invalid packet index file %s", entry->d_name);
+			ret = -1;
+		}
+		while (!ret && read(fd, &index, sizeof(index)) ==
+				sizeof(index)) {
+			struct packet_summary *packet;
+
+			packets = realloc(packets,
+				(nr_packets + 1) * sizeof(*packets));
+			if (!packets) {
+				ret = -1;
+				break;
+			}
+			packet = &packets[nr_packets++];
+			memset(packet, 0, sizeof(*packet));
+			packet->timestamp_begin = be64toh(index.timestamp_begin);
+			packet->timestamp_end = be64toh(index.timestamp_end);
+			packet->content_size = be64toh(index.content_size);
+			packet->packet_size = be64toh(index.packet_size);
+			if (be64toh(index.offset) != offset ||
+				packet->content_size > packet->packet_size ||
+				!packet->timestamp_begin ||
+				!packet->timestamp_end ||
+				packet->timestamp_begin >
+					packet->timestamp_end) {
+				diag("Invalid entry in packet index file %s",
+					entry->d_name);
+				ret = -1;
+			}
+			offset += packet->packet_size / CHAR_BIT;
+		}
+		close(fd);
+		index_count++;
+	}
+	if (!ret && nr_packets) {
+		ret = validate_packet_contexts(trace_path, packets,
+			nr_packets);
+	}
+result:
+	ok(ret == 0 && index_count > 0,
+		"The writer produced valid packet index files");
+	if (index_dir) {
+		closedir(index_dir);
+	}
+	free(packets);
+	free(index_path);
+}
+
 void event_copy_tests(struct bt_ctf_event *event)
 {
 	struct bt_ctf_event *copy;
@@ -2512,6 +2698,862 @@ end:
 	bt_put(event_header_type);
 }
 
+void test_streaming_stream(struct bt_ctf_writer *writer)
+{
+	int i, ret;
+	struct bt_ctf_trace *trace = NULL;
+	struct bt_ctf_clock *clock = NULL;
+	struct bt_ctf_stream_class *stream_class = NULL;
+	struct bt_ctf_stream *stream = NULL;
+	struct bt_ctf_field_type *integer_type = NULL;
+	struct bt_ctf_field *integer = NULL, *packet_header = NULL;
+	struct bt_ctf_event_class *event_class = NULL;
+	struct bt_ctf_event *event = NULL;
+
+	trace = bt_ctf_writer_get_trace(writer);
+	if (!trace) {
+		fail("Failed to get trace from writer");
+		goto end;
+	}
+
+	clock = bt_ctf_trace_get_clock(trace, 0);
+	if (!clock) {
+		fail("Failed to get clock from trace");
+		goto end;
+	}
+
+	stream_class = bt_ctf_stream_class_create("streaming_stream");
+	if (!stream_class) {
+		fail("Failed to create stream class");
+		goto end;
+	}
+
+	ret = bt_ctf_stream_class_set_clock(stream_class, clock);
+	if (ret) {
+		fail("Failed to set stream class clock");
+		goto end;
+	}
+
+	event_class = bt_ctf_event_class_create("streamed_event");
+	integer_type = bt_ctf_field_type_integer_create(32);
+	if (!event_class || !integer_type) {
+		fail("Failed to create event class");
+		goto end;
+	}
+
+	ret = bt_ctf_event_class_add_field(event_class, integer_type,
+		"value");
+	ret |= bt_ctf_stream_class_add_event_class(stream_class, event_class);
+	if (ret) {
+		fail("Failed to add event class to stream class");
+		goto end;
+	}
+
+	stream = bt_ctf_writer_create_stream(writer, stream_class);
+	if (!stream) {
+		fail("Failed to create stream");
+		goto end;
+	}
+
+	packet_header = bt_ctf_stream_get_packet_header(stream);
+	integer = bt_ctf_field_structure_get_field(packet_header,
+		"custom_trace_packet_header_field");
+	if (!integer ||
+		bt_ctf_field_unsigned_integer_set_value(integer, 3488)) {
+		fail("Failed to set custom_trace_packet_header_field value");
+		goto end;
+	}
+	bt_put(integer);
+	integer = NULL;
+
+	ok(bt_ctf_stream_set_packet_size(NULL, 0) < 0,
+		"bt_ctf_stream_set_packet_size handles NULL correctly");
+	ok(!bt_ctf_stream_set_packet_size(stream, 65536),
+		"Set the packet size of a stream");
+	ok(bt_ctf_stream_enable_streaming(NULL, 0) < 0,
+		"bt_ctf_stream_enable_streaming handles NULL correctly");
+	ok(!bt_ctf_stream_enable_streaming(stream, 4096),
+		"Enable streaming on a stream");
+
+	/* The same event is appended repeatedly since it is not kept. */
+	event = bt_ctf_event_create(event_class);
+	integer = bt_ctf_event_get_payload(event, "value");
+	for (i = 0; i < STREAMING_TEST_LENGTH; i++) {
+		ret = bt_ctf_clock_set_time(clock, ++current_time);
+		ret |= bt_ctf_field_unsigned_integer_set_value(integer, i);
+		ret |= bt_ctf_stream_append_event(stream, event);
+		if (ret) {
+			break;
+		}
+	}
+	ok(i == STREAMING_TEST_LENGTH,
+		"Append events to a streaming stream, reusing the same event");
+	ok(bt_ctf_stream_enable_streaming(stream, 0) == 0,
+		"Change the packet size of a streaming stream");
+	ok(bt_ctf_stream_flush(stream) == 0,
+		"Flush a streaming stream");
+	ok(bt_ctf_stream_flush(stream) == 0,
+		"Flush a streaming stream with no open packet");
+end:
+	bt_put(clock);
+	bt_put(trace);
+	bt_put(stream);
+	bt_put(stream_class);
+	bt_put(event_class);
+	bt_put(event);
+	bt_put(integer);
+	bt_put(packet_header);
+	bt_put(integer_type);
+}
+
+/*
+ * Objects shared by the stream tests: a stream class using the trace's
+ * clock, an event class to which the test adds its payload, and a stream
+ * created once both classes are set up. A fixture initialized without a
+ * writer creates its own trace in a temporary directory.
+ */
+struct stream_fixture {
+	char trace_path[64];
+	struct bt_ctf_writer *writer;
+	struct bt_ctf_trace *trace;
+	struct bt_ctf_clock *clock;
+	struct bt_ctf_stream_class *stream_class;
+	struct bt_ctf_event_class *event_class;
+	struct bt_ctf_stream *stream;
+};
+
+/*
+ * Create the fixture's classes, named after prefix. Returns 0 on
+ * success; the fixture must be released with stream_fixture_fini()
+ * either way.
+ */
+static
+int stream_fixture_init(struct stream_fixture *fixture,
+		struct bt_ctf_writer *writer, const char *prefix)
+{
+	int ret = -1;
+	char name[64];
+
+	memset(fixture, 0, sizeof(*fixture));
+	if (writer) {
+		bt_get(writer);
+		fixture->writer = writer;
+	} else {
+		snprintf(fixture->trace_path, sizeof(fixture->trace_path),
+			"/tmp/ctfwriter_%s_XXXXXX", prefix);
+		if (!mkdtemp(fixture->trace_path)) {
+			perror("# perror");
+			fixture->trace_path[0] = '\0';
+			goto end;
+		}
+		fixture->writer = bt_ctf_writer_create(fixture->trace_path);
+		if (!fixture->writer) {
+			goto end;
+		}
+	}
+
+	fixture->trace = bt_ctf_writer_get_trace(fixture->writer);
+	if (!fixture->trace) {
+		goto end;
+	}
+	if (bt_ctf_trace_get_clock_count(fixture->trace) > 0) {
+		fixture->clock = bt_ctf_trace_get_clock(fixture->trace, 0);
+	} else {
+		snprintf(name, sizeof(name), "%s_clock", prefix);
+		fixture->clock = bt_ctf_clock_create(name);
+		if (fixture->clock && bt_ctf_writer_add_clock(fixture->writer,
+				fixture->clock)) {
+			BT_PUT(fixture->clock);
+		}
+	}
+	snprintf(name, sizeof(name), "%s_stream", prefix);
+	fixture->stream_class = bt_ctf_stream_class_create(name);
+	snprintf(name, sizeof(name), "%s_event", prefix);
+	fixture->event_class = bt_ctf_event_class_create(name);
+	if (!fixture->clock || !fixture->stream_class ||
+			!fixture->event_class) {
+		goto end;
+	}
+
+	ret = bt_ctf_stream_class_set_clock(fixture->stream_class,
+		fixture->clock);
+end:
+	return ret;
+}
+
+/*
+ * Add the fixture's event class to its stream class and create the
+ * fixture's stream. Returns 0 on success.
+ */
+static
+int stream_fixture_create_stream(struct stream_fixture *fixture)
+{
+	if (bt_ctf_stream_class_add_event_class(fixture->stream_class,
+			fixture->event_class)) {
+		return -1;
+	}
+
+	fixture->stream = bt_ctf_writer_create_stream(fixture->writer,
+		fixture->stream_class);
+	return fixture->stream ? 0 : -1;
+}
+
+static
+void stream_fixture_fini(struct stream_fixture *fixture)
+{
+	bt_put(fixture->stream);
+	bt_put(fixture->event_class);
+	bt_put(fixture->stream_class);
+	bt_put(fixture->clock);
+	bt_put(fixture->trace);
+	bt_put(fixture->writer);
+	if (fixture->trace_path[0]) {
+		delete_trace(fixture->trace_path);
+	}
+}
+
+void test_event_recycling(struct bt_ctf_writer *writer)
+{
+	int i, ret = 0;
+	struct stream_fixture fixture;
+	struct bt_ctf_field_type *integer_type = NULL;
+	struct bt_ctf_field *integer = NULL;
+	struct bt_ctf_event *event = NULL, *recycled_event;
+	uint64_t value;
+
+	integer_type = bt_ctf_field_type_integer_create(32);
+	if (stream_fixture_init(&fixture, writer, "recycling") ||
+			!integer_type ||
+			bt_ctf_event_class_add_field(fixture.event_class,
+				integer_type, "value") ||
+			stream_fixture_create_stream(&fixture)) {
+		fail("Failed to set up event recycling test");
+		goto end;
+	}
+
+	event = bt_ctf_event_create(fixture.event_class);
+	integer = bt_ctf_event_get_payload(event, "value");
+	ok(integer && !bt_ctf_field_unsigned_integer_set_value(integer, 42),
+		"Set the payload of an event to recycle");
+	BT_PUT(integer);
+	recycled_event = event;
+	bt_ctf_event_recycle(event);
+	event = bt_ctf_event_create(fixture.event_class);
+	ok(event == recycled_event,
+		"bt_ctf_event_create returns a recycled event");
+	integer = bt_ctf_event_get_payload(event, "value");
+	ok(bt_ctf_field_unsigned_integer_get_value(integer, &value) < 0,
+		"The payload of a recycled event is reset");
+	BT_PUT(integer);
+	BT_PUT(event);
+
+	/* An appended event is recycled once the stream is flushed. */
+	event = bt_ctf_event_create(fixture.event_class);
+	integer = bt_ctf_event_get_payload(event, "value");
+	ret = bt_ctf_clock_set_time(fixture.clock, ++current_time);
+	ret |= bt_ctf_field_unsigned_integer_set_value(integer, 42);
+	ret |= bt_ctf_stream_append_event(fixture.stream, event);
+	BT_PUT(integer);
+	recycled_event = event;
+	bt_ctf_event_recycle(event);
+	event = NULL;
+	ok(!ret && !bt_ctf_stream_flush(fixture.stream),
+		"Append and flush an event to recycle");
+	event = bt_ctf_event_create(fixture.event_class);
+	integer = bt_ctf_event_get_payload(event, "value");
+	ok(event == recycled_event && !bt_ctf_event_get_stream(event) &&
+		bt_ctf_field_unsigned_integer_get_value(integer, &value) < 0,
+		"A flushed event is recycled with its payload reset");
+	BT_PUT(integer);
+	BT_PUT(event);
+
+	for (i = 0; i < 1000 && !ret; i++) {
+		event = bt_ctf_event_create(fixture.event_class);
+		integer = bt_ctf_event_get_payload(event, "value");
+		ret = bt_ctf_clock_set_time(fixture.clock, ++current_time);
+		ret |= bt_ctf_field_unsigned_integer_set_value(integer, i);
+		ret |= bt_ctf_stream_append_event(fixture.stream, event);
+		BT_PUT(integer);
+		bt_ctf_event_recycle(event);
+		event = NULL;
+	}
+	ok(ret == 0, "Append recycled events to a stream");
+	ok(bt_ctf_stream_flush(fixture.stream) == 0,
+		"Flush a stream of recycled events");
+end:
+	stream_fixture_fini(&fixture);
+	bt_put(event);
+	bt_put(integer);
+	bt_put(integer_type);
+}
+
+void test_payload_set_tracking(struct bt_ctf_writer *writer)
+{
+	int ret = 0;
+	struct stream_fixture fixture;
+	struct bt_ctf_field_type *uint_8_type = NULL, *enum_type = NULL,
+		*inner_type = NULL;
+	struct bt_ctf_event *event = NULL, *other_event = NULL;
+	struct bt_ctf_field *inner = NULL, *field = NULL, *container = NULL;
+
+	ret = stream_fixture_init(&fixture, writer, "tracking");
+	uint_8_type = bt_ctf_field_type_integer_create(8);
+	enum_type = bt_ctf_field_type_enumeration_create(uint_8_type);
+	inner_type = bt_ctf_field_type_structure_create();
+	if (ret || !uint_8_type || !enum_type || !inner_type) {
+		fail("Failed to create payload tracking test objects");
+		goto end;
+	}
+
+	ret = bt_ctf_field_type_enumeration_add_mapping(enum_type, "zero",
+		0, 0);
+	ret |= bt_ctf_field_type_structure_add_field(inner_type, uint_8_type,
+		"value");
+	ret |= bt_ctf_field_type_structure_add_field(inner_type, enum_type,
+		"state");
+	ret |= bt_ctf_event_class_add_field(fixture.event_class, uint_8_type,
+		"id");
+	ret |= bt_ctf_event_class_add_field(fixture.event_class, inner_type,
+		"inner");
+	if (ret || stream_fixture_create_stream(&fixture)) {
+		fail("Failed to set up payload tracking stream");
+		goto end;
+	}
+
+	event = bt_ctf_event_create(fixture.event_class);
+	other_event = bt_ctf_event_create(fixture.event_class);
+	if (!event || !other_event) {
+		fail("Failed to create events");
+		goto end;
+	}
+
+	ok(bt_ctf_stream_append_event(fixture.stream, event),
+		"An event with an unset payload is rejected");
+	field = bt_ctf_event_get_payload(event, "id");
+	ok(!bt_ctf_field_unsigned_integer_set_value(field, 1),
+		"Set a payload field");
+	BT_PUT(field);
+	inner = bt_ctf_event_get_payload(event, "inner");
+	field = bt_ctf_field_structure_get_field(inner, "value");
+	ret = bt_ctf_field_unsigned_integer_set_value(field, 2);
+	BT_PUT(field);
+	ok(!ret && bt_ctf_stream_append_event(fixture.stream, event),
+		"An event with an unset nested enumeration is rejected");
+
+	field = bt_ctf_field_structure_get_field(inner, "state");
+	container = bt_ctf_field_enumeration_get_container(field);
+	ok(!bt_ctf_field_unsigned_integer_set_value(container, 0),
+		"Set a nested enumeration");
+
+	/* A structure shared by two events is validated by walking it. */
+	ok(!bt_ctf_event_set_payload(other_event, "inner", inner),
+		"Share a structure between two events' payloads");
+	BT_PUT(field);
+	field = bt_ctf_event_get_payload(other_event, "id");
+	ret = bt_ctf_field_unsigned_integer_set_value(field, 3);
+	BT_PUT(field);
+	ok(!ret && !bt_ctf_stream_append_event(fixture.stream, other_event),
+		"A payload containing a shared structure is validated");
+	ok(!bt_ctf_stream_append_event(fixture.stream, event),
+		"An event whose payload is set once incrementally is accepted");
+	ok(!bt_ctf_stream_flush(fixture.stream),
+		"Flush a stream of incrementally set events");
+end:
+	stream_fixture_fini(&fixture);
+	bt_put(event);
+	bt_put(other_event);
+	bt_put(inner);
+	bt_put(field);
+	bt_put(container);
+	bt_put(uint_8_type);
+	bt_put(enum_type);
+	bt_put(inner_type);
+}
+
+void test_event_context_sampling(struct bt_ctf_writer *writer)
+{
+	int i, ret = 0;
+	struct stream_fixture fixture;
+	struct bt_ctf_field_type *integer_type = NULL,
+		*event_context_type = NULL;
+	struct bt_ctf_event *event = NULL;
+	struct bt_ctf_field *event_context = NULL, *field = NULL;
+
+	ret = stream_fixture_init(&fixture, writer, "sampling");
+	integer_type = bt_ctf_field_type_integer_create(32);
+	event_context_type = bt_ctf_field_type_structure_create();
+	if (ret || !integer_type || !event_context_type) {
+		fail("Failed to create event context sampling test objects");
+		goto end;
+	}
+
+	ret = bt_ctf_field_type_structure_add_field(event_context_type,
+		integer_type, "vtid");
+	ret |= bt_ctf_stream_class_set_event_context_type(fixture.stream_class,
+		event_context_type);
+	ret |= bt_ctf_event_class_add_field(fixture.event_class, integer_type,
+		"value");
+	ret |= stream_fixture_create_stream(&fixture);
+	event_context = ret ? NULL :
+		bt_ctf_stream_get_event_context(fixture.stream);
+	if (!event_context) {
+		fail("Failed to set up event context sampling stream");
+		goto end;
+	}
+
+	/* Consecutive events share the context until it is modified. */
+	for (i = 0; i < 100 && !ret; i++) {
+		if (i % 10 == 0) {
+			field = bt_ctf_field_structure_get_field(event_context,
+				"vtid");
+			ret = bt_ctf_field_unsigned_integer_set_value(field,
+				i / 10);
+			BT_PUT(field);
+		}
+
+		event = bt_ctf_event_create(fixture.event_class);
+		field = bt_ctf_event_get_payload(event, "value");
+		ret |= bt_ctf_clock_set_time(fixture.clock, ++current_time);
+		ret |= bt_ctf_field_unsigned_integer_set_value(field, i);
+		ret |= bt_ctf_stream_append_event(fixture.stream, event);
+		BT_PUT(field);
+		BT_PUT(event);
+	}
+	ok(ret == 0, "Append events sampling an unmodified event context");
+
+	BT_PUT(event_context);
+	event_context = bt_ctf_field_create(event_context_type);
+	ok(!bt_ctf_stream_set_event_context(fixture.stream, event_context),
+		"Replace a stream event context between appends");
+	event = bt_ctf_event_create(fixture.event_class);
+	field = bt_ctf_event_get_payload(event, "value");
+	ret = bt_ctf_clock_set_time(fixture.clock, ++current_time);
+	ret |= bt_ctf_field_unsigned_integer_set_value(field, i);
+	BT_PUT(field);
+	ok(!ret && bt_ctf_stream_append_event(fixture.stream, event) < 0,
+		"An unset replacement event context is not sampled");
+	field = bt_ctf_field_structure_get_field(event_context, "vtid");
+	ret = bt_ctf_field_unsigned_integer_set_value(field, 42);
+	ok(!ret && !bt_ctf_stream_append_event(fixture.stream, event),
+		"Sample a replacement event context");
+	ok(bt_ctf_stream_flush(fixture.stream) == 0,
+		"Flush a stream of events sharing an event context");
+end:
+	stream_fixture_fini(&fixture);
+	bt_put(event);
+	bt_put(event_context);
+	bt_put(field);
+	bt_put(integer_type);
+	bt_put(event_context_type);
+}
+
+void test_event_class_lookup(struct bt_ctf_writer *writer)
+{
+	int i, ret = 0;
+	struct stream_fixture fixture;
+	struct bt_ctf_field_type *integer_type = NULL, *signed_type = NULL,
+		*event_context_type = NULL, *sequence_type = NULL;
+	struct bt_ctf_event_class *event_class = NULL, *found = NULL;
+	char name[32];
+
+	ret = stream_fixture_init(&fixture, writer, "event_class_lookup");
+	integer_type = bt_ctf_field_type_integer_create(16);
+	signed_type = bt_ctf_field_type_integer_create(16);
+	event_context_type = bt_ctf_field_type_structure_create();
+	if (ret || !integer_type || !signed_type || !event_context_type) {
+		fail("Failed to create event class lookup test objects");
+		goto end;
+	}
+
+	ret = bt_ctf_field_type_integer_set_signed(signed_type, 1);
+	ret |= bt_ctf_field_type_structure_add_field(event_context_type,
+		integer_type, "len");
+	ret |= bt_ctf_field_type_structure_add_field(event_context_type,
+		signed_type, "signed_len");
+	ret |= bt_ctf_stream_class_set_event_context_type(fixture.stream_class,
+		event_context_type);
+	ret |= bt_ctf_event_class_add_field(fixture.event_class, integer_type,
+		"value");
+	/* Creating a stream freezes the stream and trace scopes. */
+	if (ret || stream_fixture_create_stream(&fixture)) {
+		fail("Failed to set up event class lookup stream");
+		goto end;
+	}
+
+	sequence_type = bt_ctf_field_type_sequence_create(integer_type,
+		"stream.event.context.len");
+	for (i = 0; i < 1000 && !ret; i++) {
+		snprintf(name, sizeof(name), "lookup_event_%d", i);
+		event_class = bt_ctf_event_class_create(name);
+		ret = bt_ctf_event_class_add_field(event_class, sequence_type,
+			"seq");
+		ret |= bt_ctf_stream_class_add_event_class(fixture.stream_class,
+			event_class);
+		BT_PUT(event_class);
+	}
+	ok(ret == 0,
+		"Add event classes sharing a stream scope sequence length");
+
+	event_class = bt_ctf_event_class_create("lookup_event_500");
+	ok(event_class && bt_ctf_stream_class_add_event_class(
+		fixture.stream_class, event_class),
+		"Reject an event class named after an existing one");
+	BT_PUT(event_class);
+
+	event_class = bt_ctf_event_class_create("lookup_event_by_id");
+	ok(event_class && !bt_ctf_event_class_set_id(event_class, 500) &&
+		bt_ctf_stream_class_add_event_class(fixture.stream_class,
+		event_class),
+		"Reject an event class with the ID of an existing one");
+	BT_PUT(event_class);
+
+	event_class = bt_ctf_stream_class_get_event_class_by_name(
+		fixture.stream_class, "lookup_event_500");
+	found = bt_ctf_stream_class_get_event_class_by_id(fixture.stream_class,
+		bt_ctf_event_class_get_id(event_class));
+	ok(event_class && event_class == found,
+		"Look up an event class by name and by ID");
+	BT_PUT(event_class);
+	BT_PUT(found);
+
+	BT_PUT(sequence_type);
+	sequence_type = bt_ctf_field_type_sequence_create(integer_type,
+		"stream.event.context.signed_len");
+	event_class = bt_ctf_event_class_create("signed_path_event");
+	ret = bt_ctf_event_class_add_field(event_class, sequence_type, "seq");
+	ok(!ret && bt_ctf_stream_class_add_event_class(fixture.stream_class,
+		event_class),
+		"Reject a signed sequence length in the stream scope");
+	BT_PUT(event_class);
+	ok(!bt_ctf_stream_class_get_event_class_by_name(fixture.stream_class,
+		"signed_path_event"),
+		"A rejected event class is not added to the stream class");
+end:
+	stream_fixture_fini(&fixture);
+	bt_put(event_class);
+	bt_put(found);
+	bt_put(integer_type);
+	bt_put(signed_type);
+	bt_put(event_context_type);
+	bt_put(sequence_type);
+}
+
+void test_columnar_append(struct bt_ctf_writer *writer)
+{
+	int ret = 0;
+	size_t i;
+	struct stream_fixture fixture;
+	struct bt_ctf_field_type *uint_16_type = NULL, *int_64_type = NULL,
+		*float_type = NULL, *string_type = NULL, *uint_12_type = NULL,
+		*int_5_type = NULL;
+	struct bt_ctf_event_class *string_event_class = NULL,
+		*other_event_class = NULL, *narrow_event_class = NULL;
+	uint64_t timestamps[1000];
+	uint16_t ids[1000];
+	int64_t offsets[1000];
+	double values[1000];
+	const void *columns[] = { ids, offsets, values };
+	uint16_t narrow_ids[4] = { 0, 1, 4095, 0 };
+	int8_t narrow_offsets[4] = { -16, 15, 0, 0 };
+	const void *narrow_columns[] = { narrow_ids, narrow_offsets };
+
+	ret = stream_fixture_init(&fixture, writer, "columnar");
+	string_event_class = bt_ctf_event_class_create("columnar_string_event");
+	other_event_class = bt_ctf_event_class_create("columnar_other_event");
+	narrow_event_class = bt_ctf_event_class_create(
+		"columnar_narrow_event");
+	uint_16_type = bt_ctf_field_type_integer_create(16);
+	uint_12_type = bt_ctf_field_type_integer_create(12);
+	int_5_type = bt_ctf_field_type_integer_create(5);
+	int_64_type = bt_ctf_field_type_integer_create(64);
+	float_type = bt_ctf_field_type_floating_point_create();
+	string_type = bt_ctf_field_type_string_create();
+	if (ret || !string_event_class || !other_event_class ||
+			!narrow_event_class || !uint_16_type || !int_64_type ||
+			!float_type || !string_type || !uint_12_type ||
+			!int_5_type) {
+		fail("Failed to create columnar append test objects");
+		goto end;
+	}
+
+	ret = bt_ctf_field_type_integer_set_signed(int_64_type, 1);
+	ret |= bt_ctf_field_type_floating_point_set_exponent_digits(
+		float_type, 11);
+	ret |= bt_ctf_field_type_floating_point_set_mantissa_digits(
+		float_type, 53);
+	ret |= bt_ctf_event_class_add_field(fixture.event_class, uint_16_type,
+		"id");
+	ret |= bt_ctf_event_class_add_field(fixture.event_class, int_64_type,
+		"offset");
+	ret |= bt_ctf_event_class_add_field(fixture.event_class, float_type,
+		"value");
+	ret |= bt_ctf_event_class_add_field(string_event_class, string_type,
+		"name");
+	ret |= bt_ctf_stream_class_add_event_class(fixture.stream_class,
+		string_event_class);
+	ret |= bt_ctf_field_type_integer_set_signed(int_5_type, 1);
+	ret |= bt_ctf_event_class_add_field(narrow_event_class, uint_12_type,
+		"id");
+	ret |= bt_ctf_event_class_add_field(narrow_event_class, int_5_type,
+		"offset");
+	ret |= bt_ctf_stream_class_add_event_class(fixture.stream_class,
+		narrow_event_class);
+	if (ret || stream_fixture_create_stream(&fixture)) {
+		fail("Failed to set up columnar append stream");
+		goto end;
+	}
+
+	for (i = 0; i < 1000; i++) {
+		timestamps[i] = ++current_time;
+		ids[i] = i;
+		offsets[i] = -((int64_t) i << 40);
+		values[i] = i * 0.5;
+	}
+
+	ok(bt_ctf_stream_append_events_columnar(NULL, fixture.event_class,
+		1000, timestamps, columns),
+		"bt_ctf_stream_append_events_columnar handles a NULL stream correctly");
+	ok(bt_ctf_stream_append_events_columnar(fixture.stream, NULL, 1000,
+		timestamps, columns),
+		"bt_ctf_stream_append_events_columnar handles a NULL event class correctly");
+	ok(bt_ctf_stream_append_events_columnar(fixture.stream,
+		fixture.event_class, 1000, timestamps, NULL),
+		"bt_ctf_stream_append_events_columnar handles NULL columns correctly");
+	ok(bt_ctf_stream_append_events_columnar(fixture.stream,
+		other_event_class, 1000, timestamps, columns),
+		"bt_ctf_stream_append_events_columnar rejects an event class of another stream class");
+	ok(bt_ctf_stream_append_events_columnar(fixture.stream,
+		string_event_class, 1000, timestamps, columns),
+		"bt_ctf_stream_append_events_columnar rejects non-scalar payload fields");
+
+	ok(bt_ctf_stream_set_packet_size(fixture.stream, 4096) == 0,
+		"Set the packet size of a columnar stream");
+	ok(bt_ctf_stream_append_events_columnar(fixture.stream,
+		fixture.event_class, 1000, timestamps, columns) == 0,
+		"Append events from columns of values");
+	ok(bt_ctf_stream_flush(fixture.stream) == 0,
+		"Flush a stream after a columnar append");
+
+	ok(bt_ctf_stream_append_events_columnar(fixture.stream,
+		narrow_event_class, 4, NULL, narrow_columns) == 0,
+		"Append columns of values which fit in their fields");
+	narrow_ids[3] = 4096;
+	ok(bt_ctf_stream_append_events_columnar(fixture.stream,
+		narrow_event_class, 4, NULL, narrow_columns) < 0,
+		"bt_ctf_stream_append_events_columnar rejects an unsigned value out of range");
+	narrow_ids[3] = 0;
+	narrow_offsets[3] = -17;
+	ok(bt_ctf_stream_append_events_columnar(fixture.stream,
+		narrow_event_class, 4, NULL, narrow_columns) < 0,
+		"bt_ctf_stream_append_events_columnar rejects a signed value out of range");
+	narrow_offsets[3] = 16;
+	ok(bt_ctf_stream_append_events_columnar(fixture.stream,
+		narrow_event_class, 4, NULL, narrow_columns) < 0,
+		"bt_ctf_stream_append_events_columnar rejects a signed value out of range");
+end:
+	stream_fixture_fini(&fixture);
+	bt_put(string_event_class);
+	bt_put(other_event_class);
+	bt_put(narrow_event_class);
+	bt_put(uint_16_type);
+	bt_put(int_64_type);
+	bt_put(float_type);
+	bt_put(string_type);
+	bt_put(uint_12_type);
+	bt_put(int_5_type);
+}
+
+/*
+ * Timestamps appended from a column are checked against the size of the
+ * event header's timestamp field, here a compact 27-bit one.
+ */
+void test_columnar_timestamp_range(struct bt_ctf_writer *writer)
+{
+	int ret;
+	struct stream_fixture fixture;
+	struct bt_ctf_field_type *event_header_type = NULL,
+		*id_type = NULL, *timestamp_type = NULL;
+	uint64_t timestamps[2];
+	uint32_t values[2] = { 1, 2 };
+	const void *columns[] = { values };
+
+	ret = stream_fixture_init(&fixture, writer, "columnar_timestamp");
+	event_header_type = bt_ctf_field_type_structure_create();
+	id_type = bt_ctf_field_type_integer_create(32);
+	timestamp_type = bt_ctf_field_type_integer_create(27);
+	if (ret || !event_header_type || !id_type || !timestamp_type) {
+		fail("Failed to create columnar timestamp test objects");
+		goto end;
+	}
+
+	ret = bt_ctf_field_type_integer_set_mapped_clock(timestamp_type,
+		fixture.clock);
+	ret |= bt_ctf_field_type_structure_add_field(event_header_type,
+		id_type, "id");
+	ret |= bt_ctf_field_type_structure_add_field(event_header_type,
+		timestamp_type, "timestamp");
+	ret |= bt_ctf_stream_class_set_event_header_type(fixture.stream_class,
+		event_header_type);
+	ret |= bt_ctf_event_class_add_field(fixture.event_class, id_type,
+		"value");
+	if (ret || stream_fixture_create_stream(&fixture)) {
+		fail("Failed to set up columnar timestamp stream");
+		goto end;
+	}
+
+	timestamps[0] = ++current_time;
+	timestamps[1] = 1ULL << 27;
+	ok(bt_ctf_stream_append_events_columnar(fixture.stream,
+		fixture.event_class, 2, timestamps, columns) < 0,
+		"bt_ctf_stream_append_events_columnar rejects a timestamp out of range");
+	timestamps[0] = ++current_time;
+	timestamps[1] = ++current_time;
+	ok(bt_ctf_stream_append_events_columnar(fixture.stream,
+		fixture.event_class, 2, timestamps, columns) == 0,
+		"Append timestamps which fit in the event header's field");
+end:
+	stream_fixture_fini(&fixture);
+	bt_put(event_header_type);
+	bt_put(id_type);
+	bt_put(timestamp_type);
+}
+
+/*
+ * Payloads made of floats, nested structures and arrays are serialized
+ * with a compiled flat layout, except for floats whose mantissa and
+ * exponent sizes do not match a native type, which fall back on the
+ * generic serializer. The trace is read back by validate_trace().
+ */
+void test_flat_layout(struct bt_ctf_writer *writer)
+{
+	int ret = 0;
+	size_t i, j;
+	struct stream_fixture fixture;
+	struct bt_ctf_field_type *uint_8_type = NULL, *float_type = NULL,
+		*double_type = NULL, *mixed_float_type = NULL,
+		*float_array_type = NULL, *inner_type = NULL,
+		*inner_array_type = NULL, *outer_type = NULL;
+
+	ret = stream_fixture_init(&fixture, writer, "flat_layout");
+	uint_8_type = bt_ctf_field_type_integer_create(8);
+	float_type = bt_ctf_field_type_floating_point_create();
+	double_type = bt_ctf_field_type_floating_point_create();
+	mixed_float_type = bt_ctf_field_type_floating_point_create();
+	inner_type = bt_ctf_field_type_structure_create();
+	outer_type = bt_ctf_field_type_structure_create();
+	if (ret || !uint_8_type || !float_type || !double_type ||
+			!mixed_float_type || !inner_type || !outer_type) {
+		fail("Failed to create flat layout test objects");
+		goto end;
+	}
+
+	ret = bt_ctf_field_type_floating_point_set_exponent_digits(
+		double_type, 11);
+	ret |= bt_ctf_field_type_floating_point_set_mantissa_digits(
+		double_type, 53);
+	/* Double exponent with a float mantissa: 36 bits. */
+	ret |= bt_ctf_field_type_floating_point_set_exponent_digits(
+		mixed_float_type, 11);
+	ret |= bt_ctf_field_type_floating_point_set_mantissa_digits(
+		mixed_float_type, 24);
+	float_array_type = bt_ctf_field_type_array_create(float_type, 3);
+	inner_array_type = bt_ctf_field_type_array_create(inner_type, 2);
+	if (ret || !float_array_type || !inner_array_type) {
+		fail("Failed to set up flat layout field types");
+		goto end;
+	}
+
+	ret = bt_ctf_field_type_structure_add_field(inner_type, uint_8_type,
+		"tag");
+	ret |= bt_ctf_field_type_structure_add_field(inner_type, double_type,
+		"value");
+	ret |= bt_ctf_field_type_structure_add_field(inner_type,
+		float_array_type, "samples");
+	ret |= bt_ctf_field_type_structure_add_field(outer_type, uint_8_type,
+		"count");
+	ret |= bt_ctf_field_type_structure_add_field(outer_type,
+		inner_array_type, "inner");
+	ret |= bt_ctf_event_class_add_field(fixture.event_class, outer_type,
+		"flat");
+	ret |= bt_ctf_event_class_add_field(fixture.event_class,
+		mixed_float_type, "mixed");
+	ret |= bt_ctf_event_class_add_field(fixture.event_class, float_type,
+		"single");
+	if (ret || stream_fixture_create_stream(&fixture)) {
+		fail("Failed to set up flat layout stream");
+		goto end;
+	}
+
+	for (i = 0; i < 100 && !ret; i++) {
+		struct bt_ctf_event *event =
+			bt_ctf_event_create(fixture.event_class);
+		struct bt_ctf_field *flat = NULL, *count = NULL,
+			*inner_array = NULL, *mixed = NULL, *single = NULL;
+
+		if (!event) {
+			ret = -1;
+			break;
+		}
+		flat = bt_ctf_event_get_payload(event, "flat");
+		count = bt_ctf_field_structure_get_field(flat, "count");
+		inner_array = bt_ctf_field_structure_get_field(flat, "inner");
+		mixed = bt_ctf_event_get_payload(event, "mixed");
+		single = bt_ctf_event_get_payload(event, "single");
+		ret = bt_ctf_field_unsigned_integer_set_value(count, 2);
+		ret |= bt_ctf_field_floating_point_set_value(mixed, i * 0.25);
+		ret |= bt_ctf_field_floating_point_set_value(single, -1.0 * i);
+		for (j = 0; j < 2 && !ret; j++) {
+			struct bt_ctf_field *inner, *tag, *value, *samples,
+				*sample;
+			size_t k;
+
+			inner = bt_ctf_field_array_get_field(inner_array, j);
+			tag = bt_ctf_field_structure_get_field(inner, "tag");
+			value = bt_ctf_field_structure_get_field(inner, "value");
+			samples = bt_ctf_field_structure_get_field(inner,
+				"samples");
+			ret = bt_ctf_field_unsigned_integer_set_value(tag, j);
+			ret |= bt_ctf_field_floating_point_set_value(value,
+				i / 3.0);
+			for (k = 0; k < 3 && !ret; k++) {
+				sample = bt_ctf_field_array_get_field(samples, k);
+				ret = bt_ctf_field_floating_point_set_value(sample,
+					k + 0.5);
+				bt_put(sample);
+			}
+			bt_put(samples);
+			bt_put(value);
+			bt_put(tag);
+			bt_put(inner);
+		}
+		if (!ret) {
+			ret = bt_ctf_clock_set_time(fixture.clock, ++current_time);
+			ret |= bt_ctf_stream_append_event(fixture.stream,
+				event);
+		}
+		bt_put(single);
+		bt_put(mixed);
+		bt_put(inner_array);
+		bt_put(count);
+		bt_put(flat);
+		bt_put(event);
+	}
+	ok(ret == 0,
+		"Append events with floats, nested structures and arrays");
+	ok(bt_ctf_stream_flush(fixture.stream) == 0,
+		"Flush a stream of fixed-layout events");
+end:
+	stream_fixture_fini(&fixture);
+	bt_put(uint_8_type);
+	bt_put(float_type);
+	bt_put(double_type);
+	bt_put(mixed_float_type);
+	bt_put(float_array_type);
+	bt_put(inner_type);
+	bt_put(inner_array_type);
+	bt_put(outer_type);
+}
+
 void test_instanciate_event_before_stream(struct bt_ctf_writer *writer)
 {
 	int ret = 0;
@@ -2628,6 +3670,329 @@ end:
 	bt_put(clock);
 }
 
+/* Read a whole file in a NUL-terminated buffer to free. */
+static
+char *get_file_contents(const char *path)
+{
+	FILE *fp;
+	long size;
+	char *contents = NULL;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		goto end;
+	}
+
+	if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0 ||
+		fseek(fp, 0, SEEK_SET)) {
+		goto end;
+	}
+
+	contents = calloc(size + 1, 1);
+	if (contents && fread(contents, 1, size, fp) != size) {
+		free(contents);
+		contents = NULL;
+	}
+end:
+	if (fp) {
+		fclose(fp);
+	}
+	return contents;
+}
+
+void test_metadata_append(void)
+{
+	int ret;
+	char *metadata_path = NULL;
+	char *metadata_string = NULL;
+	char *first_metadata = NULL, *appended_metadata = NULL,
+		*rewritten_metadata = NULL;
+	struct stream_fixture fixture;
+	struct bt_ctf_field_type *integer_type = NULL;
+	struct bt_ctf_event_class *added_event_class = NULL;
+
+	ret = stream_fixture_init(&fixture, NULL, "metadata");
+	added_event_class = bt_ctf_event_class_create("added_event");
+	integer_type = bt_ctf_field_type_integer_create(32);
+	if (ret || !added_event_class || !integer_type ||
+			asprintf(&metadata_path, "%s/metadata",
+				fixture.trace_path) < 0) {
+		fail("Failed to create metadata append test objects");
+		goto end;
+	}
+
+	ret = bt_ctf_event_class_add_field(fixture.event_class, integer_type,
+		"value");
+	ret |= bt_ctf_event_class_add_field(added_event_class, integer_type,
+		"value");
+	if (ret || stream_fixture_create_stream(&fixture)) {
+		fail("Failed to set up metadata append test stream");
+		goto end;
+	}
+
+	bt_ctf_writer_flush_metadata(fixture.writer);
+	first_metadata = get_file_contents(metadata_path);
+	ok(first_metadata && strstr(first_metadata, "metadata_event"),
+		"Write the metadata of a trace");
+
+	ok(bt_ctf_stream_class_add_event_class(fixture.stream_class,
+		added_event_class) == 0,
+		"Add an event class after the metadata was written");
+	bt_ctf_writer_flush_metadata(fixture.writer);
+	appended_metadata = get_file_contents(metadata_path);
+	ok(first_metadata && appended_metadata &&
+		!strncmp(first_metadata, appended_metadata,
+			strlen(first_metadata)) &&
+		strstr(appended_metadata + strlen(first_metadata),
+			"added_event") &&
+		!strstr(appended_metadata + strlen(first_metadata),
+			"metadata_event"),
+		"Only the new event class is appended to the metadata");
+	metadata_string = bt_ctf_writer_get_metadata_string(fixture.writer);
+	ok(metadata_string && appended_metadata &&
+		!strcmp(metadata_string, appended_metadata),
+		"The appended metadata matches the trace's metadata");
+	free(metadata_string);
+
+	ok(bt_ctf_writer_add_environment_field(fixture.writer, "added_field",
+		"value") == 0,
+		"Add an environment field after the metadata was written");
+	bt_ctf_writer_flush_metadata(fixture.writer);
+	rewritten_metadata = get_file_contents(metadata_path);
+	metadata_string = bt_ctf_writer_get_metadata_string(fixture.writer);
+	ok(metadata_string && rewritten_metadata &&
+		!strcmp(metadata_string, rewritten_metadata),
+		"The metadata is rewritten when the environment changes");
+	free(metadata_string);
+end:
+	free(first_metadata);
+	free(appended_metadata);
+	free(rewritten_metadata);
+	free(metadata_path);
+	bt_put(added_event_class);
+	bt_put(integer_type);
+	stream_fixture_fini(&fixture);
+}
+
+void test_pwrite_io_mode(char *parser_path)
+{
+	int i, ret;
+	struct stream_fixture fixture;
+	struct bt_ctf_stream *async_stream = NULL;
+	struct bt_ctf_field_type *integer_type = NULL;
+
+	ret = stream_fixture_init(&fixture, NULL, "pwrite");
+	integer_type = bt_ctf_field_type_integer_create(32);
+	if (ret || !integer_type) {
+		fail("Failed to create pwrite test objects");
+		goto end;
+	}
+
+	ok(bt_ctf_writer_set_io_mode(fixture.writer,
+		BT_CTF_WRITER_IO_MODE_PWRITE) == 0,
+		"Set a writer's I/O mode to pwrite");
+
+	ret = bt_ctf_event_class_add_field(fixture.event_class, integer_type,
+		"value");
+	ret |= stream_fixture_create_stream(&fixture);
+	async_stream = ret ? NULL : bt_ctf_writer_create_stream(
+		fixture.writer, fixture.stream_class);
+	if (!async_stream) {
+		fail("Failed to create pwrite test streams");
+		goto end;
+	}
+
+	ok(bt_ctf_stream_enable_async_flush(NULL, 2) < 0,
+		"bt_ctf_stream_enable_async_flush handles NULL correctly");
+	ok(bt_ctf_stream_enable_async_flush(async_stream, 0) < 0,
+		"bt_ctf_stream_enable_async_flush rejects an empty queue");
+	ok(bt_ctf_stream_enable_async_flush(async_stream, 2) == 0,
+		"Enable async flush on a stream");
+	ok(bt_ctf_stream_enable_async_flush(async_stream, 2) < 0,
+		"bt_ctf_stream_enable_async_flush fails if already enabled");
+	ok(bt_ctf_stream_flush_wait(NULL) < 0,
+		"bt_ctf_stream_flush_wait handles NULL correctly");
+	ok(bt_ctf_stream_flush_wait(fixture.stream) == 0,
+		"bt_ctf_stream_flush_wait succeeds on a synchronous stream");
+
+	/* Packets are large enough to be resized in memory. */
+	for (i = 0, ret = 0; i < PACKET_RESIZE_TEST_LENGTH && !ret; i++) {
+		struct bt_ctf_stream *streams[] = {
+			fixture.stream, async_stream
+		};
+		int j;
+
+		ret = bt_ctf_clock_set_time(fixture.clock, i + 1);
+		for (j = 0; j < 2 && !ret; j++) {
+			struct bt_ctf_event *event =
+				bt_ctf_event_create(fixture.event_class);
+			struct bt_ctf_field *integer =
+				bt_ctf_event_get_payload_by_index(event, 0);
+
+			ret = bt_ctf_field_unsigned_integer_set_value(integer,
+				i);
+			ret |= bt_ctf_stream_append_event(streams[j], event);
+			bt_put(integer);
+			bt_put(event);
+		}
+		if (!ret && i % 10000 == 0) {
+			ret = bt_ctf_stream_flush(fixture.stream);
+			ret |= bt_ctf_stream_flush(async_stream);
+		}
+	}
+	ok(ret == 0, "Append events to pwrite streams");
+	ok(bt_ctf_stream_flush(fixture.stream) == 0, "Flush a pwrite stream");
+	ok(bt_ctf_stream_flush(async_stream) == 0,
+		"Flush a stream asynchronously");
+	ok(bt_ctf_stream_flush_wait(async_stream) == 0,
+		"Wait for a stream's asynchronous flush");
+
+	bt_ctf_writer_flush_metadata(fixture.writer);
+	validate_trace(parser_path, fixture.trace_path);
+	validate_packet_index(fixture.trace_path);
+end:
+	bt_put(async_stream);
+	bt_put(integer_type);
+	stream_fixture_fini(&fixture);
+}
+
+/*
+ * Read the packet index entries of a trace made of a single stream.
+ * Returns the number of entries read, -1 on error.
+ */
+static
+int read_single_stream_index(const char *trace_path,
+		struct ctf_packet_index *entries, int max_entries)
+{
+	int ret = -1, fd = -1;
+	DIR *index_dir = NULL;
+	struct dirent *entry;
+	char *index_path = NULL;
+	struct ctf_packet_index_file_hdr header;
+
+	if (asprintf(&index_path, "%s/index", trace_path) < 0) {
+		goto end;
+	}
+	index_dir = opendir(index_path);
+	if (!index_dir) {
+		goto end;
+	}
+	while ((entry = readdir(index_dir))) {
+		if (entry->d_type == DT_REG) {
+			fd = openat(dirfd(index_dir), entry->d_name, O_RDONLY);
+			break;
+		}
+	}
+	if (fd < 0 || read(fd, &header, sizeof(header)) != sizeof(header)) {
+		goto end;
+	}
+	for (ret = 0; ret < max_entries; ret++) {
+		if (read(fd, &entries[ret], sizeof(entries[ret])) !=
+				sizeof(entries[ret])) {
+			break;
+		}
+	}
+end:
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (index_dir) {
+		closedir(index_dir);
+	}
+	free(index_path);
+	return ret;
+}
+
+/*
+ * A flushed packet is created at the stream's packet size and enlarged
+ * once, to the page-aligned size of its content, when its events do not
+ * fit. The packet context holds a string, so that it is not serialized
+ * with a flat layout.
+ */
+void test_packet_sizing(char *parser_path)
+{
+	int i, ret, nr_entries;
+	struct stream_fixture fixture;
+	struct bt_ctf_field_type *integer_type = NULL, *string_type = NULL,
+		*packet_context_type = NULL;
+	struct bt_ctf_field *packet_context = NULL, *note = NULL;
+	struct ctf_packet_index entries[3];
+	const uint64_t packet_size = PAGE_SIZE * CHAR_BIT;
+
+	ret = stream_fixture_init(&fixture, NULL, "sizing");
+	integer_type = bt_ctf_field_type_integer_create(64);
+	string_type = bt_ctf_field_type_string_create();
+	if (ret || !integer_type || !string_type) {
+		fail("Failed to create packet sizing test objects");
+		goto end;
+	}
+
+	packet_context_type = bt_ctf_stream_class_get_packet_context_type(
+		fixture.stream_class);
+	ret = !packet_context_type;
+	ret |= bt_ctf_field_type_structure_add_field(packet_context_type,
+		string_type, "note");
+	ret |= bt_ctf_event_class_add_field(fixture.event_class, integer_type,
+		"value");
+	ret |= stream_fixture_create_stream(&fixture);
+	packet_context = ret ? NULL :
+		bt_ctf_stream_get_packet_context(fixture.stream);
+	note = packet_context ?
+		bt_ctf_field_structure_get_field(packet_context, "note") :
+		NULL;
+	if (!note || bt_ctf_field_string_set_value(note, "sizing") ||
+			bt_ctf_stream_set_packet_size(fixture.stream,
+				PAGE_SIZE)) {
+		fail("Failed to set up packet sizing stream");
+		goto end;
+	}
+
+	/* Events of the first packet take several pages. */
+	for (i = 0, ret = 0; i < 2000 && !ret; i++) {
+		struct bt_ctf_event *event =
+			bt_ctf_event_create(fixture.event_class);
+		struct bt_ctf_field *integer =
+			bt_ctf_event_get_payload_by_index(event, 0);
+
+		ret = bt_ctf_clock_set_time(fixture.clock, ++current_time);
+		ret |= bt_ctf_field_unsigned_integer_set_value(integer, i);
+		ret |= bt_ctf_stream_append_event(fixture.stream, event);
+		bt_put(integer);
+		bt_put(event);
+		if (!ret && i == 1998) {
+			ret = bt_ctf_stream_flush(fixture.stream);
+		}
+	}
+	ok(ret == 0, "Append events to a stream with a non-flat packet context");
+	ok(bt_ctf_stream_flush(fixture.stream) == 0,
+		"Flush a packet with a non-flat packet context");
+
+	nr_entries = read_single_stream_index(fixture.trace_path, entries, 3);
+	ok(nr_entries == 2, "Flushes wrote one packet each");
+	if (nr_entries == 2) {
+		uint64_t size = be64toh(entries[0].packet_size);
+		uint64_t content = be64toh(entries[0].content_size);
+
+		ok(content > packet_size && size >= content &&
+			size - content < packet_size &&
+			!(size % packet_size),
+			"A packet is sized after its content when it does not fit");
+		ok(be64toh(entries[1].packet_size) == packet_size,
+			"A packet keeps the stream's packet size when its content fits");
+	}
+
+	bt_ctf_writer_flush_metadata(fixture.writer);
+	validate_trace(parser_path, fixture.trace_path);
+	validate_packet_index(fixture.trace_path);
+end:
+	bt_put(note);
+	bt_put(packet_context);
+	bt_put(packet_context_type);
+	bt_put(integer_type);
+	bt_put(string_type);
+	stream_fixture_fini(&fixture);
+}
+
 void append_existing_event_class(struct bt_ctf_stream_class *stream_class)
 {
 	struct bt_ctf_event_class *event_class;
@@ -2709,6 +4074,12 @@ int main(int argc, char **argv)
 		"Set a trace's byte order to big endian");
 	ok(bt_ctf_trace_get_byte_order(trace) == BT_CTF_BYTE_ORDER_BIG_ENDIAN,
 		"bt_ctf_trace_get_byte_order returns a correct endianness");
+	ok(bt_ctf_writer_set_io_mode(NULL, BT_CTF_WRITER_IO_MODE_PWRITE) < 0,
+		"bt_ctf_writer_set_io_mode handles NULL correctly");
+	ok(bt_ctf_writer_set_io_mode(writer, 42) < 0,
+		"bt_ctf_writer_set_io_mode rejects an invalid I/O mode");
+	ok(bt_ctf_writer_set_io_mode(writer, BT_CTF_WRITER_IO_MODE_MMAP) == 0,
+		"Set a writer's I/O mode");
 
 	/* Add environment context to the trace */
 	ret = gethostname(hostname, sizeof(hostname));
@@ -3176,6 +4547,8 @@ int main(int argc, char **argv)
 	/* Instantiate a stream and append events */
 	stream1 = bt_ctf_writer_create_stream(writer, stream_class);
 	ok(stream1, "Instanciate a stream class from writer");
+	ok(bt_ctf_writer_set_io_mode(writer, BT_CTF_WRITER_IO_MODE_PWRITE) < 0,
+		"bt_ctf_writer_set_io_mode fails once a stream was created");
 
 	ok(bt_ctf_stream_get_class(NULL) == NULL,
 		"bt_ctf_stream_get_class correctly handles NULL");
@@ -3261,12 +4634,35 @@ int main(int argc, char **argv)
 
 	test_custom_event_header_stream(writer);
 
+	test_streaming_stream(writer);
+
+	test_event_recycling(writer);
+
+	test_payload_set_tracking(writer);
+
+	test_event_context_sampling(writer);
+
+	test_columnar_append(writer);
+
+	test_columnar_timestamp_range(writer);
+
+	test_flat_layout(writer);
+
+	test_event_class_lookup(writer);
+
+	test_pwrite_io_mode(argv[2]);
+
+	test_packet_sizing(argv[2]);
+
+	test_metadata_append();
+
 	metadata_string = bt_ctf_writer_get_metadata_string(writer);
 	ok(metadata_string, "Get metadata string");
 
 	bt_ctf_writer_flush_metadata(writer);
 	validate_metadata(argv[1], metadata_path);
 	validate_trace(argv[2], trace_path);
+	validate_packet_index(trace_path);
 
 	bt_put(clock);
 	bt_put(ret_stream_class);
@@ -3289,20 +4685,6 @@ int main(int argc, char **argv)
 	bt_put(stream_class);
 
 	/* Remove all trace files and delete temporary trace directory */
-	DIR *trace_dir = opendir(trace_path);
-	if (!trace_dir) {
-		perror("# opendir");
-		return -1;
-	}
-
-	struct dirent *entry;
-	while ((entry = readdir(trace_dir))) {
-		if (entry->d_type == DT_REG) {
-			unlinkat(dirfd(trace_dir), entry->d_name, 0);
-		}
-	}
-
-	rmdir(trace_path);
-	closedir(trace_dir);
+	delete_trace(trace_path);
 	return 0;
 }
@@ -0,0 +1,193 @@
+/*
+ * test_ctf_writer_mt.c
+ *
+ * CTF Writer multi-threaded stress test
+ *
+ * Each thread creates its own stream of a shared stream class and
+ * appends and flushes events concurrently with the other threads while
+ * the main thread flushes the metadata.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; under version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <babeltrace/ctf-writer/writer.h>
+#include <babeltrace/ctf-writer/clock.h>
+#include <babeltrace/ctf-writer/stream.h>
+#include <babeltrace/ctf-writer/event.h>
+#include <babeltrace/ctf-writer/event-types.h>
+#include <babeltrace/ctf-writer/event-fields.h>
+#include <babeltrace/ctf-ir/stream-class.h>
+#include <babeltrace/ref.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "tap/tap.h"
+#include "common.h"
+
+#define NR_THREADS 8
+#define NR_EVENTS 20000
+#define FLUSH_INTERVAL 1000
+
+struct thread_data {
+	pthread_t thread;
+	struct bt_ctf_writer *writer;
+	struct bt_ctf_stream_class *stream_class;
+	struct bt_ctf_event_class *event_class;
+	int ret;
+};
+
+static
+void *producer_func(void *data)
+{
+	struct thread_data *td = data;
+	struct bt_ctf_stream *stream;
+	int i, ret = 0;
+
+	stream = bt_ctf_writer_create_stream(td->writer, td->stream_class);
+	if (!stream) {
+		ret = -1;
+		goto end;
+	}
+
+	for (i = 0; i < NR_EVENTS && !ret; i++) {
+		struct bt_ctf_event *event;
+		struct bt_ctf_field *field;
+
+		event = bt_ctf_event_create(td->event_class);
+		if (!event) {
+			ret = -1;
+			break;
+		}
+		field = bt_ctf_event_get_payload(event, "value");
+		ret = bt_ctf_field_unsigned_integer_set_value(field, i);
+		ret |= bt_ctf_stream_append_event(stream, event);
+		bt_put(field);
+		bt_put(event);
+		if (!ret && (i + 1) % FLUSH_INTERVAL == 0) {
+			ret = bt_ctf_stream_flush(stream);
+		}
+	}
+	if (!ret) {
+		ret = bt_ctf_stream_flush(stream);
+	}
+end:
+	bt_put(stream);
+	td->ret = ret;
+	return NULL;
+}
+
+/* Return the number of events read by babeltrace, -1 on error. */
+static
+long count_trace_events(const char *babeltrace_path, const char *trace_path)
+{
+	char *cmd;
+	char line[512];
+	FILE *fp;
+	long count = 0;
+
+	if (asprintf(&cmd, "%s %s", babeltrace_path, trace_path) < 0) {
+		return -1;
+	}
+	fp = popen(cmd, "r");
+	free(cmd);
+	if (!fp) {
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (strstr(line, "mt_event")) {
+			count++;
+		}
+	}
+	if (pclose(fp)) {
+		return -1;
+	}
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	char trace_path[] = "/tmp/ctfwriter_mt_XXXXXX";
+	struct bt_ctf_writer *writer;
+	struct bt_ctf_clock *clock;
+	struct bt_ctf_stream_class *stream_class;
+	struct bt_ctf_event_class *event_class;
+	struct bt_ctf_field_type *integer_type;
+	struct thread_data threads[NR_THREADS];
+	int i, ret, failed = 0;
+
+	if (argc < 2) {
+		printf("Usage: test_ctf_writer_mt path_to_babeltrace\n");
+		return -1;
+	}
+
+	plan_no_plan();
+
+	if (!mkdtemp(trace_path)) {
+		perror("# perror");
+		return -1;
+	}
+
+	writer = bt_ctf_writer_create(trace_path);
+	clock = bt_ctf_clock_create("mt_clock");
+	stream_class = bt_ctf_stream_class_create("mt_stream");
+	event_class = bt_ctf_event_class_create("mt_event");
+	integer_type = bt_ctf_field_type_integer_create(32);
+	assert(writer && clock && stream_class && event_class &&
+		integer_type);
+
+	ret = bt_ctf_writer_add_clock(writer, clock);
+	ret |= bt_ctf_stream_class_set_clock(stream_class, clock);
+	ret |= bt_ctf_event_class_add_field(event_class, integer_type,
+		"value");
+	ret |= bt_ctf_stream_class_add_event_class(stream_class, event_class);
+	ok(ret == 0, "Create the shared stream and event classes");
+
+	for (i = 0; i < NR_THREADS; i++) {
+		threads[i].writer = writer;
+		threads[i].stream_class = stream_class;
+		threads[i].event_class = event_class;
+		threads[i].ret = -1;
+		ret = pthread_create(&threads[i].thread, NULL, producer_func,
+			&threads[i]);
+		assert(!ret);
+	}
+
+	/* Generate the metadata concurrently with the producers. */
+	for (i = 0; i < 100; i++) {
+		bt_ctf_writer_flush_metadata(writer);
+	}
+
+	for (i = 0; i < NR_THREADS; i++) {
+		pthread_join(threads[i].thread, NULL);
+		failed |= threads[i].ret;
+	}
+	ok(!failed, "Append and flush events from %d threads", NR_THREADS);
+
+	bt_ctf_writer_flush_metadata(writer);
+	ok(count_trace_events(argv[1], trace_path) ==
+		(long) NR_THREADS * NR_EVENTS,
+		"Read back all the events written by the threads");
+
+	bt_put(integer_type);
+	bt_put(event_class);
+	bt_put(stream_class);
+	bt_put(clock);
+	bt_put(writer);
+	delete_trace(trace_path);
+	return exit_status();
+}
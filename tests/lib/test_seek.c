@@ -33,7 +33,7 @@
 #include <tap/tap.h>
 #include "common.h"
 
-#define NR_TESTS	29
+#define NR_TESTS	34
 
 void run_seek_begin(char *path, uint64_t expected_begin)
 {
@@ -291,6 +291,77 @@ void run_seek_cycles(char *path,
 	bt_context_put(ctx);
 }
 
+void run_seek_time_range(char *path,
+		uint64_t expected_begin,
+		uint64_t expected_last)
+{
+	struct bt_context *ctx;
+	struct bt_ctf_iter *iter;
+	struct bt_ctf_event *event;
+	struct bt_iter_pos begin_pos, end_pos;
+	int ret, nr_events = 0, past_end = 0;
+	unsigned int nr_seek_time_range_tests;
+
+	nr_seek_time_range_tests = 5;
+
+	/* Open the trace */
+	ctx = create_context_with_path(path);
+	if (!ctx) {
+		skip(nr_seek_time_range_tests, "Cannot create valid context");
+		return;
+	}
+
+	/* Window containing only the last timestamp */
+	begin_pos.type = BT_SEEK_TIME;
+	begin_pos.u.seek_time = expected_last;
+	end_pos.type = BT_SEEK_TIME;
+	end_pos.u.seek_time = expected_last;
+	iter = bt_ctf_iter_create(ctx, &begin_pos, &end_pos);
+	if (!iter) {
+		skip(nr_seek_time_range_tests, "Cannot create valid iterator");
+		bt_context_put(ctx);
+		return;
+	}
+
+	event = bt_ctf_iter_read_event(iter);
+
+	ok(event, "Event valid at range begin");
+	ok(event && bt_ctf_get_timestamp(event) == expected_last,
+		"First event of the range is the last event");
+
+	ret = bt_iter_next(bt_ctf_get_iter(iter));
+
+	ok(ret == 0, "iter next at range end retval %d", ret);
+
+	event = bt_ctf_iter_read_event(iter);
+
+	ok(event == 0, "Event after range end should be invalid");
+
+	bt_ctf_iter_destroy(iter);
+
+	/* Window ending at the first timestamp */
+	end_pos.u.seek_time = expected_begin;
+	iter = bt_ctf_iter_create(ctx, NULL, &end_pos);
+	if (!iter) {
+		skip(1, "Cannot create valid iterator");
+		bt_context_put(ctx);
+		return;
+	}
+	while ((event = bt_ctf_iter_read_event(iter))) {
+		if (bt_ctf_get_timestamp(event) > expected_begin)
+			past_end = 1;
+		nr_events++;
+		if (bt_iter_next(bt_ctf_get_iter(iter)) < 0)
+			break;
+	}
+
+	ok(nr_events > 0 && !past_end,
+		"Only events up to range end are read (%d)", nr_events);
+
+	bt_ctf_iter_destroy(iter);
+	bt_context_put(ctx);
+}
+
 int main(int argc, char **argv)
 {
 	char *path;
@@ -328,6 +399,7 @@ int main(int argc, char **argv)
 	run_seek_time_at_last(path, expected_last);
 	run_seek_last(path, expected_last);
 	run_seek_cycles(path, expected_begin, expected_last);
+	run_seek_time_range(path, expected_begin, expected_last);
 
 	return exit_status();
 }